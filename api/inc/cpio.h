@@ -11,9 +11,11 @@ extern "C" {
 
 
 #define CPIO_ADDR ((void*)0x8000000) // 0x20000000 for bare-metal rpi, 0x8000000 for qemu
-#define CPIO_MAX_FILES 32
+#define CPIO_INDEX_MIN_FILES 64 // initial capacity of cpio_index.files
 #define CPIO_MAGIC_NUM 0x070701
 #define CPIO_END_RECORD "TRAILER!!!"
+#define CPIO_MODE_TYPE 0170000  // file type bits of c_mode
+#define CPIO_MODE_DIR  0040000
 
 // For more details: https://www.freebsd.org/cgi/man.cgi?query=cpio&sektion=5
 
@@ -35,23 +37,57 @@ typedef struct __cpio_newc_header{
   uint8_t c_check[8];
 } cpio_newc_header_t;
 
-typedef struct __cpio_file{
-  uint8_t *pathname;       // string
+// Entry of the archive, pathname and data point into the archive itself
+typedef struct cpio_file{
+  const char *pathname;   // not ended by '\0' for a directory only implied by pathnames of files under it
+  uint16_t path_len;
+  uint8_t is_dir;
   uint32_t file_size;
+  uint32_t hash;          // of pathname, see cpio_index_find()
   uint8_t *data_ptr;
-  struct __cpio_file* next;
-} cpio_file_ll; // ll for linked list
+} cpio_file;
+
+/* Index of an archive, files[] keeps archive order and slots hash pathnames to files[].
+ * Leading "./" is dropped from pathnames, and every parent directory of a file has an entry.
+ * Built on first use, since the archive is found by fdtb_parse() before diy_malloc() is ready.
+*/
+typedef struct cpio_index{
+  cpio_file *files;
+  size_t cnt;
+  size_t cap;             // capacity of files, doubled when full
+  int32_t *slots;         // index into files, -1 for empty slot, linear probing
+  size_t slot_cnt;        // power of 2, at least twice cnt
+} cpio_index;
 
 typedef int (cpio_parse_func) (void*); // function of ( int cpio_parse(void *addr); )
 int cpio_parse(void *addr);
+int cpio_parse_extent(void *start, void *end);
+size_t cpio_image_size();
 void cpio_ls();
 int cpio_copy(char *file_name, uint8_t *destination);
 int cpio_cat(char *file_name);
 
+int cpio_index_build(cpio_index *idx, void *addr);
+const cpio_file *cpio_index_find(const cpio_index *idx, const char *pathname);
+const cpio_file *cpio_index_find_n(const cpio_index *idx, const char *pathname, size_t len);
+const cpio_file *cpio_index_child(const cpio_index *idx, const cpio_file *dir, const char *name);
+size_t cpio_index_next_child(const cpio_index *idx, const cpio_file *dir, size_t i, char *name);
+void cpio_index_release(cpio_index *idx);
+const cpio_index *cpio_get_index();
+void cpio_bench(int n);
+
 
 // initramfs, API to virtual_file_system.h --------------------------------
 
+// vnode of initramfs, knows where it is in the archive, so entries under it are found on their first lookup
+typedef struct initramfs_node{
+  tmpfs_entry entry;      // first, so a vnode of initramfs is also an initramfs_node
+  const cpio_file *file;  // NULL for root of the archive
+  int populated;          // every entry under this directory has a vnode
+} initramfs_node;
+
 extern filesystem initramfs;
+extern file_operations initramfs_fops;
 
 int initramfs_setup_mount(struct filesystem *fs, mount *mount);
 // fops
@@ -59,11 +95,13 @@ int initramfs_write(file *file, const void *buf, size_t len);
 int initramfs_read(file *file, void *buf, size_t len);
 int initramfs_open(vnode* file_node, file** target);
 int initramfs_close(file *file);
+long initramfs_lseek64(file *file, long offset, int whence);
 
 // vops
 int initramfs_mkdir(vnode *dir_node, vnode **target, const char *component_name);
 int initramfs_create(vnode *dir_node, vnode **target, const char *component_name);
 int initramfs_lookup(vnode *dir_node, vnode **target, const char *component_name);
+int initramfs_populate(vnode *dir_node);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,45 @@
+#ifndef __DCACHE_H_
+#define __DCACHE_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "virtual_file_system.h"
+#include "tmpfs.h"
+
+// Direct-mapped cache of path components, keyed by (directory vnode, name).
+// Directories are the ones after crossing mount points, so an entry never needs to know about mounts.
+#define DCACHE_SIZE       256         // power of 2
+#define DCACHE_HASH_INIT  2166136261u // FNV-1a offset basis
+
+typedef struct dcache_entry{
+  vnode *dir;       // NULL for empty slot
+  vnode *node;      // NULL for negative entry, i.e. name known not to exist under dir
+  uint32_t hash;
+  uint32_t len;
+  char name[TMPFS_MAX_COMPONENT_NAME];
+} dcache_entry;
+
+typedef struct dcache_stat{
+  uint64_t hits;
+  uint64_t negative_hits;   // included in hits
+  uint64_t misses;
+  uint64_t flushes;
+} dcache_stat;
+
+// FNV-1a, one byte at a time so the hash is computed while scanning a path
+static inline uint32_t dcache_hash_step(uint32_t hash, char c){
+  return (hash ^ (uint8_t)c) * 16777619u;
+}
+
+int  dcache_lookup(vnode *dir, const char *name, size_t len, uint32_t hash, vnode **target);
+void dcache_insert(vnode *dir, const char *name, size_t len, uint32_t hash, vnode *node);
+void dcache_flush();
+void dcache_dump_stat();
+
+#ifdef __cplusplus
+}
+#endif
+#endif  // __DCACHE_H_
@@ -15,6 +15,7 @@ int devfs_read(file *file, void *buf, size_t len);
 int devfs_open(vnode* file_node, file** target);
 int devfs_close(file *file);
 long devfs_lseek(file *file, long offset, int whence);
+int devfs_poll(file *file);
 
 // vops
 int devfs_mkdir(vnode *dir_node, vnode **target, const char *component_name);
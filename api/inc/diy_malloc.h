@@ -39,6 +39,7 @@ void alloc_page_init();
 int alloc_page(int page_cnt, int verbose);
 int free_page(int page_index, int verbose);
 void mem_reserve(uint64_t start, uint64_t end);
+void mem_release(uint64_t start, uint64_t end);
 void mem_reserve_kernel_vm(uint64_t start, uint64_t end);
 
 // Dump functions
@@ -46,6 +47,11 @@ void dump_the_frame_array();
 void dupmp_frame_freelist_arr();
 void dump_chunk();
 
+// Reference count of pages shared between address spaces
+int page_ref_inc(uint64_t addr);
+int page_ref_dec(uint64_t addr);
+int page_ref_get(uint64_t addr);
+
 void *diy_malloc(size_t size);
 void diy_free(void *addr);
 
@@ -5,10 +5,65 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
 #include "virtual_file_system.h"
+#include "tmpfs.h"
+#include "sd.h"
+
+#define FAT32_CACHE_SECTORS 32  // metadata sectors kept in memory
+#define FAT32_MIN_EXTENT    4   // initial capacity of extents of a file, doubled when full
+#define FAT32_FLUSH_MS      1000  // dirty metadata is written back by fat32fs_flusher() at most this long after it is modified
+
+// Run of contiguous clusters of a file
+typedef struct fat32_extent{
+  uint32_t file_cluster;  // index of its first cluster within the file
+  uint32_t cluster;       // its first cluster on the volume
+  uint32_t cnt;
+} fat32_extent;
+
+// Vnode of a file of FAT32, comp->lba is the first cluster of its chain, 0 if it has none
+typedef struct fat32_node{
+  tmpfs_entry entry;        // first, so a vnode of fat32fs is also a fat32_node
+  fat32_extent *extents;    // cluster chain as extents sorted by file_cluster, walked through FAT once on first access
+  size_t extent_cnt;
+  size_t extent_cap;
+  size_t extent_hint;       // extent of the last access, tried before searching
+  uint32_t cluster_cnt;     // clusters in the chain
+  uint8_t extents_loaded;
+  uint32_t dirent_phy_bk;   // directory entry of the file is entry dirent_idx of this sector
+  uint32_t dirent_idx;
+} fat32_node;
+
+// Sector of FAT or FSInfo in memory
+typedef struct fat32_sector{
+  uint32_t phy_bk;
+  uint8_t valid;
+  uint8_t dirty;    // modified, not written back to SD card yet
+  uint64_t last_use;
+  uint8_t data[SD_BLOCK_SIZE];
+} fat32_sector;
+
+typedef struct fat32_stat{
+  uint64_t sd_reads;      // readblock() of metadata
+  uint64_t sd_writes;     // writeblock() of metadata
+  uint64_t cache_hits;
+  uint64_t cache_misses;
+  uint64_t data_reads;    // readblock() of file data
+  uint64_t data_writes;   // writeblock() of file data
+  uint64_t flushes;       // fat32fs_sync() which wrote anything
+  uint32_t clusters;
+  uint32_t free_clusters;
+  uint32_t next_free;     // where the next allocation starts searching
+} fat32_stat;
 
 extern filesystem fat32fs;
 
+int fat32fs_sync();
+void fat32fs_tick();
+void fat32fs_flusher();
+void fat32fs_bench();
+const fat32_stat *fat32fs_get_stat();
+
 
 #ifdef __cplusplus
 }
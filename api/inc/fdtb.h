@@ -30,6 +30,7 @@ typedef struct __fdt_node_prop__{
 
 
 int fdtb_parse(void *dtb_addr, int print, cpio_parse_func *callback);
+int fdtb_get_initrd(uint64_t *start, uint64_t *end);
 
 #ifdef __cplusplus
 }
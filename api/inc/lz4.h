@@ -0,0 +1,23 @@
+#ifndef __LZ4_H_
+#define __LZ4_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Decoder of LZ4 compressed data, e.g. an initramfs made by "lz4 -l initfs.cp initfs.cp.lz4".
+// Both the frame format (lz4 default) and the legacy format (lz4 -l, used by Linux for initramfs) are accepted.
+// For more details: https://github.com/lz4/lz4/blob/dev/doc/lz4_Frame_format.md
+#define LZ4_FRAME_MAGIC   0x184D2204
+#define LZ4_LEGACY_MAGIC  0x184C2102
+#define LZ4_MIN_MATCH     4
+
+int lz4_is_compressed(const void *src);
+long lz4_decompress(const void *src, size_t src_len, void *dst, size_t dst_cap);
+
+#ifdef __cplusplus
+}
+#endif
+#endif  // __LZ4_H_
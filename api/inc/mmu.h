@@ -7,6 +7,7 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include "diy_malloc.h"
 
 // Should be reserved by mem_reserve_kernel_vm() if virtual memory is used
 #define PAGE_TABLE_STATICS_START_ADDR     0x1000
@@ -19,9 +20,29 @@ extern "C" {
 #define CLEAR_LOW_12bit(num)  ((num) & 0xFFFFFFFFFFFFF000)
 #define KERNEL_VA_TO_PA(addr) (((uint64_t)(addr)) & 0x0000FFFFFFFFFFFF)
 #define KERNEL_PA_TO_VA(addr) (((uint64_t)(addr)) | 0xFFFF000000000000)
+#define PAGE_FLOOR(addr)      (((uint64_t)(addr)) & ~((uint64_t)PAGE_SIZE - 1))
+#define PAGE_CEIL(addr)       PAGE_FLOOR((uint64_t)(addr) + PAGE_SIZE - 1)
+#define ENTRY_GET_PA(entry)   (((uint64_t)(entry)) & 0x0000FFFFFFFFF000)
+
+// flags of map_pages_counted()
+#define MMU_MAP_READ_WRITE    0
+#define MMU_MAP_READ_ONLY     (1 << 0)
+#define MMU_MAP_COPY_ON_WRITE (1 << 1)
+
+// Range of virtual address, [start, end)
+typedef struct vm_area{
+  uint64_t start;
+  uint64_t end;
+} vm_area;
 
 uint64_t *new_page_table();
 void map_pages(uint64_t *pgd, uint64_t va_start, uint64_t pa_start, int num);
+void map_pages_counted(uint64_t *pgd, uint64_t va_start, uint64_t pa_start, int num, int flags);
+void unmap_pages(uint64_t *pgd, uint64_t va_start, int num);
+int detach_pages(uint64_t *pgd, uint64_t va_start, int num, uint64_t *frames);
+uint64_t *page_table_walk(uint64_t *pgd, uint64_t va, int create);
+int mmu_page_fault(uint64_t *pgd, uint64_t far, uint64_t esr, const vm_area *zero_areas, int area_cnt);
+void free_page_table(uint64_t *pgd);
 void dump_page_table(uint64_t *pgd);
 void copy_page_table(uint64_t *from, uint64_t *to);
 void *virtual_mem_translate(void *virtual_addr);
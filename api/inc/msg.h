@@ -0,0 +1,54 @@
+#ifndef __MSG_H_
+#define __MSG_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "thread.h"
+
+// Message passing between processes.
+// With virtual memory, whole pages of a page aligned buffer are moved from sender to receiver by page table entries,
+// so large messages are not copied, and those pages of the sender's buffer read as zeros after sending.
+// Other messages are copied once into the kernel and once out.
+#define MSG_MAX_SIZE   (PAGE_SIZE * 256)  // 1 MB
+#define MSG_QUEUE_MAX  16                 // pending messages of a process, sender blocks when full
+
+typedef struct message{
+  int from;               // pid of sender
+  size_t len;
+  size_t page_cnt;        // > 0 if payload is in frames[], page i holds bytes from i*PAGE_SIZE
+  uint64_t *frames;       // kernel address of each frame, each holds one reference for the message
+  uint8_t *data;          // payload copied from sender, if page_cnt is 0
+  struct message *next;
+} message;
+
+typedef struct msg_queue{
+  message *head;
+  message *tail;
+  int cnt;
+  wait_queue rd_wait;     // receivers blocked on empty queue
+  wait_queue wr_wait;     // senders blocked on full queue
+} msg_queue;
+
+typedef struct msg_stat{
+  uint64_t pages_moved;   // pages whose frame changed address space without copying
+  uint64_t pages_copied;  // pages that went through memcpy_()
+} msg_stat;
+
+// Kernel side, called by system calls for the current thread
+long msg_send(int pid, const void *buf, size_t len);
+long msg_recv(void *buf, size_t len, int *from);
+void msg_queue_close(msg_queue *mq);
+void msg_queue_release(msg_queue *mq);
+const msg_stat *msg_get_stat();
+
+// User side
+void msg_bench();
+
+#ifdef __cplusplus
+}
+#endif
+#endif  // __MSG_H_
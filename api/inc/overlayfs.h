@@ -0,0 +1,54 @@
+#ifndef __OVERLAYFS_H_
+#define __OVERLAYFS_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "virtual_file_system.h"
+#include "tmpfs.h"
+#include "cpio.h"
+
+// Writable view of initramfs, the archive is the lower layer and tmpfs vnodes are the upper layer.
+// A file of the archive is read in place until its first write copies it up into tmpfs,
+// and a removed entry of the archive is kept as a whiteout of its directory, so it is not found again.
+#define OVERLAY_MIN_WHITEOUT 4 // initial capacity of whiteouts of a directory, doubled when full
+
+typedef struct overlay_node{
+  tmpfs_entry entry;        // first, so a vnode of overlay is also an overlay_node
+  const cpio_file *lower;   // entry of the archive, NULL for root of the archive or an entry only in upper
+  uint8_t has_lower;        // COMP_DIR: lower has entries under it; COMP_FILE: comp->data points into the archive, not copied up
+  uint8_t populated;        // every entry of lower under this directory has a vnode
+  size_t whiteout_cnt;
+  size_t whiteout_cap;
+  char (*whiteouts)[TMPFS_MAX_COMPONENT_NAME];  // names of entries of lower removed from this directory
+} overlay_node;
+
+typedef struct overlay_stat{
+  uint64_t copy_ups;        // files copied from the archive into tmpfs
+  uint64_t bytes_copied;
+  uint64_t whiteouts;       // entries of the archive removed
+} overlay_stat;
+
+extern filesystem overlayfs;
+extern file_operations overlay_fops;
+
+int overlay_setup_mount(struct filesystem *fs, mount *mount);
+const overlay_stat *overlay_get_stat();
+// fops
+int overlay_write(file *file, const void *buf, size_t len);
+int overlay_read(file *file, void *buf, size_t len);
+int overlay_open(vnode* file_node, file** target);
+int overlay_close(file *file);
+long overlay_lseek64(file *file, long offset, int whence);
+
+// vops
+int overlay_mkdir(vnode *dir_node, vnode **target, const char *component_name);
+int overlay_create(vnode *dir_node, vnode **target, const char *component_name);
+int overlay_lookup(vnode *dir_node, vnode **target, const char *component_name);
+int overlay_populate(vnode *dir_node);
+int overlay_unlink(vnode *dir_node, const char *component_name);
+
+#ifdef __cplusplus
+}
+#endif
+#endif  // __OVERLAYFS_H_
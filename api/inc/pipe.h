@@ -0,0 +1,37 @@
+#ifndef __PIPE_H_
+#define __PIPE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "virtual_file_system.h"
+#include "thread.h"
+
+#define PIPE_BUF_SIZE PAGE_SIZE   // power of 2
+
+/* Single producer single consumer ring of a pipe.
+ * head and tail run freely and wrap at 2^32, bytes in ring = tail - head.
+ * Reader only writes head, writer only writes tail, so no lock is needed.
+*/
+typedef struct pipe_t{
+  uint32_t head;          // next byte to read, written by reader
+  uint32_t tail;          // next byte to write, written by writer
+  uint8_t *buf;           // PIPE_BUF_SIZE bytes
+  int readers;            // opened handles of the read end
+  int writers;            // opened handles of the write end
+  wait_queue rd_wait;     // readers blocked on empty ring
+  wait_queue wr_wait;     // writers blocked on full ring
+  vnode rd_node;          // vnode of the read end
+  vnode wr_node;          // vnode of the write end
+  vnode_comp comp;        // shared by both ends, comp.data points to this pipe
+} pipe_t;
+
+int pipe_create(file **rd, file **wr);
+void pipe_bench();
+
+#ifdef __cplusplus
+}
+#endif
+#endif  // __PIPE_H_
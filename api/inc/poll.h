@@ -0,0 +1,22 @@
+#ifndef __POLL_H_
+#define __POLL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "virtual_file_system.h"
+
+/* Pollers sleep on a single wait queue, off the run queue.
+ * They are woken when any source may have changed, i.e. poll_wake() from a pipe or the uart rx interrupt,
+ * or when the earliest timeout expires, checked by poll_tick() on every timer interrupt.
+*/
+int  poll_fds(pollfd *fds, int nfds, int timeout_ms);
+void poll_wake();
+void poll_tick();
+
+#ifdef __cplusplus
+}
+#endif
+#endif  // __POLL_H_
@@ -0,0 +1,78 @@
+#ifndef __PROGRAM_LOADER_H_
+#define __PROGRAM_LOADER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "virtual_file_system.h"
+#include "thread.h"
+
+// ELF64, see https://refspecs.linuxfoundation.org/elf/gabi4+/ch4.eheader.html
+#define ELF_MAGIC       0x464C457F  // "\x7FELF" in little endian
+#define ELF_CLASS_64    2
+#define ELF_MACHINE_AARCH64 183
+#define ELF_TYPE_EXEC   2
+#define ELF_TYPE_DYN    3
+#define ELF_PT_LOAD     1
+#define ELF_PF_X        (1 << 0)
+#define ELF_PF_W        (1 << 1)
+#define ELF_PF_R        (1 << 2)
+
+typedef struct elf64_header_t{
+  uint32_t e_magic;       // ELF_MAGIC
+  uint8_t  e_class;       // ELF_CLASS_64
+  uint8_t  e_data;        // 1 for little endian
+  uint8_t  e_version_id;
+  uint8_t  e_pad[9];
+  uint16_t e_type;        // ELF_TYPE_EXEC or ELF_TYPE_DYN
+  uint16_t e_machine;     // ELF_MACHINE_AARCH64
+  uint32_t e_version;
+  uint64_t e_entry;       // virtual address of entry point
+  uint64_t e_phoff;       // offset of program header table
+  uint64_t e_shoff;
+  uint32_t e_flags;
+  uint16_t e_ehsize;
+  uint16_t e_phentsize;   // size of a program header
+  uint16_t e_phnum;       // count of program headers
+  uint16_t e_shentsize;
+  uint16_t e_shnum;
+  uint16_t e_shstrndx;
+} elf64_header_t;
+
+typedef struct elf64_phdr_t{
+  uint32_t p_type;        // ELF_PT_LOAD for loadable segment
+  uint32_t p_flags;       // ELF_PF_X, ELF_PF_W, ELF_PF_R
+  uint64_t p_offset;      // offset of segment in file
+  uint64_t p_vaddr;       // virtual address of segment
+  uint64_t p_paddr;
+  uint64_t p_filesz;      // bytes in file, the rest up to p_memsz is .bss
+  uint64_t p_memsz;       // bytes in memory
+  uint64_t p_align;
+} elf64_phdr_t;
+
+#define PROGRAM_FLAT_PAGES 64  // space of a flat image: the file, then zero-filled .bss, globals and heap, which objcopy -O binary drops
+
+// Image of a program on a read-only file system, loaded once and shared by every process that execs it
+typedef struct program_image{
+  vnode *node;        // the vnode the image is loaded from, key of the cache
+  uint8_t *addr;      // kernel address of the image, page aligned
+  size_t size;        // file size in bytes
+  int page_cnt;       // pages occupied by the image
+  int in_place;       // 1 if addr is the file data in the archive itself, nothing copied, see image_in_place()
+  uint8_t *tail;      // in place only: zero padded copy of the last page if the file ends inside it, NULL otherwise
+  int exec_cnt;       // times the image is exec'ed, for debug purpose
+  struct program_image *next;
+} program_image;
+
+program_image *program_image_get(const char *pathname);
+void program_image_dump();
+int program_load(const char *pathname, thread_t *thd, uint64_t *entry, void **space);
+void program_load_bench(const char *pathname);
+
+#ifdef __cplusplus
+}
+#endif
+#endif  // __PROGRAM_LOADER_H_
@@ -0,0 +1,46 @@
+#ifndef __SHM_H_
+#define __SHM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mmu.h"
+
+// Shared memory segments, the same frames are mapped into every process that maps the segment, so nothing is copied.
+#define SHM_MAX_SEGMENT 16
+#define SHM_VA_START    0x0000100000000000  // with virtual memory, where kernel chosen mappings start
+
+/* Each page of a segment holds one reference for the segment itself and one per mapping.
+ * A process without page table of its own uses the kernel address, such mappings are counted by kernel_maps instead,
+ * and by the shm_maps[] of the process, so they are dropped when it exits.
+ * A segment is reaped after it is unlinked, kernel_maps is 0 and every page is back to the single reference of the segment.
+*/
+typedef struct shm_segment{
+  int used;
+  int key;
+  int unlinked;       // no new shm_open() finds it, freed once every mapping is gone
+  size_t pages;
+  uint8_t *addr;      // kernel address, page aligned and contiguous
+  int kernel_maps;    // mappings at addr by processes without page table of their own
+} shm_segment;
+
+// Kernel side
+int shm_get_or_create(int key, size_t size);
+shm_segment *shm_get(int id);
+int shm_unlink(int key);
+void shm_reap();
+int shm_kernel_map(int id, uint8_t *maps);
+int shm_kernel_unmap(int id, uint8_t *maps);
+void shm_kernel_dup(const uint8_t *maps);
+void shm_kernel_release(uint8_t *maps);
+
+// User side
+void shm_bench();
+
+#ifdef __cplusplus
+}
+#endif
+#endif  // __SHM_H_
@@ -28,6 +28,18 @@ extern "C" {
   asm volatile("mov " #r ", %0" :: "r" (__val));    \
 })
 
+// Exception syndrome register (esr_el1) decoding
+#define ESR_ELx_EC(esr)           (((esr) >> 26) & 0x3F)  // exception class
+#define ESR_ELx_EC_SVC64          0x15                    // svc instruction execution in AArch64 state
+#define ESR_ELx_EC_DABT_LOW       0x24                    // data abort from a lower exception level
+#define ESR_ELx_EC_DABT_CUR       0x25                    // data abort without a change in exception level
+#define ESR_ELx_ISS_DFSC(esr)     ((esr) & 0x3F)          // data fault status code
+#define ESR_ELx_ISS_WNR(esr)      (((esr) >> 6) & 0x1)    // 1 if the abort is caused by writing
+#define ESR_DFSC_TRANSLATION_L0   0x04
+#define ESR_DFSC_TRANSLATION_L3   0x07
+#define ESR_DFSC_PERMISSION_L1    0x0D
+#define ESR_DFSC_PERMISSION_L3    0x0F
+
 // Trap frame for exeception handling, refer: save_all, check vect_table_and_execption_handler.S
 typedef struct trap_frame {
   uint64_t x0;  uint64_t x1;
@@ -0,0 +1,9 @@
+#ifndef __SYSCALL_ABI_H_
+#define __SYSCALL_ABI_H_
+
+// Shared by system_call.c and the exception vectors in vect_table_and_execption_handler.S,
+// so only preprocessor definitions go here.
+
+#define SYSCALL_TABLE_SIZE     64 // entries of each system call table, numbers in x8 at or above it are rejected
+
+#endif  // __SYSCALL_ABI_H_
@@ -0,0 +1,77 @@
+#ifndef __SYSCALL_RING_H_
+#define __SYSCALL_RING_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mmu.h"
+
+/* Submission/completion ring shared between a process and the kernel, for batching system calls.
+ * User fills submission entries and calls sysc_ring_enter() once for all of them,
+ * kernel executes the entries in order and posts a completion entry for each.
+ * Each side only writes the index it owns: user owns sq_tail and cq_head, kernel owns sq_head and cq_tail.
+ * Entries are handed out through sqe_tail, and published to the kernel by moving sq_tail in ring_submit(), after they are filled.
+*/
+#define SYSCALL_RING_ENTRIES  1024  // power of 2
+#define SYSCALL_RING_PAGES    ((sizeof(syscall_ring) + PAGE_SIZE - 1) / PAGE_SIZE)
+#define SYSCALL_RING_VA       (DEFAULT_THREAD_VA_STACK_START - 32*PAGE_SIZE)  // with virtual memory, below data page of vdso.h
+
+enum ring_op {
+  RING_OP_NOP = 0,
+  RING_OP_OPEN,     // addr: pathname, flags: flags of open
+  RING_OP_READ,     // fd, addr: buffer, len
+  RING_OP_WRITE,    // fd, addr: buffer, len
+  RING_OP_LSEEK,    // fd, off: offset, flags: whence
+  RING_OP_CLOSE     // fd
+};
+
+typedef struct ring_sqe{  // submission queue entry
+  uint32_t op;        // enum ring_op
+  int32_t  fd;
+  uint64_t addr;
+  uint64_t len;
+  int64_t  off;
+  uint32_t flags;
+  uint32_t padding;
+  uint64_t user_data; // copied to the completion entry as is
+} ring_sqe;
+
+typedef struct ring_cqe{  // completion queue entry
+  uint64_t user_data;
+  int64_t  res;       // return value of the operation
+} ring_cqe;
+
+typedef struct syscall_ring{
+  uint32_t sq_head;   // next entry kernel consumes
+  uint32_t sq_tail;   // next entry user fills
+  uint32_t cq_head;   // next entry user consumes
+  uint32_t cq_tail;   // next entry kernel fills
+  uint32_t sqe_tail;  // next entry ring_get_sqe() hands out, only used by user
+  ring_sqe sqes[SYSCALL_RING_ENTRIES];
+  ring_cqe cqes[SYSCALL_RING_ENTRIES];
+} syscall_ring;
+
+// Kernel side
+syscall_ring *syscall_ring_create();
+void syscall_ring_release(syscall_ring *ring);
+
+// User side
+syscall_ring *ring_setup();
+ring_sqe *ring_get_sqe(syscall_ring *ring);
+void ring_prep_open(ring_sqe *sqe, const char *pathname, int flags, uint64_t user_data);
+void ring_prep_read(ring_sqe *sqe, int fd, void *buf, size_t len, uint64_t user_data);
+void ring_prep_write(ring_sqe *sqe, int fd, const void *buf, size_t len, uint64_t user_data);
+void ring_prep_lseek(ring_sqe *sqe, int fd, long offset, int whence, uint64_t user_data);
+void ring_prep_close(ring_sqe *sqe, int fd, uint64_t user_data);
+int ring_submit(syscall_ring *ring);
+ring_cqe *ring_peek_cqe(syscall_ring *ring);
+void ring_cqe_seen(syscall_ring *ring);
+void ring_bench();
+
+#ifdef __cplusplus
+}
+#endif
+#endif  // __SYSCALL_RING_H_
@@ -7,9 +7,15 @@ extern "C" {
 #endif
 
 #include <stddef.h>
+#include <stdint.h>
 #include "sys_reg.h"
+#include "virtual_file_system.h"
 
 void system_call(trap_frame *tf);
+int  sync_exception_dispatch(trap_frame *tf);
+void syscall_fast_path_set(int enable);
+int  syscall_fast_path_get();
+void syscall_bench();
 
 int    sysc_getpid();
 size_t sysc_uart_read(char buf[], size_t size);
@@ -23,12 +29,39 @@ int    sysc_kill(int pid);
 
 // Virtual File System, system call ---------------
 int    sysc_open(const char *pathname, int flags);
+int    sysc_openat(int dirfd, const char *pathname, int flags);
 int    sysc_close(int fd);
 size_t sysc_write(int fd, const void *buf, size_t count);
 size_t sysc_read(int fd, void *buf, size_t count);
 int    sysc_mkdir(const char *pathname, unsigned mode);
 int    sysc_mount(const char *src, const char *target, const char *filesystem, unsigned long flags, const void *data);
 int    sysc_chdir(const char *path);
+long   sysc_lseek64(int fd, long offset, int whence);
+long   sysc_readv(int fd, const iovec *iov, int iovcnt);
+long   sysc_writev(int fd, const iovec *iov, int iovcnt);
+long   sysc_pread64(int fd, void *buf, size_t count, long offset);
+long   sysc_pwrite64(int fd, const void *buf, size_t count, long offset);
+int    sysc_pipe(int fds[2]);
+long   sysc_getdents(int fd, void *buf, size_t len);
+int    sysc_unlink(const char *pathname);
+int    sysc_sync();
+
+// Shared memory, see shm.h
+int    sysc_shm_open(int key, size_t size);
+void  *sysc_shm_map(int id, void *va);
+int    sysc_shm_unmap(int id, void *va);
+int    sysc_shm_unlink(int key);
+
+// Message passing, see msg.h
+long   sysc_msg_send(int pid, const void *buf, size_t len);
+long   sysc_msg_recv(void *buf, size_t len, int *from);
+
+// Readiness of fds, see poll.h
+int    sysc_poll(pollfd *fds, int nfds, int timeout_ms);
+
+// Batched system call, see syscall_ring.h
+uint64_t sysc_ring_setup();
+int    sysc_ring_enter(unsigned to_submit);
 
 #ifdef __cplusplus
 }
@@ -9,14 +9,20 @@ extern "C" {
 #include "diy_malloc.h"
 #include "virtual_file_system.h"
 #include "tmpfs.h"
+#include "mmu.h"
+#include "vdso.h"
+#include "syscall_ring.h"
+#include "shm.h"
 
 #define DEFAULT_THREAD_SIZE (PAGE_SIZE*4) // 4kB, this includes the size of a stack and the thread's TCB
+#define THREAD_MAX_ZERO_AREA 4            // max count of areas zero-filled on demand, e.g. .bss of segments
 
 enum task_state {
   RUNNNING=1,
   WAIT_TO_RUN,
   EXITED,   // zombie, waiting to be cleaned
-  CLEANED   
+  CLEANED,
+  WAITING   // blocked on a wait_queue, not in run queue
 };
 enum task_exeception_level {
   USER=0,
@@ -53,12 +59,30 @@ typedef struct thread_t {
   void *target_func;
   file *fd_table[VFS_PROCESS_MAX_OPEN_FILE];  // should be zeroed out on thread_create
   char cwd[TMPFS_MAX_PATH_LEN];               // current working directory, should initialized on thread_create
+  vnode *cwd_node;                            // vnode of cwd, relative paths are looked up from here. NULL for root
+  vdso_data *vdso;                            // data page shared read-only to el0, see vdso.h
+  syscall_ring *ring;                         // created by sysc_ring_setup(), see syscall_ring.h
+  uint8_t shm_maps[SHM_MAX_SEGMENT];          // shared memory segments mapped at their kernel address, see shm.h
+  struct msg_queue *mq;                       // messages sent to this thread, created on first use, see msg.h
+#ifdef VIRTUAL_MEM
+  vm_area zero_areas[THREAD_MAX_ZERO_AREA];   // mapped to zeroed pages on first access, set by program_load()
+  int zero_area_cnt;
+  uint64_t shm_next_va;                       // where next kernel chosen shared memory mapping goes, see shm.h
+#endif
   struct thread_t *next;
+  struct thread_t *all_next;                  // list of threads not exited yet, for thread_find()
+  struct wait_queue *wq;                      // queue blocked on, for state=WAITING
 } thread_t;
 
+// Threads blocked on an event, e.g. pipe empty or full
+typedef struct wait_queue{
+  struct thread_t *head;
+} wait_queue;
+
 void idle();
 void thread_init();
 thread_t *thread_get_current();
+thread_t *thread_find(int pid);
 thread_t *thread_create(void *func, enum task_exeception_level mode);
 void start_scheduling();
 void schedule();
@@ -68,6 +92,9 @@ void exit_call_by_syscall_only();
 int kill_call_by_syscall_only(int pid);
 void thread_go_to_el0();
 int thread_get_idle_fd(thread_t *thd);
+void thread_set_vdso(thread_t *thd);
+void thread_wait(wait_queue *wq);
+void thread_wake_all(wait_queue *wq);
 
 #ifdef __cplusplus
 }
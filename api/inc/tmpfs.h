@@ -5,11 +5,52 @@ extern "C" {
 #endif
 
 #include "virtual_file_system.h"
+#include "diy_malloc.h"
 
 #define TMPFS_MAX_PATH_LEN 255
 #define TMPFS_MAX_COMPONENT_NAME 32
-#define TMPFS_MAX_ENTRY 16
-#define TMPFS_MAX_FILE_SIZE 4096
+#define TMPFS_DIR_MIN_ENTRY 16 // initial capacity of entries of a directory, doubled when full
+
+// File data is kept in pages of a radix tree, allocated on the first write to them.
+// Pages never written are holes, read as zeros and take no memory.
+#define TMPFS_RADIX_BITS 6                                 // 64 slots per node
+#define TMPFS_RADIX_SLOTS (1 << TMPFS_RADIX_BITS)
+#define TMPFS_RADIX_MAX_HEIGHT 4
+#define TMPFS_MAX_FILE_SIZE ((size_t)PAGE_SIZE << (TMPFS_RADIX_BITS * TMPFS_RADIX_MAX_HEIGHT)) // 64 GB
+
+// Slot of the open addressing hash of a directory, linear probing
+typedef struct dir_slot{
+  uint32_t hash;
+  vnode *node;      // NULL for empty slot
+} dir_slot;
+
+// Index of a directory. comp->entries keeps insertion order for listing, slots find an entry by name
+typedef struct dir_index{
+  size_t cap;       // capacity of comp->entries
+  size_t slot_cnt;  // power of 2, kept at least twice comp->len so probes stay short
+  size_t removed;   // NULL in comp->entries, left by tmpfs_unlink() while the directory is open
+  dir_slot *slots;
+} dir_index;
+
+// Interior node of the radix tree, slots point to nodes one level down or to pages at the bottom level
+typedef struct radix_node{
+  void *slots[TMPFS_RADIX_SLOTS];
+} radix_node;
+
+// Pages of a tmpfs file, hung on comp->pages
+typedef struct tmpfs_pages{
+  int height;       // levels of radix_node above the pages, root is a page itself if 0
+  void *root;       // NULL if the whole file is a hole
+  size_t page_cnt;  // pages allocated
+} tmpfs_pages;
+
+// A vnode, its component and a short name in one allocation, see tmpfs_node_alloc()
+#define TMPFS_INLINE_NAME 24
+typedef struct tmpfs_entry{
+  vnode node;
+  vnode_comp comp;
+  char name[TMPFS_INLINE_NAME];  // comp.comp_name points here if the name fits, or to its own allocation
+} tmpfs_entry;
 
 extern filesystem tmpfs;
 
@@ -18,13 +59,21 @@ int tmpfs_write(file *file, const void *buf, size_t len);
 int tmpfs_read(file *file, void *buf, size_t len);
 int tmpfs_open(vnode* file_node, file** target);
 int tmpfs_close(file *file);
+long tmpfs_lseek64(file *file, long offset, int whence);
 
 // vops
 int tmpfs_mkdir(vnode *dir_node, vnode **target, const char *component_name);
 int tmpfs_create(vnode *dir_node, vnode **target, const char *component_name);
 int tmpfs_lookup(vnode *dir_node, vnode **target, const char *component_name);
+int tmpfs_unlink(vnode *dir_node, const char *component_name);
 
 int tmpfs_setup_mount(struct filesystem *fs, mount *mount);
+vnode *tmpfs_node_alloc(const char *name);
+vnode *tmpfs_node_alloc_size(const char *name, size_t size);
+int tmpfs_link(vnode *dir_node, vnode *node);
+void tmpfs_pages_release(tmpfs_pages *pages);
+void tmpfs_dir_bench(int n);
+void tmpfs_sparse_bench();
 
 #ifdef __cplusplus
 }
@@ -26,5 +26,8 @@ void uart_rx_tx_handler();
 int uart_getc_async();
 int uart_gets_n_async(int n, char *str, int echo);
 void uart_puts_async(char *str);
+int uart_rx_ready();
+void uart_rx_irq_arm();
+void uart_rx_irq_disarm();
 
 #endif /* __UART_H */
@@ -0,0 +1,36 @@
+#ifndef __VDSO_H_
+#define __VDSO_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "mmu.h"
+
+// Per-process data page shared read-only to el0, so user can get pid and time without a system call.
+// Address of the page is kept in tpidrro_el0, which el0 can read but not write.
+#define VDSO_VA (DEFAULT_THREAD_VA_STACK_START - PAGE_SIZE)  // with virtual memory, mapped right below user stack
+
+typedef struct vdso_data{
+  int pid;
+  int ppid;
+  uint64_t cntfrq;        // frequency of cntpct_el0
+  uint64_t boot_cntpct;   // cntpct_el0 when kernel boots, base of monotonic time
+} vdso_data;
+
+// Kernel side
+void vdso_init();
+vdso_data *vdso_create(int pid, int ppid);
+void vdso_release(vdso_data *vdso);
+
+// User side, no system call involved
+int vdso_getpid();
+int vdso_getppid();
+uint64_t vdso_uptime_us();
+void vdso_bench();
+
+#ifdef __cplusplus
+}
+#endif
+#endif  // __VDSO_H_
@@ -10,7 +10,18 @@ extern "C" {
 
 #define VFS_MAX_DEPTH 64
 #define VFS_PROCESS_MAX_OPEN_FILE 16
+#define VFS_INLINE_DATA 32 // tmpfs files up to this size are kept in vnode_comp, no page needed
 #define O_CREAT 0100 // flag for vfs_open()
+#define O_DIRECTORY 040000  // flag for vfs_open(), open a directory, e.g. as dirfd of openat()
+#define AT_FDCWD -100       // dirfd of openat(), relative to cwd
+#define SEEK_SET 0    // whence of lseek64
+#define SEEK_CUR 1
+#define SEEK_END 2
+#define POLLIN   0x01 // events of poll, readable without blocking
+#define POLLOUT  0x04 // writable without blocking
+#define POLLERR  0x08 // write end of a pipe with no reader, always reported
+#define POLLHUP  0x10 // read end of a pipe with no writer, always reported
+#define POLLNVAL 0x20 // fd not opened, always reported
 
 typedef enum comp_type{
   COMP_FILE = 1,
@@ -27,12 +38,17 @@ typedef struct vnode{
 typedef struct vnode_comp{ // vnode component
   char *comp_name;
   enum comp_type type;
-  size_t len;       // COMP_DIR: entry count in this directory; COM_FILE: file size in byte
+  uint8_t data_paged;  // COMP_FILE of tmpfs: 1 once data moved from inline_data to pages, see tmpfs.c
+  size_t len;       // COMP_DIR: slots in entries, removed entries are NULL until compacted, see tmpfs_unlink(); COM_FILE: file size in byte
   union {
     vnode **entries; // for type of COMP_DIR
     char  *data;     // for type of COM_FILE
+    struct tmpfs_pages *pages;  // for type of COMP_FILE of tmpfs, see tmpfs.h
+    char inline_data[VFS_INLINE_DATA]; // for type of COMP_FILE of tmpfs, files of at most VFS_INLINE_DATA bytes
     uint32_t lba;    // for FAT32
   };
+  struct dir_index *index;  // COMP_DIR: entries hashed by name, NULL until the first entry, see tmpfs.c
+  uint32_t dir_handles;     // COMP_DIR: handles opened with O_DIRECTORY, which use index of entries as cookie
 } vnode_comp;
 
 // file handle
@@ -43,14 +59,38 @@ typedef struct file{
   int flags;
 } file;
 
+// Buffer of readv/writev
+typedef struct iovec{
+  void *iov_base;
+  size_t iov_len;
+} iovec;
+
+// Entry of poll
+typedef struct pollfd{
+  int fd;
+  short events;   // POLLIN and/or POLLOUT to watch
+  short revents;  // set by poll
+} pollfd;
+
+// Entry filled by getdents, records are packed back to back in the buffer
+typedef struct dirent{
+  uint64_t size;    // comp->len, bytes of a file or entry count of a directory
+  uint64_t off;     // cookie, f_pos of the directory handle to resume listing after this entry
+  uint16_t reclen;  // bytes of this record including name, multiple of 8, next record starts here
+  uint8_t  type;    // COMP_FILE or COMP_DIR
+  char     name[];  // ends with '\0'
+} dirent;
+
 typedef struct mount{
   struct vnode *root;
   struct filesystem *fs;
+  struct mount *next;   // mounts made by vfs_mount(), for vfs_sync()
 } mount;
 
 typedef struct filesystem{
   const char *name;
   int (*setup_mount)(struct filesystem *fs, mount *mount);
+  int (*sync)(mount *mount);  // write back what is kept dirty in memory, return sectors written, NULL if it keeps nothing dirty
 } filesystem;
 
 typedef struct file_operations{
@@ -59,12 +99,15 @@ typedef struct file_operations{
   int  (*open)   (vnode *file_node, struct file **target);
   int  (*close)  (file *file);
   long (*lseek64)(file *file, long offset, int whence);
+  int  (*poll)   (file *file);  // return POLL* events ready now, NULL if never blocks. Sources that may block call poll_wake() on change
 } file_operations;
 
 typedef struct vnode_operations{
   int (*lookup)(vnode *dir_node, vnode **target, const char *component_name);
   int (*create)(vnode *dir_node, vnode **target, const char *component_name);
   int (*mkdir) (vnode *dir_node, vnode **target, const char *component_name);
+  int (*populate)(vnode *dir_node);  // make every entry present in comp->entries before listing, NULL if they always are
+  int (*unlink)(vnode *dir_node, const char *component_name);  // remove an entry, NULL if the file system is read-only
 } vnode_operations;
 
 extern mount root_mount;
@@ -72,10 +115,21 @@ extern mount root_mount;
 
 int register_filesystem(filesystem *fs);
 int vfs_open(char *pathname, int flags, file **file_handle);
+int vfs_open_at(vnode *dir_node, char *pathname, int flags, file **file_handle);
 int vfs_close(file *file);
+int vfs_dup(file *file, struct file **target);
 int vfs_write(file *file, void *buf, size_t len);
 int vfs_read(file *file, void *buf, size_t len);
+long vfs_readv(file *file, const iovec *iov, int iovcnt);
+long vfs_writev(file *file, const iovec *iov, int iovcnt);
+int vfs_pread(file *file, void *buf, size_t len, size_t offset);
+int vfs_pwrite(file *file, const void *buf, size_t len, size_t offset);
+int vfs_poll(file *file);
+long vfs_getdents(file *dir, void *buf, size_t len);
 int vfs_mkdir(char *pathname);
+int vfs_unlink(char *pathname);
+int vfs_unlink_at(vnode *dir_node, char *pathname);
+int vfs_sync();
 int vfs_mount(char *pathname, const char *fs_name);
 int vfs_lookup(char *pathname, vnode **target);
 void vfs_dump_root();
@@ -83,6 +137,7 @@ void vfs_dump_under(vnode *node, int depth);
 
 int lookup_recur(char *pathname, vnode *dir_node, vnode **node_found, int create);
 int to_abs_path(char *abs_path, const char *cwd, const char *path);
+int normalize_path(char *out, const char *path);
 
 #ifdef __cplusplus
 }
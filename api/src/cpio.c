@@ -2,25 +2,32 @@
 #include <stdint.h>
 #include "diy_string.h"
 #include "cpio.h"
-#include "diy_sscanf.h"
 #include "uart.h"
 #include "virtual_file_system.h"
 #include "tmpfs.h"
 #include "diy_malloc.h"
+#include "diy_printf.h"
+#include "dcache.h"
+#include "sys_reg.h"
+#include "lz4.h"
 
 
-static cpio_file_ll files_arr[CPIO_MAX_FILES];
+static void *archive = NULL;  // cpio archive, set by cpio_parse_extent(), or decompressed from image by cpio_get_index()
+static void *image = NULL;    // initramfs as loaded by the boot loader, maybe compressed by LZ4
+static size_t image_size = 0;
+static cpio_index initrd;     // index of archive, built by cpio_get_index()
 static int mounted = 0;
 
 
-static uint32_t header_get_mem(uint8_t* member, size_t size){
-  static char str_buf[32];
-  uint32_t ret = 0;
-  memcpy_(str_buf, member, size);
-  str_buf[size] = '\0';
-  if(sscanf_(str_buf, "%8X", &ret) != 1)
-    return -1;
-  return ret;
+/** Decode n hex digits of a header field without branching on the digit.
+ * '0'-'9' are 0x30-0x39, 'A'-'F' and 'a'-'f' are 0x41-0x46 and 0x61-0x66,
+ * so bit 6 tells a letter, whose low nibble plus 9 is its value.
+*/
+static inline uint32_t hex_decode(const uint8_t *s, int n){
+  uint32_t val = 0;
+  for(int i=0; i<n; i++)
+    val = (val << 4) | ((s[i] & 0xF) + 9 * (s[i] >> 6));
+  return val;
 }
 
 static int pad_to_4(int num){
@@ -28,153 +35,401 @@ static int pad_to_4(int num){
   return modded==0 ? 0 : 4 - modded;
 }
 
+static uint32_t path_hash(const char *pathname, size_t len){
+  uint32_t hash = DCACHE_HASH_INIT;
+  for(size_t i=0; i<len; i++)
+    hash = dcache_hash_step(hash, pathname[i]);
+  return hash;
+}
+
+// Put files[i] into the slots, which are doubled first if more than half would be used
+static void cpio_index_slot_add(cpio_index *idx, size_t i){
+  if((i + 1) * 2 > idx->slot_cnt){
+    if(idx->slots != NULL)
+      diy_free(idx->slots);
+    idx->slot_cnt = idx->slot_cnt == 0 ? CPIO_INDEX_MIN_FILES : idx->slot_cnt * 2;
+    idx->slots = diy_malloc(sizeof(int32_t) * idx->slot_cnt);
+    memset_(idx->slots, 0xFF, sizeof(int32_t) * idx->slot_cnt);  // -1
+    for(size_t k=0; k<i; k++)
+      cpio_index_slot_add(idx, k);
+  }
+  size_t s = idx->files[i].hash & (idx->slot_cnt - 1);
+  while(idx->slots[s] >= 0)
+    s = (s + 1) & (idx->slot_cnt - 1);
+  idx->slots[s] = i;
+}
+
+// Add an entry, or update the one of the same pathname, e.g. a directory added before as a parent of a file
+static void cpio_index_add(cpio_index *idx, const cpio_file *file){
+  cpio_file *same = (cpio_file*)cpio_index_find_n(idx, file->pathname, file->path_len);
+  if(same != NULL){
+    *same = *file;
+    return;
+  }
+  if(idx->cnt == idx->cap){
+    const size_t cap = idx->cap == 0 ? CPIO_INDEX_MIN_FILES : idx->cap * 2;
+    cpio_file *files = diy_malloc(sizeof(cpio_file) * cap);
+    if(idx->cnt > 0){
+      memcpy_(files, idx->files, sizeof(cpio_file) * idx->cnt);
+      diy_free(idx->files);
+    }
+    idx->files = files;
+    idx->cap = cap;
+  }
+  idx->files[idx->cnt] = *file;
+  cpio_index_slot_add(idx, idx->cnt++);
+}
+
+// Bytes of the archive at addr till the end of its trailer, 0 on bad magic number
+static size_t cpio_archive_size(const void *addr){
+  const cpio_newc_header_t *header = (const cpio_newc_header_t*) addr;
+  while(hex_decode(header->c_magic, sizeof(header->c_magic)) == CPIO_MAGIC_NUM){
+    const uint32_t file_size = hex_decode(header->c_filesize, sizeof(header->c_filesize));
+    const uint32_t name_size = hex_decode(header->c_namesize, sizeof(header->c_namesize));
+    const uint8_t *data_ptr = (const uint8_t*)(&header[1]) + name_size + pad_to_4(name_size + sizeof(cpio_newc_header_t));
+    const int is_end = strcmp_(CPIO_END_RECORD, (const char*)(&header[1])) == 0;
+    header = (const cpio_newc_header_t*)( data_ptr + file_size + pad_to_4(file_size) );
+    if(is_end)
+      return (const uint8_t*)header - (const uint8_t*)addr;
+  }
+  return 0;
+}
+
+// Remember where the archive is, the index is built later by cpio_get_index()
 int cpio_parse(void *addr){
-  cpio_newc_header_t *header = (cpio_newc_header_t*) addr;
-  uint32_t magic_num = 0;
-  uint32_t file_size = 0;
-  uint32_t name_size = 0;
-  uint8_t *data_ptr = NULL;
-  uint8_t *file_name = NULL;
-  cpio_file_ll *file = files_arr;
+  return cpio_parse_extent(addr, NULL);
+}
+
+/** Remember where the initramfs is, either a cpio archive or one compressed by LZ4.
+ * Nothing is decompressed here, since diy_malloc() is not ready yet, see cpio_get_index().
+ * @param end: end of the initramfs, e.g. from fdtb_get_initrd(). NULL if unknown, then it cannot be compressed
+ * @return 0 on success, -1 on unknown format
+*/
+int cpio_parse_extent(void *start, void *end){
+  if(lz4_is_compressed(start)){
+    if(end == NULL){
+      uart_printf("Error, cpio_parse_extent(), initramfs at 0x%lX is compressed but its end is unknown\r\n", (uint64_t)start);
+      return -1;
+    }
+    image = start;
+    image_size = (uint8_t*)end - (uint8_t*)start;
+    archive = NULL;
+    return 0;
+  }
+
+  const cpio_newc_header_t *header = (cpio_newc_header_t*) start;
+  const uint32_t magic_num = hex_decode(header->c_magic, sizeof(header->c_magic));
+  if(magic_num != CPIO_MAGIC_NUM){
+    uart_printf("[Error] magic_num=%d, should be %d instead.\r\n", magic_num, CPIO_MAGIC_NUM);
+    return -1;
+  }
+  archive = image = start;
+  image_size = end == NULL ? cpio_archive_size(start) : (size_t)((uint8_t*)end - (uint8_t*)start);
+  return 0;
+}
+
+// Bytes of initramfs as loaded by the boot loader, to be reserved from the buddy system
+size_t cpio_image_size(){
+  return image_size;
+}
+
+// Decompress an initramfs compressed by LZ4 into pages of the buddy system, the archive stays there from now on
+static void *cpio_decompress(const void *src, size_t len){
+  const long size = lz4_decompress(src, len, NULL, 0);   // size first, frames may not carry it
+  if(size <= 0)
+    return NULL;
+  void *dst = diy_malloc(size < PAGE_SIZE ? PAGE_SIZE : size);  // whole pages, page aligned
+  if(dst == NULL || lz4_decompress(src, len, dst, size) != size){
+    uart_printf("Error, cpio_decompress(), failed to decompress %lu bytes into %ld bytes\r\n", len, size);
+    if(dst != NULL)
+      diy_free(dst);
+    return NULL;
+  }
+  return dst;
+}
+
+/** Index every entry of the archive at addr in one pass, till the trailer
+ * @return 0 on success, -1 on bad magic number
+*/
+int cpio_index_build(cpio_index *idx, void *addr){
+  const cpio_newc_header_t *header = (cpio_newc_header_t*) addr;
+  memset_(idx, 0, sizeof(cpio_index));
   while(1){
     // Check for magic num
-    magic_num = header_get_mem(header->c_magic, sizeof(header->c_magic));
+    const uint32_t magic_num = hex_decode(header->c_magic, sizeof(header->c_magic));
     if(magic_num != CPIO_MAGIC_NUM){
-      uart_printf("[Error] magic_num=%d, should be %d instead.\r\n", magic_num, CPIO_MAGIC_NUM);
-      file->next = NULL;
+      uart_printf("Error, cpio_index_build(), magic_num=%d, should be %d instead, entry=%lu\r\n", magic_num, CPIO_MAGIC_NUM, idx->cnt);
+      cpio_index_release(idx);
       return -1;
     }
 
-    // Get file size and pathname size
-    file_size = header_get_mem(header->c_filesize, sizeof(header->c_filesize));
-    name_size = header_get_mem(header->c_namesize, sizeof(header->c_namesize));
-
-    // Get file name (aka pathname)
-    file_name = (uint8_t*)(&header[1]); // equivalent to ((u8*)header) + sizeof(header) or (u8*)(header+1)
-
-    // Get file data address
-    data_ptr = (uint8_t*)(&header[1]) + name_size + pad_to_4(name_size + sizeof(cpio_newc_header_t));
-    
-    // Get next address
-    file->data_ptr  = data_ptr;
-    file->file_size = file_size;
-    file->pathname  = file_name;
-    if(strcmp_(CPIO_END_RECORD, (const char*)file_name) != 0){
-      header = (cpio_newc_header_t*)( data_ptr + file_size + pad_to_4(file_size) );
-      file->next = file + 1; // should be malloc() here.
-      file = file->next;
-    }
-    else{
-      file->next = NULL;
-      return 0;
+    // Get file size and pathname size, pathname follows the header, data follows the pathname
+    const uint32_t file_size = hex_decode(header->c_filesize, sizeof(header->c_filesize));
+    const uint32_t name_size = hex_decode(header->c_namesize, sizeof(header->c_namesize));
+    const uint32_t mode      = hex_decode(header->c_mode, sizeof(header->c_mode));
+    const char *file_name = (const char*)(&header[1]);
+    uint8_t *data_ptr = (uint8_t*)(&header[1]) + name_size + pad_to_4(name_size + sizeof(cpio_newc_header_t));
+    if(strcmp_(CPIO_END_RECORD, file_name) == 0)
+      break;
+    header = (cpio_newc_header_t*)( data_ptr + file_size + pad_to_4(file_size) );
+
+    // "." is the root itself, "./" is dropped
+    if(file_name[0] == '.' && file_name[1] == '/')
+      file_name += 2;
+    if(file_name[0] == '\0' || strcmp_(file_name, ".") == 0)
+      continue;
+
+    // Directories are indexed even if the archive has no entry for them, hash of a prefix comes along the way
+    cpio_file file = {.pathname=file_name, .path_len=0, .file_size=0, .hash=DCACHE_HASH_INIT, .is_dir=1, .data_ptr=NULL};
+    for(; file_name[file.path_len] != '\0'; file.path_len++){
+      if(file_name[file.path_len] == '/' && cpio_index_find_n(idx, file_name, file.path_len) == NULL)
+        cpio_index_add(idx, &file);
+      file.hash = dcache_hash_step(file.hash, file_name[file.path_len]);
     }
+    file.is_dir = (mode & CPIO_MODE_TYPE) == CPIO_MODE_DIR;
+    file.file_size = file_size;
+    file.data_ptr = data_ptr;
+    cpio_index_add(idx, &file);
   }
+  return 0;
 }
 
-void cpio_ls(){
-  cpio_file_ll *file = files_arr;
+// Return entry of pathname, NULL if not found
+const cpio_file *cpio_index_find(const cpio_index *idx, const char *pathname){
+  return cpio_index_find_n(idx, pathname, strlen_(pathname));
+}
+
+// Return entry of the first len bytes of pathname, NULL if not found
+const cpio_file *cpio_index_find_n(const cpio_index *idx, const char *pathname, size_t len){
+  if(idx->slot_cnt == 0)
+    return NULL;
+  const uint32_t hash = path_hash(pathname, len);
+  for(size_t s = hash & (idx->slot_cnt - 1); idx->slots[s] >= 0; s = (s + 1) & (idx->slot_cnt - 1)){
+    const cpio_file *file = &idx->files[idx->slots[s]];
+    if(file->hash == hash && file->path_len == len && memcmp_(pathname, file->pathname, len) == 0)
+      return file;
+  }
+  return NULL;
+}
 
-  // Traverse the linked list
-  while(file->next != NULL){
-    uart_printf("%s, size=%d\r\n", file->pathname, file->file_size);
-    file = file->next;
+/** Return entry named name directly under directory dir of the archive, NULL if not found
+ * @param dir: NULL for root of the archive
+*/
+const cpio_file *cpio_index_child(const cpio_index *idx, const cpio_file *dir, const char *name){
+  const size_t name_len = strlen_(name);
+  char path[TMPFS_MAX_PATH_LEN];
+  size_t len = 0;
+  if(dir != NULL){
+    if(dir->path_len + 1 + name_len >= TMPFS_MAX_PATH_LEN)
+      return NULL;
+    memcpy_(path, dir->pathname, dir->path_len);
+    len = dir->path_len;
+    path[len++] = '/';
+  }
+  memcpy_(path + len, name, name_len);
+  return cpio_index_find_n(idx, path, len + name_len);
+}
+
+/** Find the next entry directly under directory dir of the archive, from files[i] on.
+ * The index is not grouped by directory, so listing a directory scans it once.
+ * @param dir: NULL for root of the archive
+ * @param name: set to the last component of the entry found, at least TMPFS_MAX_COMPONENT_NAME bytes
+ * @return index into files of the entry, idx->cnt if there is no more
+*/
+size_t cpio_index_next_child(const cpio_index *idx, const cpio_file *dir, size_t i, char *name){
+  const size_t prefix = dir == NULL ? 0 : dir->path_len + 1;  // with the '/'
+  for(; i<idx->cnt; i++){
+    const cpio_file *file = &idx->files[i];
+    if(file->path_len <= prefix || (prefix > 0 &&
+      (memcmp_(file->pathname, dir->pathname, prefix - 1) != 0 || file->pathname[prefix - 1] != '/')))
+      continue;   // not under dir
+
+    // Only direct entries, i.e. no more '/' after the prefix
+    size_t k = prefix;
+    while(k < file->path_len && file->pathname[k] != '/')
+      k++;
+    if(k != file->path_len || k - prefix >= TMPFS_MAX_COMPONENT_NAME)
+      continue;
+    memcpy_(name, file->pathname + prefix, k - prefix);
+    name[k - prefix] = '\0';
+    return i;
+  }
+  return idx->cnt;
+}
+
+void cpio_index_release(cpio_index *idx){
+  if(idx->files != NULL) diy_free(idx->files);
+  if(idx->slots != NULL) diy_free(idx->slots);
+  memset_(idx, 0, sizeof(cpio_index));
+}
+
+// Index of the archive found by cpio_parse(), built on first call, after decompressing the archive if needed
+const cpio_index *cpio_get_index(){
+  if(archive == NULL && image != NULL){
+    archive = cpio_decompress(image, image_size);
+    if(archive != NULL)
+      mem_release((uint64_t)image, (uint64_t)image + image_size); // reserved by main(), not needed anymore
+    image = NULL;     // don't try again
+  }
+  if(initrd.slots == NULL && archive != NULL)
+    cpio_index_build(&initrd, archive);
+  return &initrd;
+}
+
+void cpio_ls(){
+  const cpio_index *idx = cpio_get_index();
+  for(size_t i=0; i<idx->cnt; i++){
+    if(!idx->files[i].is_dir)
+      uart_printf("%s, size=%d\r\n", idx->files[i].pathname, idx->files[i].file_size);
   }
 }
 
 // This function copies content of file_name to destination
 int cpio_copy(char *file_name, uint8_t *destination){
-  cpio_file_ll *file = files_arr;
-  uint8_t *dest_ptr = destination;
-  uint8_t *src_ptr = NULL;
-  uint32_t size = 0;
-
-  // Traverse the linked list
-  while(file->next != NULL){
-    if(strcmp_(file_name, (char*)file->pathname) == 0){
-      src_ptr = file->data_ptr;
-      size = file->file_size;
-      // Copy executable to destination
-      for(uint32_t i = 0; i < size; i++)
-        *dest_ptr++ = *src_ptr++;
-
-      uart_printf("cpio_copy: copied %s to %p, size=%u.\r\n", file_name, destination, size);
-      return 0;
-    }
-    file = file->next;
+  const cpio_file *file = cpio_index_find(cpio_get_index(), file_name);
+  if(file == NULL){
+    uart_printf("cpio_copy: cannot access '%s': No such file or directory\r\n", file_name);
+    return -1;
   }
-  uart_printf("cpio_copy: cannot access '%s': No such file or directory\r\n", file_name);
-  return -1;
+  memcpy_(destination, file->data_ptr, file->file_size);
+  uart_printf("cpio_copy: copied %s to %p, size=%u.\r\n", file_name, destination, file->file_size);
+  return 0;
 }
 
 int cpio_cat(char *file_name){
-  cpio_file_ll *file = files_arr;
-
-  // Traverse the linked list
-  while(file->next != NULL){
-    if(strcmp_(file_name, (char*)file->pathname) == 0){
-      // Dump for debug
-      for(int i = 0; i < file->file_size; i++) uart_printf("%c", file->data_ptr[i]);
-      uart_printf("\r\n");
-      return 0;
-    }
-    file = file->next;
+  const cpio_file *file = cpio_index_find(cpio_get_index(), file_name);
+  if(file == NULL){
+    uart_printf("cat: cannot access '%s': No such file or directory\r\n", file_name);
+    return -1;
   }
-  uart_printf("cat: cannot access '%s': No such file or directory\r\n", file_name);
-  return -1;
+  for(int i = 0; i < file->file_size; i++) uart_printf("%c", file->data_ptr[i]);
+  uart_printf("\r\n");
+  return 0;
+}
+
+// Write a newc header of a file of name and size at buf, return bytes till where its data goes
+static size_t cpio_bench_header(uint8_t *buf, const char *name, uint32_t size){
+  const uint32_t name_size = strlen_(name) + 1;
+  cpio_newc_header_t *header = (cpio_newc_header_t*)buf;
+  memset_(header, '0', sizeof(cpio_newc_header_t));
+  memcpy_(header->c_magic, "070701", sizeof(header->c_magic));
+  char field[sizeof(header->c_filesize) + 1];
+  sprintf_(field, "%08X", size);
+  memcpy_(header->c_filesize, field, sizeof(header->c_filesize));
+  sprintf_(field, "%08X", name_size);
+  memcpy_(header->c_namesize, field, sizeof(header->c_namesize));
+  memcpy_(&header[1], name, name_size);
+  return sizeof(cpio_newc_header_t) + name_size + pad_to_4(name_size + sizeof(cpio_newc_header_t));
+}
+
+// Index a generated archive of n 4-byte files, then look every one of them up
+void cpio_bench(int n){
+  const size_t entry_max = sizeof(cpio_newc_header_t) + 16 + 4;  // "/bench/f%06d" and 4 bytes of data, padded
+  char name[16];
+  cpio_index idx;
+  int found = 0;
+
+  uint8_t *buf = diy_malloc(entry_max * (n + 1));
+  if(buf == NULL){
+    uart_printf("Error, cpio_bench(), cannot allocate archive of %d entries\r\n", n);
+    return;
+  }
+  size_t pos = 0;
+  for(int i=0; i<n; i++){
+    sprintf_(name, "bench/f%06d", i);
+    pos += cpio_bench_header(buf + pos, name, 4);
+    memcpy_(buf + pos, &i, 4);
+    pos += 4;
+  }
+  cpio_bench_header(buf + pos, CPIO_END_RECORD, 0);
+
+  const uint64_t t0 = read_sysreg(cntpct_el0);
+  if(cpio_index_build(&idx, buf) != 0){
+    diy_free(buf);
+    return;
+  }
+  const uint64_t t1 = read_sysreg(cntpct_el0);
+  for(int i=0; i<n; i++){
+    sprintf_(name, "bench/f%06d", i);
+    const cpio_file *file = cpio_index_find(&idx, name);
+    if(file != NULL && *(int*)file->data_ptr == i)
+      found++;
+  }
+  const uint64_t t2 = read_sysreg(cntpct_el0);
+
+  const uint64_t freq = read_sysreg(cntfrq_el0);
+  uart_printf("%lu entries indexed in %lu us, %d of %d looked up in %lu us, %lu slots\r\n",
+    idx.cnt, (t1 - t0) * 1000000 / freq, found, n, (t2 - t1) * 1000000 / freq, idx.slot_cnt);
+  cpio_index_release(&idx);
+  diy_free(buf);
 }
 
 // initramfs, API to virtual_file_system.h --------------------------------
 filesystem initramfs = {.name="initramfs", .setup_mount=initramfs_setup_mount};
-file_operations initramfs_fops = {.write=initramfs_write, .read=initramfs_read, .open=initramfs_open, .close=initramfs_close};
-vnode_operations initramfs_vops = {.lookup=initramfs_lookup, .create=initramfs_create, .mkdir=initramfs_mkdir};
+file_operations initramfs_fops = {.write=initramfs_write, .read=initramfs_read, .open=initramfs_open, .close=initramfs_close, .lseek64=initramfs_lseek64};
+vnode_operations initramfs_vops = {.lookup=initramfs_lookup, .create=initramfs_create, .mkdir=initramfs_mkdir, .populate=initramfs_populate};
 
+// Nothing of the archive is instantiated here, vnodes are created by initramfs_lookup() on demand
 int initramfs_setup_mount(struct filesystem *fs, mount *mount){
   if(mount == NULL){
     uart_printf("Error, initramfs_setup_mount(), NULL pointer.");
   }
-  mount->root = diy_malloc(sizeof(vnode));
+  mount->root = tmpfs_node_alloc_size("", sizeof(initramfs_node));
   mount->fs = fs;
   mount->root->mount = NULL;
-  mount->root->comp = diy_malloc(sizeof(vnode_comp));
-  mount->root->comp->comp_name = "";
   mount->root->comp->len = 0;
   mount->root->comp->entries = NULL;
+  mount->root->comp->index = NULL;
   mount->root->comp->type = COMP_DIR;
   mount->root->f_ops = &initramfs_fops;
   mount->root->v_ops = &initramfs_vops;
-
-  if(mounted)
-    return 0;
-
-  // Insert files in the linked list to the file system
-  cpio_file_ll *file = files_arr;
-  vnode *dir_node = mount->root;
-  vnode *node_new = NULL;
-  while(file->next != NULL){
-
-    // Skip 0 files
-    if(file->file_size > 0){
-      // Create entry
-      lookup_recur((char*)file->pathname, dir_node, &node_new, 1);
-
-      // Config entry to a file
-      node_new->comp->type = COMP_FILE;
-      node_new->comp->data = (char*)file->data_ptr;
-      node_new->comp->len = file->file_size;
-    }
-    file = file->next;
-  }
   mounted = 1;
   return 0;
 }
 
+// Create the vnode of file, an entry of the archive, under dir_node
+static vnode *initramfs_instantiate(vnode *dir_node, const cpio_file *file, const char *component_name){
+  initramfs_node *node = (initramfs_node*)tmpfs_node_alloc_size(component_name, sizeof(initramfs_node));
+  if(node == NULL)
+    return NULL;
+  node->file = file;
+  vnode *vn = &node->entry.node;
+  vn->f_ops = &initramfs_fops;
+  vn->v_ops = &initramfs_vops;
+  if(file->is_dir)
+    vn->comp->type = COMP_DIR;
+  else{
+    vn->comp->type = COMP_FILE;
+    vn->comp->data = (char*)file->data_ptr;
+    vn->comp->len = file->file_size;
+  }
+  tmpfs_link(dir_node, vn);
+  return vn;
+}
+
 // fops
 int initramfs_write(file *file, const void *buf, size_t len){
   uart_printf("Error, initramfs_write(), cannot modify initramfs\r\n");
   return 0;
 }
+// comp->data points into the archive itself, unlike tmpfs whose files are kept in pages
 int initramfs_read(file *file, void *buf, size_t len){
-  return tmpfs_read(file, buf, len);
+  if(file == NULL || file->vnode == NULL || file->vnode->comp == NULL){
+    uart_printf("Error, initramfs_read(), null file, file=0x%lX\r\n", (uint64_t)file);
+    return 1;
+  }
+  vnode_comp *comp = file->vnode->comp;
+  if(comp->type != COMP_FILE){
+    uart_printf("Error, initramfs_read(), node_name=%s, type=%d, not file\r\n", comp->comp_name, comp->type);
+    return 2;
+  }
+
+  if(file->f_pos >= comp->len)
+    return 0;  // end of file
+  const size_t read_able = file->f_pos + len >= comp->len ? (comp->len - file->f_pos) : len;
+  memcpy_(buf, comp->data + file->f_pos, read_able);
+  file->f_pos += read_able;
+  return read_able;
 }
 int initramfs_open(vnode* file_node, file** target){
   return tmpfs_open(file_node, target);
@@ -182,6 +437,9 @@ int initramfs_open(vnode* file_node, file** target){
 int initramfs_close(file *file){
   return tmpfs_close(file);
 }
+long initramfs_lseek64(file *file, long offset, int whence){
+  return tmpfs_lseek64(file, offset, whence);
+}
 
 // vops
 int initramfs_mkdir(vnode *dir_node, vnode **target, const char *component_name){
@@ -201,5 +459,31 @@ int initramfs_create(vnode *dir_node, vnode **target, const char *component_name
     return tmpfs_create(dir_node, target, component_name);
 }
 int initramfs_lookup(vnode *dir_node, vnode **target, const char *component_name){
-  return tmpfs_lookup(dir_node, target, component_name);
+  if(tmpfs_lookup(dir_node, target, component_name) == 0)
+    return 0;   // instantiated before
+  if(((initramfs_node*)dir_node)->populated)
+    return 1;   // every entry under dir_node has a vnode already
+
+  const cpio_file *file = cpio_index_child(cpio_get_index(), ((initramfs_node*)dir_node)->file, component_name);
+  if(file == NULL)
+    return 1;   // not found under dir_node
+  *target = initramfs_instantiate(dir_node, file, component_name);
+  return *target == NULL;
+}
+
+// Create vnodes of every entry directly under dir_node, for listing
+int initramfs_populate(vnode *dir_node){
+  initramfs_node *dir = (initramfs_node*)dir_node;
+  if(dir->populated)
+    return 0;
+
+  const cpio_index *idx = cpio_get_index();
+  char name[TMPFS_MAX_COMPONENT_NAME];
+  vnode *node = NULL;
+  for(size_t i = cpio_index_next_child(idx, dir->file, 0, name); i < idx->cnt; i = cpio_index_next_child(idx, dir->file, i + 1, name)){
+    if(tmpfs_lookup(dir_node, &node, name) != 0)
+      initramfs_instantiate(dir_node, &idx->files[i], name);
+  }
+  dir->populated = 1;
+  return 0;
 }
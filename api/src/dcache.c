@@ -0,0 +1,51 @@
+#include "dcache.h"
+#include "diy_string.h"
+#include "uart.h"
+
+static dcache_entry table[DCACHE_SIZE];
+static dcache_stat stat;
+
+static inline dcache_entry *dcache_slot(vnode *dir, uint32_t hash){
+  return &table[(hash ^ (uint32_t)((uint64_t)dir >> 4)) & (DCACHE_SIZE - 1)];
+}
+
+/** Look up name of len bytes under dir, name needs no '\0'.
+ * @param target: set to the vnode on a hit, NULL on a negative hit
+ * @return 1 on hit, 0 on miss, i.e. dir->v_ops->lookup() is needed
+*/
+int dcache_lookup(vnode *dir, const char *name, size_t len, uint32_t hash, vnode **target){
+  const dcache_entry *e = dcache_slot(dir, hash);
+  if(e->dir == dir && e->hash == hash && e->len == len && memcmp_(e->name, name, len) == 0){
+    *target = e->node;
+    stat.hits++;
+    if(e->node == NULL)
+      stat.negative_hits++;
+    return 1;
+  }
+  stat.misses++;
+  return 0;
+}
+
+// Remember the result of looking up name under dir, node is NULL if name does not exist
+void dcache_insert(vnode *dir, const char *name, size_t len, uint32_t hash, vnode *node){
+  if(len >= TMPFS_MAX_COMPONENT_NAME)
+    return;
+  dcache_entry *e = dcache_slot(dir, hash);
+  e->dir = dir;
+  e->node = node;
+  e->hash = hash;
+  e->len = len;
+  memcpy_(e->name, name, len);
+}
+
+// Drop every entry, e.g. a mount hides what was under the mount point
+void dcache_flush(){
+  memset_(table, 0, sizeof(table));
+  stat.flushes++;
+}
+
+void dcache_dump_stat(){
+  const uint64_t total = stat.hits + stat.misses;
+  uart_printf("dcache: hits=%lu (negative=%lu), misses=%lu, hit rate=%lu%%, flushes=%lu\r\n",
+    stat.hits, stat.negative_hits, stat.misses, total == 0 ? 0 : stat.hits * 100 / total, stat.flushes);
+}
@@ -9,23 +9,21 @@
 
 #define DEVFS_UART_NAME "uart"
 #define DEVFS_FRAMEBUFFER_NAME "framebuffer"
-#define SEEK_SET 0
 
 filesystem devfs = {.name="devfs", .setup_mount=devfs_setup_mount};
-file_operations devfs_fops = {.write=devfs_write, .read=devfs_read, .open=devfs_open, .close=devfs_close, .lseek64=devfs_lseek};
+file_operations devfs_fops = {.write=devfs_write, .read=devfs_read, .open=devfs_open, .close=devfs_close, .lseek64=devfs_lseek, .poll=devfs_poll};
 vnode_operations devfs_vops = {.lookup=devfs_lookup, .create=devfs_create, .mkdir=devfs_mkdir};
 
 int devfs_setup_mount(struct filesystem *fs, mount *mount){
   if(mount == NULL){
     uart_printf("Error, devfs_setup_mount(), NULL pointer.");
   }
-  mount->root = diy_malloc(sizeof(vnode));
+  mount->root = tmpfs_node_alloc("");
   mount->fs = fs;
   mount->root->mount = NULL;
-  mount->root->comp = diy_malloc(sizeof(vnode_comp));
-  mount->root->comp->comp_name = "";
   mount->root->comp->len = 0;
   mount->root->comp->entries = NULL;
+  mount->root->comp->index = NULL;
   mount->root->comp->type = COMP_DIR;
   mount->root->f_ops = &devfs_fops;
   mount->root->v_ops = &devfs_vops;
@@ -93,6 +91,16 @@ int devfs_read(file *file, void *buf, size_t len){
     return 0;
   }
 }
+/** uart is readable once rx FIFO holds a byte, arm rx interrupt otherwise so pollers are woken, see irq_handler().
+ * Writes to devices never block.
+*/
+int devfs_poll(file *file){
+  if(strcmp_(file->vnode->comp->comp_name, DEVFS_UART_NAME) == 0 && !uart_rx_ready()){
+    uart_rx_irq_arm();
+    return POLLOUT;
+  }
+  return POLLIN | POLLOUT;
+}
 int devfs_open(vnode* file_node, file** target){
   return tmpfs_open(file_node, target);
 }
@@ -100,11 +108,17 @@ int devfs_close(file *file){
   return tmpfs_close(file);
 }
 long devfs_lseek(file *file, long offset, int whence){
+  if(strcmp_(file->vnode->comp->comp_name, DEVFS_UART_NAME) == 0)
+    return -1;  // a stream, there is no position to seek to
   if(whence == SEEK_SET){
     file->f_pos = (size_t)offset;
     // uart_printf("Debug, devfs_lseek(), f_pos set to %ld\r\n", file->f_pos);
     return file->f_pos;
   }
+  else if(whence == SEEK_CUR){
+    file->f_pos += offset;
+    return file->f_pos;
+  }
   else{
     uart_printf("Error, devfs_lseek(), unknown whence=%d\r\n", whence);
     return -1;
@@ -47,6 +47,7 @@ static uint64_t heap_start_addr = 0;// start address of heap
 #define MALLOC_WHOLE_PAGE (PAGE_SIZE + 1)
 static int *malloc_page_usage;      // used for malloc, malloc_page_usage[i] == k means that k bytes in page #i are allocated through malloc
                                     // malloc_page_usage[i] == MALLOC_WHOLE_PAGE means that the page #i is allocated as single or multiple page for large diy_malloc() request
+static uint16_t *page_ref_cnt;      // page_ref_cnt[i] == k means that page #i is mapped k times, 0 for pages not shared between address spaces
 
 // frame_freelist_arr[i] points to the head of the linked list of free 4kB*(2^i) pages
 buddynode *frame_freelist_arr[MAX_CONTI_ALLOCATION_EXPO + 1] = {NULL};
@@ -350,14 +351,17 @@ void alloc_page_preinit(uint64_t heap_start, uint64_t heap_end){
   uint64_t simple_malloc_last_byte = (uint64_t) &__simple_malloc_start;
   simple_malloc_last_byte += sizeof(int) * total_pages;           // for malloc_page_usage
   simple_malloc_last_byte += sizeof(buddy_status) * total_pages;  // for the_frame_array
+  simple_malloc_last_byte += sizeof(uint16_t) * total_pages;      // for page_ref_cnt
   simple_malloc_last_byte += (16 - (simple_malloc_last_byte%16)); // round to multiple of 16
   __simple_malloc_end = (char*)( simple_malloc_last_byte + 1024); // add 1024 for other purpose
   uart_printf("alloc_page_preinit(): __simple_malloc_start=%p, __simple_malloc_end=%p\r\n", &__simple_malloc_start, __simple_malloc_end);
   // Init: allocate space
   malloc_page_usage = (int*) simple_malloc(sizeof(int) * total_pages);
   the_frame_array = (buddy_status*) simple_malloc(sizeof(buddy_status) * total_pages);
+  page_ref_cnt = (uint16_t*) simple_malloc(sizeof(uint16_t) * total_pages);
   for(int i=0; i<total_pages; i++){
     malloc_page_usage[i] = -1;
+    page_ref_cnt[i] = 0;
     the_frame_array[i].val = FRAME_ARRAY_X;
     the_frame_array[i].used = 1;
   }
@@ -444,6 +448,64 @@ void mem_reserve(uint64_t start, uint64_t end){
     }
 }
 
+/** Give pages reserved by mem_reserve() back to the buddy system, e.g. a compressed initramfs once decompressed.
+ * Only pages wholly inside [start, end) are freed, pages at the edges may hold something else reserved.
+*/
+void mem_release(uint64_t start, uint64_t end){
+  const int start_page = GET_PAGE_NUM(start + PAGE_SIZE - 1);
+  const int end_page = GET_PAGE_NUM(end);  // exclusive
+  if(start < heap_start_addr || start_page < 0 || end_page > total_pages || start_page > end_page){
+    uart_printf("Error, wrong memory release range, start=0x%lX, end=0x%lX, start_page=%d, end_page=%d\r\n",
+      start, end, start_page, end_page);
+    return;
+  }
+  for(int i=start_page; i<end_page; i++){
+    if(the_frame_array[i].val != FRAME_ARRAY_P)
+      continue;
+    the_frame_array[i].val = 1;   // a block of one allocated page, so free_page() merges it with its buddies
+    the_frame_array[i].used = 1;
+    free_page(i, 0);
+  }
+  uart_printf("released from page %d to %d\r\n", start_page, end_page - 1);
+}
+
+// Page reference count ---------------------------------------------
+// Frames mapped into more than one address space are counted here, so the last unmapping knows it can free the frame.
+// addr can be either physical or kernel virtual address.
+static int page_ref_index(uint64_t addr){
+  addr = (addr & 0x0000FFFFFFFFFFFF) | VM_KERNEL_PREFIX;
+  if(addr < heap_start_addr || GET_PAGE_NUM(addr) >= total_pages)
+    return -1;
+  return GET_PAGE_NUM(addr);
+}
+
+/** Increase reference count of the page that addr belongs to.
+ * @return reference count after increment, -1 if addr is not in heap
+*/
+int page_ref_inc(uint64_t addr){
+  const int i = page_ref_index(addr);
+  if(i < 0) return -1;
+  page_ref_cnt[i]++;
+  return page_ref_cnt[i];
+}
+
+/** Decrease reference count of the page that addr belongs to. Caller frees the page if 0 is returned.
+ * @return reference count after decrement, -1 if addr is not in heap or page is not referenced
+*/
+int page_ref_dec(uint64_t addr){
+  const int i = page_ref_index(addr);
+  if(i < 0 || page_ref_cnt[i] == 0) return -1;
+  page_ref_cnt[i]--;
+  return page_ref_cnt[i];
+}
+
+// Return reference count of the page that addr belongs to, -1 if addr is not in heap
+int page_ref_get(uint64_t addr){
+  const int i = page_ref_index(addr);
+  if(i < 0) return -1;
+  return page_ref_cnt[i];
+}
+
 // diy_malloc, diy_free for small memory ---------------------------
 void *diy_malloc(size_t size){
   // TODO: Handle allocation for size > (PAGE_SIZE-sizeof(chunk_header))
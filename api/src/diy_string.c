@@ -129,6 +129,16 @@ void *memset_(void *str, int c, size_t len){
   return str;
 }
 
+int memcmp_(const void *src1, const void *src2, size_t len){
+  const unsigned char *p1 = src1;
+  const unsigned char *p2 = src2;
+  for(size_t i=0; i<len; i++){
+    if(p1[i] != p2[i])
+      return p1[i] - p2[i];
+  }
+  return 0;
+}
+
 int str_spilt(char** str_arr, char* str, char* deli){
   int count = 0;
   // Spilt str by specified delimeter
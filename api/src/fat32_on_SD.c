@@ -6,6 +6,10 @@
 #include "tmpfs.h"
 #include "diy_string.h"
 #include "diy_malloc.h"
+#include "thread.h"
+#include "sys_reg.h"
+#include "general.h"
+#include "system_call.h"
 #include <stdint.h>
 
 /*
@@ -19,12 +23,34 @@
 
 static uint32_t FAT1_phy_bk;     // physical block, FAT has size of sec_per_fat32*SD_BLOCK_SIZE bytes
 static uint32_t root_dir_phy_bk; // physical block
+static uint32_t data_phy_bk;     // physical block of cluster 2
+static uint32_t sec_per_cluster; // boot_sector_t.sector_per_cluster
+static uint32_t cluster_bytes;   // sec_per_cluster*SD_BLOCK_SIZE
 static uint32_t root_cluster;    // boot_sector_t.root_cluster, usually 2
 static uint32_t sec_per_fat32;   // boot_sector_t.sector_per_fat32
-
-#define FROM_LBA_TO_PHY_BK(lba) (root_dir_phy_bk +(lba) +  - root_cluster)
+static uint32_t fat_cnt;         // boot_sector_t.fat_cnt, FAT1 is mirrored to the others
+static uint32_t fsinfo_phy_bk;   // physical block of FSInfo, 0 if the volume has none
+static uint32_t cluster_end;     // valid cluster numbers are [2, cluster_end)
+static uint32_t next_free;       // cluster to search a free one from, FSInfo next-free hint
+static uint32_t free_cnt;        // free clusters, FSInfo free count
+static uint8_t *used_map;        // bit per cluster, set if used, built from FAT at mount
+static fat32_sector sector_cache[FAT32_CACHE_SECTORS];
+static fat32_stat stat;
+static uint64_t dirty_since;     // cntpct_el0 when a clean cache got its first dirty sector, 0 if nothing is dirty
+static wait_queue flusher_wait;  // fat32fs_flusher() sleeps here till fat32fs_tick() finds metadata dirty long enough
+
+#define CLUSTER_TO_PHY_BK(c)    (data_phy_bk + ((c) - 2) * sec_per_cluster)
+#define IS_CLUSTER(c)           ((c) >= 2 && (c) < cluster_end)
 #define FAT_ENTRY_EOF           ((uint32_t)0x0FFFFFF8) // end of file (end of linked list in FAT)
 #define FAT_ENTRY_EMPTY         ((uint32_t)0x00000000)
+#define FAT_ENTRY_MASK          ((uint32_t)0x0FFFFFFF) // high 4 bits of an entry are reserved
+#define FAT_ENTRIES_PER_SECTOR  (SD_BLOCK_SIZE / sizeof(uint32_t))
+#define FSINFO_LEAD_SIG         0x41615252
+#define FSINFO_STRUCT_SIG       0x61417272
+#define FSINFO_UNKNOWN          0xFFFFFFFF
+#define USED_MAP_TEST(c)        (used_map[(c) >> 3] &  (1 << ((c) & 7)))
+#define USED_MAP_SET(c)         (used_map[(c) >> 3] |= (1 << ((c) & 7)))
+#define USED_MAP_CLEAR(c)       (used_map[(c) >> 3] &= ~(1 << ((c) & 7)))
 #define DIR_ENTRY_ATTR_ARCHIVE  0x20    // file, page 23, Ref[5]
 #define DIR_ENTRY_wrtTime_mock  0x58D8  // 11:06:48AM
 #define DIR_ENTRY_wrtDate_mock  0x50C4  // 20200604
@@ -86,6 +112,17 @@ typedef struct boot_sector_t  {
   uint8_t valid_bootsector[2]; // 0x55, 0xAA
 } __attribute__((packed)) boot_sector_t;
 
+// FSInfo sector, page 21, Ref[5]
+typedef struct fsinfo_t {
+  uint32_t lead_sig;      // FSINFO_LEAD_SIG
+  uint8_t reserved[480];
+  uint32_t struct_sig;    // FSINFO_STRUCT_SIG
+  uint32_t free_count;    // last known free cluster count, FSINFO_UNKNOWN if unknown
+  uint32_t next_free;     // hint of where to start looking for a free cluster, FSINFO_UNKNOWN if none
+  uint8_t reserved2[12];
+  uint32_t trail_sig;
+} __attribute__((packed)) fsinfo_t;
+
 // page 23, Ref[5]
 typedef struct dir_entry  {
   char name[11];        // 0~10
@@ -103,15 +140,373 @@ typedef struct dir_entry  {
 } __attribute__((packed)) dir_entry;
 
 
+// Metadata sector cache -------------------------------------------------
+// Sectors of FAT, FSInfo and directories are read and modified here, and written back by fat32fs_sync() only if dirty,
+// i.e. on close, sync or FAT32_FLUSH_MS after being modified. So metadata writes of many small file writes are coalesced.
+
+static void sector_write_back(fat32_sector *s){
+  writeblock(s->phy_bk, s->data);
+  stat.sd_writes++;
+  if(s->phy_bk >= FAT1_phy_bk && s->phy_bk < FAT1_phy_bk + sec_per_fat32){
+    for(uint32_t f=1; f<fat_cnt; f++){  // mirror of FAT1
+      writeblock(s->phy_bk + f*sec_per_fat32, s->data);
+      stat.sd_writes++;
+    }
+  }
+  s->dirty = 0;
+}
+
+/** Return cached content of phy_bk, read from SD card on miss into the least recently used slot, written back first if dirty.
+ * Fully associative, since a directory sector and the FAT sector of its files would often collide when mapped by address.
+ * @param dirty: 1 if the caller is going to modify the sector
+*/
+static uint8_t *sector_get(uint32_t phy_bk, int dirty){
+  static uint64_t clock = 0;
+  fat32_sector *s = NULL;
+  for(int i=0; i<FAT32_CACHE_SECTORS; i++){
+    fat32_sector *slot = &sector_cache[i];
+    if(slot->valid && slot->phy_bk == phy_bk){
+      s = slot;
+      break;
+    }
+    if(s == NULL || !slot->valid || (s->valid && slot->last_use < s->last_use))
+      s = slot;   // victim so far
+  }
+  s->last_use = ++clock;
+  if(!s->valid || s->phy_bk != phy_bk){
+    if(s->valid && s->dirty)
+      sector_write_back(s);
+    readblock(phy_bk, s->data);
+    stat.sd_reads++;
+    stat.cache_misses++;
+    s->phy_bk = phy_bk;
+    s->valid = 1;
+    s->dirty = 0;
+  }
+  else
+    stat.cache_hits++;
+  if(dirty && dirty_since == 0)
+    dirty_since = read_sysreg(cntpct_el0);
+  s->dirty |= dirty;
+  return s->data;
+}
+
+static uint32_t fat_get(uint32_t cluster){
+  const uint32_t *entries = (const uint32_t*)sector_get(FAT1_phy_bk + cluster / FAT_ENTRIES_PER_SECTOR, 0);
+  return entries[cluster % FAT_ENTRIES_PER_SECTOR] & FAT_ENTRY_MASK;
+}
+
+static void fat_set(uint32_t cluster, uint32_t value){
+  uint32_t *entries = (uint32_t*)sector_get(FAT1_phy_bk + cluster / FAT_ENTRIES_PER_SECTOR, 1);
+  uint32_t *entry = &entries[cluster % FAT_ENTRIES_PER_SECTOR];
+  *entry = (*entry & ~FAT_ENTRY_MASK) | (value & FAT_ENTRY_MASK);
+}
+
+static void fsinfo_update(){
+  if(fsinfo_phy_bk == 0)
+    return;
+  fsinfo_t *info = (fsinfo_t*)sector_get(fsinfo_phy_bk, 1);
+  info->free_count = free_cnt;
+  info->next_free = next_free;
+}
+
+/** Allocate a cluster as a one cluster chain, searching the bitmap from hint, 8 clusters at a time if all used.
+ * Only FAT in the sector cache is modified, nothing is written to SD card till fat32fs_sync().
+ * @param hint: cluster to start from, e.g. the one after the end of a file, 0 for the next-free hint of FSInfo
+ * @return cluster number, 0 if the volume is full
+*/
+static uint32_t fat_alloc_cluster(uint32_t hint){
+  if(free_cnt == 0)
+    return 0;
+  uint32_t c = IS_CLUSTER(hint) ? hint : next_free;
+  for(uint32_t n=0; n<cluster_end - 2; ){
+    if(c >= cluster_end)
+      c = 2;
+    if((c & 7) == 0 && c + 8 <= cluster_end && used_map[c >> 3] == 0xFF){
+      c += 8;
+      n += 8;
+      continue;
+    }
+    if(!USED_MAP_TEST(c)){
+      USED_MAP_SET(c);
+      fat_set(c, FAT_ENTRY_EOF);
+      free_cnt--;
+      next_free = c + 1 < cluster_end ? c + 1 : 2;
+      fsinfo_update();
+      return c;
+    }
+    c++;
+    n++;
+  }
+  return 0;
+}
+
+static void fat_free_cluster(uint32_t cluster){
+  fat_set(cluster, FAT_ENTRY_EMPTY);
+  USED_MAP_CLEAR(cluster);
+  free_cnt++;
+  fsinfo_update();
+}
+
+/** Scan FAT1 once to build the bitmap of used clusters, then take the next-free hint of FSInfo if it is valid.
+ * @return 0 on success
+*/
+static int fat_load(uint32_t sector_cnt, uint32_t first_data_sector){
+  cluster_end = (sector_cnt - first_data_sector) / sec_per_cluster + 2;
+  if(cluster_end > sec_per_fat32 * FAT_ENTRIES_PER_SECTOR)
+    cluster_end = sec_per_fat32 * FAT_ENTRIES_PER_SECTOR;
+  used_map = diy_malloc(cluster_end / 8 + 1);
+  if(used_map == NULL){
+    uart_printf("Error, fat_load(), cannot allocate bitmap of %u clusters\r\n", cluster_end);
+    return -1;
+  }
+  memset_(used_map, 0, cluster_end / 8 + 1);
+
+  uint32_t entries[FAT_ENTRIES_PER_SECTOR];
+  free_cnt = 0;
+  for(uint32_t b=0; b*FAT_ENTRIES_PER_SECTOR < cluster_end; b++){
+    readblock(FAT1_phy_bk + b, entries);
+    stat.sd_reads++;
+    for(uint32_t i=0; i<FAT_ENTRIES_PER_SECTOR; i++){
+      const uint32_t c = b*FAT_ENTRIES_PER_SECTOR + i;
+      if(c < 2 || c >= cluster_end)
+        continue;
+      if((entries[i] & FAT_ENTRY_MASK) != FAT_ENTRY_EMPTY)
+        USED_MAP_SET(c);
+      else
+        free_cnt++;
+    }
+  }
+  USED_MAP_SET(0);
+  USED_MAP_SET(1);
+
+  next_free = 2;
+  if(fsinfo_phy_bk != 0){
+    const fsinfo_t *info = (const fsinfo_t*)sector_get(fsinfo_phy_bk, 0);
+    if(info->lead_sig != FSINFO_LEAD_SIG || info->struct_sig != FSINFO_STRUCT_SIG){
+      uart_printf("Warning, fat_load(), FSInfo at %u has bad signature, ignored\r\n", fsinfo_phy_bk);
+      fsinfo_phy_bk = 0;
+    }
+    else if(info->next_free >= 2 && info->next_free < cluster_end)
+      next_free = info->next_free;
+  }
+  return 0;
+}
+
+// Write every dirty metadata sector back to SD card. Return sectors written
+int fat32fs_sync(){
+  int cnt = 0;
+  for(int i=0; i<FAT32_CACHE_SECTORS; i++){
+    if(sector_cache[i].valid && sector_cache[i].dirty){
+      sector_write_back(&sector_cache[i]);
+      cnt++;
+    }
+  }
+  dirty_since = 0;
+  if(cnt > 0)
+    stat.flushes++;
+  return cnt;
+}
+
+// Wake fat32fs_flusher() once metadata has been dirty for FAT32_FLUSH_MS, called in timer interrupt
+void fat32fs_tick(){
+  if(dirty_since != 0 && flusher_wait.head != NULL &&
+      read_sysreg(cntpct_el0) - dirty_since >= FAT32_FLUSH_MS * read_sysreg(cntfrq_el0) / 1000)
+    thread_wake_all(&flusher_wait);
+}
+
+// Kernel thread writing dirty metadata back in the background, so it reaches SD card even if files are never closed
+void fat32fs_flusher(){
+  while(1){
+    EL1_ARM_INTERRUPT_DISABLE();
+    thread_wait(&flusher_wait);
+    EL1_ARM_INTERRUPT_DISABLE();  // not kept across thread_wait(), depends on the thread switched back from
+    fat32fs_sync();
+    EL1_ARM_INTERRUPT_ENABLE();
+  }
+}
+
+const fat32_stat *fat32fs_get_stat(){
+  stat.clusters = cluster_end < 2 ? 0 : cluster_end - 2;
+  stat.free_clusters = free_cnt;
+  stat.next_free = next_free;
+  return &stat;
+}
+
+
+// Cluster chain ---------------------------------------------------------
+// A file is accessed through its extents, so seeking to an offset does not walk FAT.
+
+static int extent_push(fat32_node *node, uint32_t cluster){
+  if(node->extent_cnt > 0){
+    fat32_extent *last = &node->extents[node->extent_cnt - 1];
+    if(last->cluster + last->cnt == cluster){
+      last->cnt++;
+      node->cluster_cnt++;
+      return 0;
+    }
+  }
+  if(node->extent_cnt >= node->extent_cap){
+    const size_t cap = node->extent_cap == 0 ? FAT32_MIN_EXTENT : node->extent_cap * 2;
+    fat32_extent *extents = diy_malloc(cap * sizeof(fat32_extent));
+    if(extents == NULL){
+      uart_printf("Error, extent_push(), cannot grow extents of %s to %lu\r\n", node->entry.comp.comp_name, cap);
+      return -1;
+    }
+    if(node->extents != NULL){
+      memcpy_(extents, node->extents, node->extent_cnt * sizeof(fat32_extent));
+      diy_free(node->extents);
+    }
+    node->extents = extents;
+    node->extent_cap = cap;
+  }
+  node->extents[node->extent_cnt++] = (fat32_extent){.file_cluster = node->cluster_cnt, .cluster = cluster, .cnt = 1};
+  node->cluster_cnt++;
+  return 0;
+}
+
+// Walk the chain from comp->lba through FAT, once per vnode. Return 0 on success
+static int extent_load(fat32_node *node){
+  if(node->extents_loaded)
+    return 0;
+  uint32_t c = node->entry.comp.lba;
+  for(uint32_t n=0; IS_CLUSTER(c); n++){
+    if(n >= cluster_end - 2){
+      uart_printf("Error, extent_load(), chain of %s has a loop\r\n", node->entry.comp.comp_name);
+      return -1;
+    }
+    if(extent_push(node, c) != 0)
+      return -1;
+    c = fat_get(c);
+  }
+  if(c < FAT_ENTRY_EOF && node->cluster_cnt > 0)
+    uart_printf("Warning, extent_load(), chain of %s ends with 0x%X\r\n", node->entry.comp.comp_name, c);
+  node->extents_loaded = 1;
+  return 0;
+}
+
+// Map cluster index within the file to cluster on the volume, 0 if beyond the chain
+static uint32_t extent_map(fat32_node *node, uint32_t file_cluster){
+  if(file_cluster >= node->cluster_cnt)
+    return 0;
+  const fat32_extent *e = &node->extents[node->extent_hint];
+  if(file_cluster < e->file_cluster || file_cluster >= e->file_cluster + e->cnt){
+    // Last extent starting at or before file_cluster
+    size_t lo = 0, hi = node->extent_cnt - 1;
+    while(lo < hi){
+      const size_t mid = (lo + hi + 1) / 2;
+      if(node->extents[mid].file_cluster <= file_cluster)
+        lo = mid;
+      else
+        hi = mid - 1;
+    }
+    node->extent_hint = lo;
+    e = &node->extents[lo];
+  }
+  return e->cluster + (file_cluster - e->file_cluster);
+}
+
+// Add a cluster at the end of the chain, right after the last one if it is free. Return the cluster, 0 if the volume is full
+static uint32_t extent_append(fat32_node *node){
+  const fat32_extent *last = node->extent_cnt > 0 ? &node->extents[node->extent_cnt - 1] : NULL;
+  const uint32_t tail = last != NULL ? last->cluster + last->cnt - 1 : 0;
+  const uint32_t c = fat_alloc_cluster(tail + 1);
+  if(c == 0)
+    return 0;
+  if(extent_push(node, c) != 0){
+    fat_free_cluster(c);
+    return 0;
+  }
+  if(tail != 0)
+    fat_set(tail, c);
+  else
+    node->entry.comp.lba = c;
+  return c;
+}
+
+/** Copy buf to offset pos of node, allocating clusters past the end of the chain.
+ * A sector is read first only if it holds data of the file outside of what is written.
+ * @param buf: NULL to write zeros
+ * @return bytes written, less than len if the volume is full
+*/
+static size_t chain_write(fat32_node *node, size_t pos, const char *buf, size_t len){
+  uint8_t temp[SD_BLOCK_SIZE] __attribute__((aligned(4)));
+  const size_t file_len = node->entry.comp.len;
+  size_t done = 0;
+  while(done < len){
+    const uint32_t file_cluster = pos / cluster_bytes;
+    while(file_cluster >= node->cluster_cnt){
+      if(extent_append(node) == 0){
+        uart_printf("Error, chain_write(), no free cluster for %s\r\n", node->entry.comp.comp_name);
+        return done;
+      }
+    }
+    const uint32_t phy_bk = CLUSTER_TO_PHY_BK(extent_map(node, file_cluster)) + (pos % cluster_bytes) / SD_BLOCK_SIZE;
+    const size_t off = pos % SD_BLOCK_SIZE;
+    const size_t n = (SD_BLOCK_SIZE - off) < (len - done) ? (SD_BLOCK_SIZE - off) : (len - done);
+    const size_t sector_start = pos - off;
+    const size_t valid = file_len <= sector_start ? 0 : (file_len - sector_start < SD_BLOCK_SIZE ? file_len - sector_start : SD_BLOCK_SIZE);
+
+    if(n == SD_BLOCK_SIZE && buf != NULL && ((uint64_t)(buf + done) & 3) == 0)
+      writeblock(phy_bk, (void*)(buf + done));   // whole sector, straight from buf
+    else{
+      if((off > 0 && valid > 0) || off + n < valid){
+        readblock(phy_bk, temp);
+        stat.data_reads++;
+      }
+      else
+        memset_(temp, 0, SD_BLOCK_SIZE);
+      if(buf != NULL)
+        memcpy_(temp + off, buf + done, n);
+      else
+        memset_(temp + off, 0, n);
+      writeblock(phy_bk, temp);
+    }
+    stat.data_writes++;
+    pos += n;
+    done += n;
+  }
+  return done;
+}
+
+// Copy len bytes at offset pos of node to buf, the caller keeps it within the file. Return bytes read
+static size_t chain_read(fat32_node *node, size_t pos, char *buf, size_t len){
+  uint8_t temp[SD_BLOCK_SIZE] __attribute__((aligned(4)));
+  size_t done = 0;
+  while(done < len){
+    const uint32_t cluster = extent_map(node, pos / cluster_bytes);
+    if(cluster == 0){
+      uart_printf("Error, chain_read(), offset %lu of %s is beyond its chain\r\n", pos, node->entry.comp.comp_name);
+      break;
+    }
+    const uint32_t phy_bk = CLUSTER_TO_PHY_BK(cluster) + (pos % cluster_bytes) / SD_BLOCK_SIZE;
+    const size_t off = pos % SD_BLOCK_SIZE;
+    const size_t n = (SD_BLOCK_SIZE - off) < (len - done) ? (SD_BLOCK_SIZE - off) : (len - done);
+    if(n == SD_BLOCK_SIZE && ((uint64_t)(buf + done) & 3) == 0)
+      readblock(phy_bk, buf + done);
+    else{
+      readblock(phy_bk, temp);
+      memcpy_(buf + done, temp + off, n);
+    }
+    stat.data_reads++;
+    pos += n;
+    done += n;
+  }
+  return done;
+}
+
+
 // VFS bridge -----------------------------------------------------------
 static int fat32fs_mounted = 0;
 static int fat32fs_mount(struct filesystem *fs, struct mount *mount);
+static int fat32fs_sync_mount(struct mount *mount);
 
 // fops
 static int fat32fs_write(file *file, const void *buf, size_t len);
 static int fat32fs_read(file *file, void *buf, size_t len);
 static int fat32fs_open(vnode* file_node, file** target);
 static int fat32fs_close(file *file);
+static long fat32fs_lseek64(file *file, long offset, int whence);
 
 // vops
 static int fat32fs_mkdir(vnode *dir_node, vnode **target, const char *component_name);
@@ -129,13 +524,42 @@ static int fat32_filename_to_str(const char *fat32_filename, char *str){
   return j;
 }
 
+/** Create vnode of a file of the volume under dir_node, its chain is walked on first access
+ * @param dirent_phy_bk, dirent_idx: where its directory entry is, so the entry is updated without searching the directory
+*/
+static vnode *fat32_node_new(vnode *dir_node, const char *name, uint32_t first_cluster, size_t size,
+    uint32_t dirent_phy_bk, uint32_t dirent_idx){
+  fat32_node *node = (fat32_node*)tmpfs_node_alloc_size(name, sizeof(fat32_node));
+  if(node == NULL)
+    return NULL;
+  node->dirent_phy_bk = dirent_phy_bk;
+  node->dirent_idx = dirent_idx;
+  vnode *vn = &node->entry.node;
+  vn->f_ops = dir_node->f_ops;
+  vn->v_ops = dir_node->v_ops;
+  vn->comp->type = COMP_FILE;
+  vn->comp->lba = first_cluster;
+  vn->comp->len = size;
+  if(tmpfs_link(dir_node, vn) != 0){
+    diy_free(node);
+    return NULL;
+  }
+  return vn;
+}
+
 filesystem fat32fs = {
   .name = "fat32fs",
-  .setup_mount = fat32fs_mount
+  .setup_mount = fat32fs_mount,
+  .sync = fat32fs_sync_mount
 };
-file_operations fat32fs_fops = {.write=fat32fs_write, .read=fat32fs_read, .open=fat32fs_open, .close=fat32fs_close};
+file_operations fat32fs_fops = {.write=fat32fs_write, .read=fat32fs_read, .open=fat32fs_open, .close=fat32fs_close, .lseek64=fat32fs_lseek64};
 vnode_operations fat32fs_vops = {.lookup=fat32fs_lookup, .create=fat32fs_create, .mkdir=fat32fs_mkdir};
 
+// Sector cache is shared by the whole file system, so every mount syncs all of it
+static int fat32fs_sync_mount(mount *mount){
+  return fat32fs_sync();
+}
+
 static int fat32fs_mount(filesystem *fs, mount *mount){
   const MBR_t *mbr;
   uint32_t part1_phy_bk;
@@ -161,46 +585,46 @@ static int fat32fs_mount(filesystem *fs, mount *mount){
 
   boot_sector_t *VBR = (boot_sector_t*) buf;
   FAT1_phy_bk = part1_phy_bk + VBR->reserved_sector_cnt;
-  root_dir_phy_bk = FAT1_phy_bk + (VBR->fat_cnt * VBR->sector_per_fat32);
+  data_phy_bk = FAT1_phy_bk + (VBR->fat_cnt * VBR->sector_per_fat32);
   root_cluster = VBR->root_cluster;
   sec_per_fat32 = VBR->sector_per_fat32;
-  readblock(root_dir_phy_bk, buf);
-  dir_entry *root_dir_entry = (dir_entry*) buf;
+  fat_cnt = VBR->fat_cnt;
+  sec_per_cluster = VBR->sector_per_cluster;
+  cluster_bytes = sec_per_cluster * SD_BLOCK_SIZE;
+  root_dir_phy_bk = CLUSTER_TO_PHY_BK(root_cluster);
+  fsinfo_phy_bk = (VBR->info == 0 || VBR->info == 0xFFFF) ? 0 : part1_phy_bk + VBR->info;
+  if(fat_load(VBR->sector_cnt != 0 ? VBR->sector_cnt : VBR->old_sector_cnt,
+      VBR->reserved_sector_cnt + VBR->fat_cnt * VBR->sector_per_fat32) != 0)
+    return -1;
+  const dir_entry *root_dir_entry = (const dir_entry*)sector_get(root_dir_phy_bk, 0);
 
   uart_printf("Debug, fat32fs_mount(), FAT1_phy_bk=%d, root_dir_phy_bk=%d, root_cluster=%d, sec_per_fat32=%d\r\n",
     FAT1_phy_bk, root_dir_phy_bk, root_cluster, sec_per_fat32);
 
-  mount->root = diy_malloc(sizeof(vnode));
+  mount->root = tmpfs_node_alloc("");
   mount->fs = fs;
   mount->root->mount = NULL;
-  mount->root->comp = diy_malloc(sizeof(vnode_comp));
-  mount->root->comp->comp_name = "";
   mount->root->comp->len = 0;
-  mount->root->comp->lba = root_dir_phy_bk;
+  mount->root->comp->entries = NULL;  // root directory is at root_dir_phy_bk, entries shares storage with lba
+  mount->root->comp->index = NULL;
   mount->root->comp->type = COMP_DIR;
   mount->root->f_ops = &fat32fs_fops;
   mount->root->v_ops = &fat32fs_vops;
 
   // Insert files in the root_dir_entry to the file system
   vnode *dir_node = mount->root;
-  vnode *node_new = NULL;
   const dir_entry *item = (dir_entry*) root_dir_entry;
   for(int i=0; i<SD_BLOCK_SIZE/sizeof(dir_entry); i++){
     
     // Skip empty entry
     if(item[i].name[0] != '\0'){
-      char *name = diy_malloc(sizeof(item->name) + 2); // +1 for . in fileName.ext and end of string
+      char name[sizeof(item->name) + 2]; // +1 for . in fileName.ext and end of string
       
       // Copy entry name
       fat32_filename_to_str(item[i].name, name);
 
-      // Create entry along tmpfs
-      lookup_recur((char*)name, dir_node, &node_new, 1);
-      
-      // Config entry to a file
-      node_new->comp->type = COMP_FILE;
-      node_new->comp->lba =  item[i].fstClusHI << 16 | item[i].fstClusLO; 
-      node_new->comp->len = item[i].fileSize;
+      // Create entry along tmpfs, as a file
+      fat32_node_new(dir_node, name, item[i].fstClusHI << 16 | item[i].fstClusLO, item[i].fileSize, root_dir_phy_bk, i);
     }
   }
 
@@ -210,58 +634,56 @@ static int fat32fs_mount(filesystem *fs, mount *mount){
 
 // fops
 static int fat32fs_write(file *file, const void *buf, size_t len){
-  len = len <= SD_BLOCK_SIZE ? len : SD_BLOCK_SIZE;
-  uint32_t block_cnt = len / SD_BLOCK_SIZE + (len%SD_BLOCK_SIZE != 0);
-  char *temp = diy_malloc(SD_BLOCK_SIZE * block_cnt);
-  char name[13];  // 11 char + '.' + '\0'
-  uint32_t phy_block = FROM_LBA_TO_PHY_BK(file->vnode->comp->lba);
-
-  // Read modify write
-  readblock(phy_block, temp);
-  memcpy_(temp, buf, len);
-  writeblock(phy_block, temp);
-
-  // Update root dir entry
-  readblock(root_dir_phy_bk, temp);
-  dir_entry *root_dir_entry = (dir_entry*) temp;
-  dir_entry *item = (dir_entry*) root_dir_entry;
-  const uint32_t entires_per_dir = SD_BLOCK_SIZE/sizeof(dir_entry);
-  int i = 0;
-  for(i=0; i<entires_per_dir; i++){
-    if(item[i].name[0] != '\0'){  // skip empty entry
-      fat32_filename_to_str(item[i].name, name);
-      if(strcmp_(file->vnode->comp->comp_name, name) == 0)
-        break;
-    }
+  fat32_node *node = (fat32_node*)file->vnode;
+  vnode_comp *comp = file->vnode->comp;
+  if(extent_load(node) != 0)
+    return -1;
+
+  // Zeros between the end of file and f_pos, left by seeking past the end
+  if(file->f_pos > comp->len){
+    const size_t gap = file->f_pos - comp->len;
+    const size_t filled = chain_write(node, comp->len, NULL, gap);
+    comp->len += filled;
+    if(filled < gap)
+      len = 0;
+  }
+  const size_t written = chain_write(node, file->f_pos, buf, len);
+  const size_t new_size = (file->f_pos + written) > comp->len ? (file->f_pos + written) : comp->len;
+
+  // Update directory entry in the sector cache, written back later by fat32fs_sync()
+  dir_entry *item = (dir_entry*)sector_get(node->dirent_phy_bk, 0) + node->dirent_idx;
+  if(item->fileSize != new_size || (item->fstClusHI << 16 | item->fstClusLO) != comp->lba){
+    item = (dir_entry*)sector_get(node->dirent_phy_bk, 1) + node->dirent_idx;
+    item->fileSize = new_size;
+    item->fstClusHI = (comp->lba >> 16) & 0x0000FFFF;
+    item->fstClusLO = comp->lba & 0x0000FFFF;
   }
-  if(i >= entires_per_dir) return -1;
-  item = &item[i];
-  item->fileSize = len;
-  writeblock(root_dir_phy_bk, temp);
 
-  file->vnode->comp->len = len;
-  diy_free(temp);
-  return len;
+  comp->len = new_size;
+  file->f_pos += written;
+  return written;
 }
 static int fat32fs_read(file *file, void *buf, size_t len){
-  len = len <= file->vnode->comp->len ? len : file->vnode->comp->len;
-  uint32_t block_cnt = len / SD_BLOCK_SIZE + (len%SD_BLOCK_SIZE != 0);
-  char *temp = diy_malloc(SD_BLOCK_SIZE * block_cnt);
-  uint32_t phy_block = FROM_LBA_TO_PHY_BK(file->vnode->comp->lba);
-  for(int i=0; i<block_cnt; i++)
-    readblock(phy_block + i, temp + i*SD_BLOCK_SIZE);
-  memcpy_(buf, temp, len);
-
-  uart_printf("Debug, fat32fs_read(), reading file %s, starting phy block=%d\r\n", file->vnode->comp->comp_name, phy_block);
-  diy_free(temp);
+  fat32_node *node = (fat32_node*)file->vnode;
+  if(file->f_pos >= file->vnode->comp->len)
+    return 0; // end of file
+  len = (file->f_pos + len) <= file->vnode->comp->len ? len : (file->vnode->comp->len - file->f_pos);
+  if(extent_load(node) != 0)
+    return -1;
+  len = chain_read(node, file->f_pos, buf, len);
+  file->f_pos += len;
   return len;
 }
 static int fat32fs_open(vnode* file_node, file** target){
   return tmpfs_open(file_node, target);
 }
 static int fat32fs_close(file *file){
+  fat32fs_sync();
   return tmpfs_close(file);
 }
+static long fat32fs_lseek64(file *file, long offset, int whence){
+  return tmpfs_lseek64(file, offset, whence);
+}
 
 // vops
 static int fat32fs_mkdir(vnode *dir_node, vnode **target, const char *component_name){
@@ -274,32 +696,19 @@ static int fat32fs_mkdir(vnode *dir_node, vnode **target, const char *component_
 }
 static int fat32fs_create(vnode *dir_node, vnode **target, const char *component_name){
   if(fat32fs_mounted){
-    // Find free entry in FAT1 and mark it as used (eof)
-    char temp[SD_BLOCK_SIZE];
-    uint32_t lba = 0;
-    const uint32_t entries_per_sec = SD_BLOCK_SIZE/sizeof(uint32_t);
-    for(int b=0; b<sec_per_fat32; b++){  // walk through sectors(blocks) in FAT1
-      readblock(b + FAT1_phy_bk, temp);
-      uint32_t *fat_entry = (uint32_t*) temp;
-      for(int i=0; i<entries_per_sec; i++){  // walk through each entry
-        if(fat_entry[i] == FAT_ENTRY_EMPTY){
-          fat_entry[i] = FAT_ENTRY_EOF; // immediate mark this as entry EOF, i.e., this file occupies 1 sector
-          writeblock(b + FAT1_phy_bk, temp); // write back
-          lba = b * entries_per_sec + i;
-          break;
-        }
-      }
-      if(lba != 0)
-        break;
+    if(tmpfs_lookup(dir_node, target, component_name) == 0){
+      uart_printf("Warning, fat32fs_create(), %s already exist under %s\r\n", component_name, dir_node->comp->comp_name);
+      return 1;
     }
+    // Take a free cluster in memory, FAT and directory sectors are written back by fat32fs_sync()
+    const uint32_t lba = fat_alloc_cluster(0);
 
     // Fill free directory entry
     if(lba != 0){
       // uart_printf("Debug, fat32fs_create(), ------------- lba = %d\r\n", lba);
 
       // Find free entry in root directory
-      readblock(root_dir_phy_bk, temp);
-      dir_entry *root_dir_entry = (dir_entry*) temp;
+      dir_entry *root_dir_entry = (dir_entry*)sector_get(root_dir_phy_bk, 0);
       dir_entry *item = (dir_entry*) root_dir_entry;
       const uint32_t entires_per_dir = SD_BLOCK_SIZE/sizeof(dir_entry);
       int i = 0;
@@ -310,7 +719,7 @@ static int fat32fs_create(vnode *dir_node, vnode **target, const char *component
 
       // Free entry found
       if(i < entires_per_dir){
-        item = &item[i];
+        item = &((dir_entry*)sector_get(root_dir_phy_bk, 1))[i];
         int j = 0; // component_name[j]
         int k = 0; // item->name[k]
         // Copy filename
@@ -321,26 +730,25 @@ static int fat32fs_create(vnode *dir_node, vnode **target, const char *component
         // Copy extention
         while(k < 11 && component_name[j] != '\0')  item->name[k++] = component_name[j++];
 
-        // Config entry metadata and write back to SD card
+        // Config entry metadata
         item->attr = DIR_ENTRY_ATTR_ARCHIVE;
         item->wrtDate = DIR_ENTRY_wrtDate_mock;
         item->wrtTime = DIR_ENTRY_wrtTime_mock;
         item->fstClusHI = (lba >> 16) & 0x0000FFFF;
         item->fstClusLO = lba & 0x0000FFFF;
         item->fileSize = 0;
-        writeblock(root_dir_phy_bk, temp);  // since item is sort of temp's reference
 
-        int ret = tmpfs_create(dir_node, target, component_name);
-        if(ret == 0) (*target)->comp->lba = lba;
-        return ret;
+        *target = fat32_node_new(dir_node, component_name, lba, 0, root_dir_phy_bk, i);
+        return *target == NULL;
       }
       else{
         uart_printf("Error, fat32fs_create(), cannot find free entry in root_dir_entry\r\n");
+        fat_free_cluster(lba);
         return 1;
       }
     }
     else {
-      uart_printf("Error, fat32fs_create(), cannot find free entry in FAT1\r\n");
+      uart_printf("Error, fat32fs_create(), no free cluster\r\n");
       return 1;
     }
   }
@@ -351,3 +759,25 @@ static int fat32fs_lookup(vnode *dir_node, vnode **target, const char *component
   // uart_printf("Exception, fat32fs_lookup(), unimplemented, name=%s.\r\n", component_name);
   return tmpfs_lookup(dir_node, target, component_name);
 }
+
+// Write a file of 100 chunks of 100 bytes then close it, metadata should cost a few writes in total, not a few per chunk
+void fat32fs_bench(){
+  static const char chunk[100];
+  const fat32_stat before = *fat32fs_get_stat();
+  const uint64_t t0 = read_sysreg(cntpct_el0);
+  const int fd = sysc_open("/boot/BENCH.TXT", O_CREAT);
+  if(fd < 0){
+    uart_printf("Error, fat32fs_bench(), cannot open /boot/BENCH.TXT\r\n");
+    return;
+  }
+  for(int i=0; i<100; i++)
+    sysc_write(fd, chunk, sizeof(chunk));
+  sysc_close(fd);
+  const uint64_t t1 = read_sysreg(cntpct_el0);
+
+  const fat32_stat *after = fat32fs_get_stat();
+  uart_printf("fat32fs_bench(): 100 writes of %lu bytes in %lu us, data: %lu reads %lu writes, metadata: %lu reads %lu writes\r\n",
+    sizeof(chunk), (t1 - t0) * 1000000 / read_sysreg(cntfrq_el0),
+    after->data_reads - before.data_reads, after->data_writes - before.data_writes,
+    after->sd_reads - before.sd_reads, after->sd_writes - before.sd_writes);
+}
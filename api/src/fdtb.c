@@ -15,11 +15,16 @@
 #define FDT_TK_END        0X00000009
 
 #define FDT_CPIO_INITRAMFS_PROPNAME "linux,initrd-start"
+#define FDT_INITRD_END_PROPNAME     "linux,initrd-end"
+
+static uint64_t initrd_start = 0; // extent of initramfs from /chosen, 0 if not found
+static uint64_t initrd_end = 0;
 
 static uint64_t pad_to_4(void *num);
 static void dump(void *arr, const uint32_t len);
 static uint32_t rev32(uint32_t val);
 static uint64_t endian_rev(void *input, int dtype_size);
+static uint64_t prop_addr(const char *val, uint32_t len);
 
 // Return devive tree size if parsed success, -1 if failed
 int fdtb_parse(void *dtb_addr, int print, cpio_parse_func *callback){
@@ -61,12 +66,13 @@ int fdtb_parse(void *dtb_addr, int print, cpio_parse_func *callback){
         propVal = (char*) cur;
         if(print) uart_printf("PROP_NODE  depth=%d, cur=%p, prop.len=%2d, .nameoff=0x%8X, propName=%s, propVal=%s\r\n", 
                       depth, cur, rev32(prop->len), rev32(prop->nameoff), propName, propVal);
-        // TODO: Get linux,initrd-start start address here
-        if(!strcmp_(FDT_CPIO_INITRAMFS_PROPNAME, propName) && callback != NULL){
-          uint64_t addr = (uint64_t) rev32( *((uint32_t*)propVal) );
-          addr |= VM_KERNEL_PREFIX;
-          (*callback) ((void*)addr);
+        if(!strcmp_(FDT_CPIO_INITRAMFS_PROPNAME, propName)){
+          initrd_start = prop_addr(propVal, rev32(prop->len)) | VM_KERNEL_PREFIX;
+          if(callback != NULL)
+            (*callback) ((void*)initrd_start);
         }
+        else if(!strcmp_(FDT_INITRD_END_PROPNAME, propName))
+          initrd_end = prop_addr(propVal, rev32(prop->len)) | VM_KERNEL_PREFIX;
         cur += rev32(prop->len);
         cur += pad_to_4(cur);
         break;
@@ -107,6 +113,26 @@ int fdtb_parse(void *dtb_addr, int print, cpio_parse_func *callback){
   return rev32(header->totalsize);
 }
 
+/** Extent of initramfs given by the boot loader in /chosen of the device tree.
+ * @return 0 if both linux,initrd-start and linux,initrd-end are found by fdtb_parse(), -1 otherwise
+*/
+int fdtb_get_initrd(uint64_t *start, uint64_t *end){
+  if(initrd_start == 0 || initrd_end <= initrd_start)
+    return -1;
+  *start = initrd_start;
+  *end = initrd_end;
+  return 0;
+}
+
+// Address property of 1 or 2 cells, big endian
+static uint64_t prop_addr(const char *val, uint32_t len){
+  uint32_t cell[2];
+  memcpy_(cell, val, len == 8 ? 8 : 4);   // property value is only 4 byte aligned
+  if(len == 8)
+    return ((uint64_t)rev32(cell[0]) << 32) | rev32(cell[1]);
+  return rev32(cell[0]);
+}
+
 static uint64_t pad_to_4(void *num){
   uint64_t modded = ((uint64_t)num) % 4;
   return modded==0 ? 0 : 4 - modded;
@@ -0,0 +1,150 @@
+#include "lz4.h"
+#include "uart.h"
+
+#define LZ4_FLG_VERSION_MASK  0xC0
+#define LZ4_FLG_VERSION       0x40
+#define LZ4_FLG_BLOCK_CHECK   0x10
+#define LZ4_FLG_CONTENT_SIZE  0x08
+#define LZ4_FLG_DICT_ID       0x01
+#define LZ4_BLOCK_UNCOMPRESSED 0x80000000u  // highest bit of block size in frame format
+
+static inline uint32_t read_le32(const uint8_t *p){
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Return 1 if src starts with magic number of LZ4 frame or legacy format
+int lz4_is_compressed(const void *src){
+  const uint32_t magic = read_le32((const uint8_t*)src);
+  return magic == LZ4_FRAME_MAGIC || magic == LZ4_LEGACY_MAGIC;
+}
+
+/** Decode one block of sequences, appending to out[*pos].
+ * Matches may reach back into earlier blocks, since every block is decoded into the same buffer.
+ * @param out: NULL to count the bytes only
+ * @return 0 on success, -1 on corrupted block or out of room
+*/
+static int lz4_block(const uint8_t *in, size_t in_len, uint8_t *out, size_t cap, size_t *pos){
+  const uint8_t *const end = in + in_len;
+  size_t w = *pos;
+  while(in < end){
+    const uint8_t token = *in++;
+
+    // Literals, length 15 continues with bytes till one is not 255
+    size_t len = token >> 4;
+    if(len == 15){
+      uint8_t b = 255;
+      while(b == 255 && in < end){
+        b = *in++;
+        len += b;
+      }
+    }
+    if(len > (size_t)(end - in) || (out != NULL && len > cap - w))
+      return -1;
+    if(out != NULL){
+      for(size_t i=0; i<len; i++)
+        out[w + i] = in[i];
+    }
+    in += len;
+    w += len;
+    if(in == end)
+      break;  // last sequence has literals only
+
+    // Match, copied byte by byte since it may overlap what it produces
+    if(end - in < 2)
+      return -1;
+    const size_t offset = in[0] | (in[1] << 8);
+    in += 2;
+    len = (token & 0x0F);
+    if(len == 15){
+      uint8_t b = 255;
+      while(b == 255 && in < end){
+        b = *in++;
+        len += b;
+      }
+    }
+    len += LZ4_MIN_MATCH;
+    if(offset == 0 || offset > w || (out != NULL && len > cap - w))
+      return -1;
+    if(out != NULL){
+      const uint8_t *from = out + w - offset;
+      for(size_t i=0; i<len; i++)
+        out[w + i] = from[i];
+    }
+    w += len;
+  }
+  *pos = w;
+  return 0;
+}
+
+/** Decompress src of src_len bytes, in frame or legacy format, into dst.
+ * @param dst: NULL to find the decompressed size, without writing anything
+ * @return bytes decompressed, -1 if src is not LZ4 or is corrupted, or dst_cap is too small
+*/
+long lz4_decompress(const void *src, size_t src_len, void *dst, size_t dst_cap){
+  const uint8_t *in = (const uint8_t*)src;
+  const uint8_t *const end = in + src_len;
+  uint8_t *out = (uint8_t*)dst;
+  size_t pos = 0;
+  if(src_len < 4)
+    return -1;
+
+  const uint32_t magic = read_le32(in);
+  in += 4;
+  if(magic == LZ4_LEGACY_MAGIC){
+    // Compressed size of each block, till the end or another stream
+    while(end - in >= 4){
+      const uint32_t size = read_le32(in);
+      if(size == LZ4_LEGACY_MAGIC){
+        in += 4;
+        continue;   // concatenated streams
+      }
+      in += 4;
+      if(size > (size_t)(end - in) || lz4_block(in, size, out, dst_cap, &pos) != 0){
+        uart_printf("Error, lz4_decompress(), corrupted legacy block at offset %lu\r\n", (uint64_t)(in - (const uint8_t*)src));
+        return -1;
+      }
+      in += size;
+    }
+    return pos;
+  }
+  if(magic != LZ4_FRAME_MAGIC){
+    uart_printf("Error, lz4_decompress(), magic=0x%08X, not LZ4\r\n", magic);
+    return -1;
+  }
+
+  // Frame descriptor: FLG, BD, optional content size and dictionary id, header checksum
+  if(end - in < 3)
+    return -1;
+  const uint8_t flg = in[0];
+  if((flg & LZ4_FLG_VERSION_MASK) != LZ4_FLG_VERSION || (flg & LZ4_FLG_DICT_ID)){
+    uart_printf("Error, lz4_decompress(), FLG=0x%02X, unsupported version or dictionary\r\n", flg);
+    return -1;
+  }
+  in += 2 + ((flg & LZ4_FLG_CONTENT_SIZE) ? 8 : 0) + 1;
+
+  while(end - in >= 4){
+    const uint32_t size = read_le32(in) & ~LZ4_BLOCK_UNCOMPRESSED;
+    const int raw = (read_le32(in) & LZ4_BLOCK_UNCOMPRESSED) != 0;
+    in += 4;
+    if(size == 0 && !raw)
+      return pos;   // end mark, content checksum after it is not checked
+    if(size > (size_t)(end - in)){
+      uart_printf("Error, lz4_decompress(), block of %u bytes past the end\r\n", size);
+      return -1;
+    }
+    if(raw){
+      if(out != NULL && size > dst_cap - pos)
+        return -1;
+      for(size_t i=0; out != NULL && i<size; i++)
+        out[pos + i] = in[i];
+      pos += size;
+    }
+    else if(lz4_block(in, size, out, dst_cap, &pos) != 0){
+      uart_printf("Error, lz4_decompress(), corrupted block at offset %lu\r\n", (uint64_t)(in - (const uint8_t*)src));
+      return -1;
+    }
+    in += size + ((flg & LZ4_FLG_BLOCK_CHECK) ? 4 : 0);
+  }
+  uart_printf("Error, lz4_decompress(), no end mark\r\n");
+  return -1;
+}
@@ -19,6 +19,8 @@
 #define PD_BLOCK 0b01
 #define PD_ACCESS (1 << 10)
 #define PD_USER_KERNEL_ACCESS (1 << 6)
+#define PD_READ_ONLY (1 << 7)           // AP[2], read-only for both el0 and el1
+#define PD_COPY_ON_WRITE (1LL << 55)    // software defined bit, ignored by hardware. Set along with PD_READ_ONLY
 
 #define KERNEL_VM_TO_PM_MASK 0x0000FFFFFFFFFFFF // for kernel, virtual mem addr to physical mem addr
 
@@ -30,48 +32,177 @@ uint64_t *new_page_table(){
   return table_addr;
 }
 
+/** Walk the page table of pgd down to the PTE (level 3 entry) of va.
+ * @param create: Set to 1 to allocate missing tables along the walk, 0 to return NULL on missing tables
+ * @return kernel virtual address of the PTE, NULL if not found
+*/
+uint64_t *page_table_walk(uint64_t *pgd, uint64_t va, int create){
+  int index[4]; // index of each table for L0~3
+  uint64_t *table = (uint64_t*) KERNEL_PA_TO_VA((uint64_t)pgd);
+  va >>= 12;   index[3] = va & 0x1ff;
+  va >>= 9;    index[2] = va & 0x1ff;
+  va >>= 9;    index[1] = va & 0x1ff;
+  va >>= 9;    index[0] = va & 0x1ff;
+
+  // Find the address of level3 table
+  for(int lv=0; lv<3; lv++) {  // map lv0~2
+    
+    // Allocate a table that table[index[lv]] can point to
+    if(table[index[lv]] == 0){
+      if(!create) return NULL;
+      table[index[lv]] = KERNEL_VA_TO_PA(new_page_table()) | PD_TABLE;
+    }
+
+    // Next level, remove attributes at low 12 bits
+    table = (uint64_t*)KERNEL_PA_TO_VA(CLEAR_LOW_12bit(table[index[lv]]));
+  }
+  return &table[index[3]];
+}
+
 void map_pages(uint64_t *pgd, uint64_t va_start, uint64_t pa_start, int num){
   if (pgd == NULL || pa_start == 0){
     uart_printf("Error, in map_pages(), pgd=0x%p, pa_start=0x%p\r\n", pgd, (void*)pa_start);
     return;
   }
 
-  int index[4]; // index of each table for L0~3
-  uint64_t va = 0;
-  uint64_t *table = NULL;
-  uint64_t entry = 0;
+  uint64_t *pte = NULL;
   pa_start = KERNEL_VA_TO_PA(pa_start);
   for (int n = 0; n < num; ++n) {
-    
-    // Get index of each level
-    va = (uint64_t)(va_start + n*PAGE_SIZE);
-    va >>= 12;   index[3] = va & 0x1ff;
-    va >>= 9;    index[2] = va & 0x1ff;
-    va >>= 9;    index[1] = va & 0x1ff;
-    va >>= 9;    index[0] = va & 0x1ff;
-    table = (uint64_t*) KERNEL_PA_TO_VA((uint64_t)pgd);
-    entry = 0;
-
-    // Find the address of level3 table
-    for(int lv=0; lv<3; lv++) {  // map lv0~2
-      
-      // Allocate a table that table[index[lv]] can point to
-      if(table[index[lv]] == 0){
-        table[index[lv]] = KERNEL_VA_TO_PA(new_page_table()) | PD_TABLE;
-      }
+    pte = page_table_walk(pgd, va_start + n*PAGE_SIZE, 1);
+
+    // leve3, aka PTE
+    if(*pte != 0)
+      uart_printf("Warning, in map_pages(), PTE=%lx alread mapped, va=0x%lx\r\n", *pte, va_start + n*PAGE_SIZE);
+    *pte = (pa_start + n*PAGE_SIZE) | PD_ACCESS | PD_USER_KERNEL_ACCESS | (MAIR_IDX_NORMAL_NOCACHE << MAIR_SHIFT) | PD_PAGE;
+  }
+}
+
+// Drop the reference of the frame a PTE points to, free the frame if no one maps it anymore
+static void pte_release(uint64_t pte){
+  const uint64_t pa = CLEAR_LOW_12bit(ENTRY_GET_PA(pte));
+  if(page_ref_get(pa) > 0 && page_ref_dec(pa) == 0)
+    diy_free((void*)KERNEL_PA_TO_VA(pa));
+}
+
+static void tlb_flush_all(){
+  asm volatile("dsb ish");            // ensure write has completed
+  asm volatile("tlbi vmalle1is");     // invalidate all TLB entries
+  asm volatile("dsb ish");            // ensure completion of TLB invalidatation
+  asm volatile("isb");                // clear pipeline
+}
+
+/** Map frames with reference counting, so the frames can be shared between address spaces and released on teardown.
+ * Reference count of each frame is increased, and the frame previously mapped at the same va is released.
+ * @param flags: MMU_MAP_READ_ONLY for pages never written, e.g. text of a program image,
+ *  MMU_MAP_READ_ONLY|MMU_MAP_COPY_ON_WRITE for pages that the first write gives the writer a private copy, see mmu_page_fault()
+*/
+void map_pages_counted(uint64_t *pgd, uint64_t va_start, uint64_t pa_start, int num, int flags){
+  if (pgd == NULL || pa_start == 0){
+    uart_printf("Error, in map_pages_counted(), pgd=0x%p, pa_start=0x%p\r\n", pgd, (void*)pa_start);
+    return;
+  }
+
+  uint64_t *pte = NULL;
+  uint64_t pa = 0;
+  uint64_t attrs = PD_ACCESS | PD_USER_KERNEL_ACCESS | (MAIR_IDX_NORMAL_NOCACHE << MAIR_SHIFT) | PD_PAGE;
+  if(flags & MMU_MAP_READ_ONLY)     attrs |= PD_READ_ONLY;
+  if(flags & MMU_MAP_COPY_ON_WRITE) attrs |= PD_COPY_ON_WRITE;
+  pa_start = KERNEL_VA_TO_PA(pa_start);
+  for (int n = 0; n < num; ++n) {
+    pte = page_table_walk(pgd, va_start + n*PAGE_SIZE, 1);
+    pa = pa_start + n*PAGE_SIZE;
+    page_ref_inc(pa);
+    if(*pte != 0)
+      pte_release(*pte);
+    *pte = pa | attrs;
+  }
+  tlb_flush_all();
+}
+
+// Remove mappings of num pages from va_start, frames lose one reference
+void unmap_pages(uint64_t *pgd, uint64_t va_start, int num){
+  uint64_t *pte = NULL;
+  for (int n = 0; n < num; ++n) {
+    pte = page_table_walk(pgd, va_start + n*PAGE_SIZE, 0);
+    if(pte == NULL || *pte == 0) continue;
+    pte_release(*pte);
+    *pte = 0;
+  }
+  tlb_flush_all();
+}
 
-      // Remove attributes at low 12 bits
-      entry = CLEAR_LOW_12bit(table[index[lv]]);
+/** Remove mappings of num pages from va_start and hand their frames to the caller, so the frames can be mapped
+ * into another page table without copying. Only private writable frames are detached, i.e. not copy-on-write and
+ * mapped once by map_pages_counted(), other pages are left mapped.
+ * @param frames: num elements, kernel address of each detached frame, which keeps the reference of the removed mapping.
+ *  0 for pages not detached
+ * @return count of pages detached
+*/
+int detach_pages(uint64_t *pgd, uint64_t va_start, int num, uint64_t *frames){
+  uint64_t *pte = NULL;
+  int cnt = 0;
+  for (int n = 0; n < num; ++n) {
+    frames[n] = 0;
+    pte = page_table_walk(pgd, va_start + n*PAGE_SIZE, 0);
+    if(pte == NULL || *pte == 0 || (*pte & PD_READ_ONLY)) continue;
+    if(page_ref_get(ENTRY_GET_PA(*pte)) != 1) continue;
+    frames[n] = KERNEL_PA_TO_VA(ENTRY_GET_PA(*pte));
+    *pte = 0;
+    cnt++;
+  }
+  if(cnt > 0)
+    tlb_flush_all();
+  return cnt;
+}
 
-      // Next level
-      table = (uint64_t*)KERNEL_PA_TO_VA(entry); // address of the first entry of next level table
+/** Handle data abort caused by writing to a copy-on-write page, or accessing a page in zero_areas for the first time.
+ * @param pgd: page table of the faulting thread
+ * @param far: faulting virtual address, from far_el1
+ * @param esr: syndrome, from esr_el1
+ * @param zero_areas: areas mapped to zeroed pages on demand, e.g. .bss of a program
+ * @param area_cnt: count of zero_areas
+ * @return 0 if the fault is resolved and the faulting instruction can be retried, non-0 otherwise
+*/
+int mmu_page_fault(uint64_t *pgd, uint64_t far, uint64_t esr, const vm_area *zero_areas, int area_cnt){
+  const uint64_t dfsc = ESR_ELx_ISS_DFSC(esr);
+
+  // First access to a zero-filled area
+  if(dfsc >= ESR_DFSC_TRANSLATION_L0 && dfsc <= ESR_DFSC_TRANSLATION_L3){
+    for(int i=0; i<area_cnt; i++){
+      if(far >= zero_areas[i].start && far < zero_areas[i].end){
+        uint8_t *page = diy_malloc(PAGE_SIZE);
+        memset_(page, 0, PAGE_SIZE);
+        map_pages_counted(pgd, CLEAR_LOW_12bit(far), (uint64_t)page, 1, MMU_MAP_READ_WRITE);
+        return 0;
+      }
     }
+    return 1;
+  }
 
-    // leve3, aka PTE
-    if(table[index[3]] != 0)
-      uart_printf("Warning, in map_pages(), PTE[%d]=%lx alread mapped\r\n", index[3], table[index[3]]);
-    table[index[3]] = (pa_start + n*PAGE_SIZE) | PD_ACCESS | PD_USER_KERNEL_ACCESS | (MAIR_IDX_NORMAL_NOCACHE << MAIR_SHIFT) | PD_PAGE;
+  if(!ESR_ELx_ISS_WNR(esr) || dfsc < ESR_DFSC_PERMISSION_L1 || dfsc > ESR_DFSC_PERMISSION_L3)
+    return 1; // not a write to a read-only page
+
+  uint64_t *pte = page_table_walk(pgd, far, 0);
+  if(pte == NULL || !(*pte & PD_COPY_ON_WRITE))
+    return 2; // really read-only
+
+  const uint64_t pa = CLEAR_LOW_12bit(ENTRY_GET_PA(*pte));
+  const uint64_t attrs = ENTRY_GET_ATTRS(*pte) & ~(PD_COPY_ON_WRITE | PD_READ_ONLY);
+
+  // Someone else still maps the frame, copy it to a private one
+  if(page_ref_get(pa) > 1){
+    uint8_t *copy = diy_malloc(PAGE_SIZE);
+    memcpy_(copy, (void*)KERNEL_PA_TO_VA(pa), PAGE_SIZE);
+    page_ref_inc((uint64_t)copy);
+    pte_release(*pte);
+    *pte = KERNEL_VA_TO_PA(copy) | attrs;
   }
+  // The only mapping left, just take it over
+  else
+    *pte = pa | attrs;
+
+  tlb_flush_all();
+  return 0;
 }
 
 void mmu_init(){
@@ -152,6 +283,8 @@ void copy_page_table(uint64_t *from, uint64_t *to){
         for(int i3=0; i3<(PAGE_SIZE/8); i3++){
           if(TF_L3[i3] == 0) continue; // skip empty entry
           TT_L3[i3] = TF_L3[i3];
+          if(page_ref_get(ENTRY_GET_PA(TF_L3[i3])) > 0)  // shared frame gains one more mapping
+            page_ref_inc(ENTRY_GET_PA(TF_L3[i3]));
           // TT_L3[i3] = ENTRY_GET_ATTRS(TF_L3[i3]);
           // TT_L3[i3] |= KERNEL_VA_TO_PA( new_page_table() );
         }
@@ -160,6 +293,38 @@ void copy_page_table(uint64_t *from, uint64_t *to){
   }
 }
 
+/** Release a page table created by new_page_table() and its sub-tables.
+ * Shared frames mapped by the table lose one reference, and are freed if no one maps them anymore.
+ * Block entries (e.g. identity mapping of the kernel) are not walked into.
+*/
+void free_page_table(uint64_t *pgd){
+  uint64_t *table_L0 = (uint64_t*)KERNEL_PA_TO_VA(pgd);
+  uint64_t *table_L1, *table_L2, *table_L3;
+  for(int i0=0; i0<(PAGE_SIZE/8); i0++){
+    if((table_L0[i0] & 0b11) != PD_TABLE) continue; // skip empty entry
+    table_L1 = (uint64_t*) KERNEL_PA_TO_VA(CLEAR_LOW_12bit(ENTRY_GET_PA(table_L0[i0])));
+
+    for(int i1=0; i1<(PAGE_SIZE/8); i1++){
+      if((table_L1[i1] & 0b11) != PD_TABLE) continue; // skip empty entry and 1GB block
+      table_L2 = (uint64_t*) KERNEL_PA_TO_VA(CLEAR_LOW_12bit(ENTRY_GET_PA(table_L1[i1])));
+
+      for(int i2=0; i2<(PAGE_SIZE/8); i2++){
+        if((table_L2[i2] & 0b11) != PD_TABLE) continue; // skip empty entry and 2MB block
+        table_L3 = (uint64_t*) KERNEL_PA_TO_VA(CLEAR_LOW_12bit(ENTRY_GET_PA(table_L2[i2])));
+
+        for(int i3=0; i3<(PAGE_SIZE/8); i3++){
+          if(table_L3[i3] != 0)
+            pte_release(table_L3[i3]);
+        }
+        diy_free(table_L3);
+      }
+      diy_free(table_L2);
+    }
+    diy_free(table_L1);
+  }
+  diy_free(table_L0);
+}
+
 void dump_page_table(uint64_t *pgd){
   uint64_t *table_L0 = (uint64_t*)KERNEL_PA_TO_VA(pgd);
   uint64_t *table_L1, *table_L2, *table_L3;
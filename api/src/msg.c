@@ -0,0 +1,237 @@
+#include "msg.h"
+#include "system_call.h"
+#include "mmu.h"
+#include "diy_malloc.h"
+#include "diy_string.h"
+#include "sys_reg.h"
+#include "uart.h"
+
+static msg_stat stat;
+
+// Kernel side ---------------------------------------
+
+static msg_queue *msg_queue_of(thread_t *thd){
+  if(thd->mq == NULL){
+    thd->mq = diy_malloc(sizeof(msg_queue));
+    memset_(thd->mq, 0, sizeof(msg_queue));
+  }
+  return thd->mq;
+}
+
+// Return 1 if whole pages of buf can be moved in or out of the address space of thd
+static int msg_can_move(thread_t *thd, const void *buf, size_t len){
+#ifdef VIRTUAL_MEM
+  return thd->ttbr0_el1 != PAGE_TABLE_STATICS_START_ADDR && len >= PAGE_SIZE && (uint64_t)buf == PAGE_FLOOR(buf);
+#else
+  return 0;
+#endif
+}
+
+// Drop the reference of the message on a frame
+static void msg_frame_put(uint64_t frame){
+  if(page_ref_dec(frame) == 0)
+    diy_free((void*)frame);
+}
+
+/** Take the payload out of the sender.
+ * Whole pages are detached from the sender if possible, and a zeroed page is mapped in place of each,
+ * so whole pages of buf read as zeros after sending and the sender can keep using buf.
+ * Bytes of the last partial page are copied, so the rest of that page stays with the sender.
+*/
+static message *msg_pack(thread_t *thd, const void *buf, size_t len){
+  message *msg = diy_malloc(sizeof(message));
+  memset_(msg, 0, sizeof(message));
+  msg->from = thd->pid;
+  msg->len = len;
+  if(!msg_can_move(thd, buf, len)){
+    if(len > 0){
+      msg->data = diy_malloc(len);
+      memcpy_(msg->data, buf, len);
+      stat.pages_copied += PAGE_CEIL(len) / PAGE_SIZE;
+    }
+    return msg;
+  }
+
+#ifdef VIRTUAL_MEM
+  const size_t whole = len / PAGE_SIZE;
+  msg->page_cnt = PAGE_CEIL(len) / PAGE_SIZE;
+  msg->frames = diy_malloc(msg->page_cnt * sizeof(uint64_t));
+  memset_(msg->frames, 0, msg->page_cnt * sizeof(uint64_t));
+  detach_pages((uint64_t*)thd->ttbr0_el1, (uint64_t)buf, whole, msg->frames);
+  for(size_t i=0; i<msg->page_cnt; i++){
+    if(msg->frames[i] != 0){
+      // Moved, the sender gets a zeroed page instead of a hole, which would fault on its next access
+      uint8_t *zero = diy_malloc(PAGE_SIZE);
+      memset_(zero, 0, PAGE_SIZE);
+      map_pages_counted((uint64_t*)thd->ttbr0_el1, (uint64_t)buf + i*PAGE_SIZE, (uint64_t)zero, 1, MMU_MAP_READ_WRITE);
+      continue;
+    }
+    // Shared, read-only or partial page
+    uint8_t *page = diy_malloc(PAGE_SIZE);
+    memcpy_(page, (const uint8_t*)buf + i*PAGE_SIZE, i < whole ? PAGE_SIZE : len - i*PAGE_SIZE);
+    page_ref_inc((uint64_t)page);
+    msg->frames[i] = (uint64_t)page;
+    stat.pages_copied++;
+  }
+#endif
+  return msg;
+}
+
+/** Give the payload to the receiver and free the message.
+ * Whole pages are mapped at buf if possible, replacing pages previously there.
+ * @return bytes received, payload beyond len is dropped
+*/
+static size_t msg_unpack(thread_t *thd, message *msg, void *buf, size_t len){
+  const size_t n = msg->len < len ? msg->len : len;
+  if(msg->page_cnt == 0){
+    memcpy_(buf, msg->data, n);
+    stat.pages_copied += PAGE_CEIL(n) / PAGE_SIZE;
+    if(msg->data != NULL)
+      diy_free(msg->data);
+  }
+  else{
+#ifdef VIRTUAL_MEM
+    const int can_map = msg_can_move(thd, buf, n);
+#endif
+    for(size_t i=0; i<msg->page_cnt; i++){
+      const size_t offset = i*PAGE_SIZE;
+#ifdef VIRTUAL_MEM
+      if(can_map && offset + PAGE_SIZE <= n){
+        map_pages_counted((uint64_t*)thd->ttbr0_el1, (uint64_t)buf + offset, msg->frames[i], 1, MMU_MAP_READ_WRITE);
+        stat.pages_moved++;
+      }
+      else
+#endif
+      if(offset < n){
+        memcpy_((uint8_t*)buf + offset, (const uint8_t*)msg->frames[i], (n - offset) < PAGE_SIZE ? (n - offset) : PAGE_SIZE);
+        stat.pages_copied++;
+      }
+      msg_frame_put(msg->frames[i]);
+    }
+    diy_free(msg->frames);
+  }
+  diy_free(msg);
+  return n;
+}
+
+/** Send len bytes of buf to process pid, blocks while the queue of pid is full.
+ * @return len, -1 if pid is not found or len is too large
+*/
+long msg_send(int pid, const void *buf, size_t len){
+  thread_t *thd = thread_get_current();
+  thread_t *to = NULL;
+  if(len > MSG_MAX_SIZE){
+    uart_printf("Error, msg_send(), len=%lu larger than %lu, pid=%d\r\n", len, (size_t)MSG_MAX_SIZE, thd->pid);
+    return -1;
+  }
+  while((to = thread_find(pid)) != NULL && to->mq != NULL && to->mq->cnt >= MSG_QUEUE_MAX)
+    thread_wait(&to->mq->wr_wait);
+  if(to == NULL){
+    uart_printf("Error, msg_send(), pid=%d not found, pid=%d\r\n", pid, thd->pid);
+    return -1;
+  }
+
+  msg_queue *mq = msg_queue_of(to);
+  message *msg = msg_pack(thd, buf, len);
+  if(mq->tail == NULL) mq->head = msg;
+  else                 mq->tail->next = msg;
+  mq->tail = msg;
+  mq->cnt++;
+  thread_wake_all(&mq->rd_wait);
+  return len;
+}
+
+/** Receive the oldest message sent to current process, blocks while there is none.
+ * @param from: set to pid of sender if not NULL
+ * @return bytes received
+*/
+long msg_recv(void *buf, size_t len, int *from){
+  thread_t *thd = thread_get_current();
+  msg_queue *mq = msg_queue_of(thd);
+  while(mq->head == NULL)
+    thread_wait(&mq->rd_wait);
+
+  message *msg = mq->head;
+  mq->head = msg->next;
+  if(mq->head == NULL)
+    mq->tail = NULL;
+  mq->cnt--;
+  thread_wake_all(&mq->wr_wait);
+  if(from != NULL)
+    *from = msg->from;
+  return msg_unpack(thd, msg, buf, len);
+}
+
+// Wake senders blocked on the queue of an exiting thread, they see the receiver gone
+void msg_queue_close(msg_queue *mq){
+  if(mq != NULL)
+    thread_wake_all(&mq->wr_wait);
+}
+
+// Free the queue and messages never received
+void msg_queue_release(msg_queue *mq){
+  if(mq == NULL) return;
+  message *msg = mq->head;
+  message *next = NULL;
+  while(msg != NULL){
+    next = msg->next;
+    for(size_t i=0; i<msg->page_cnt; i++)
+      msg_frame_put(msg->frames[i]);
+    if(msg->frames != NULL) diy_free(msg->frames);
+    if(msg->data != NULL)   diy_free(msg->data);
+    diy_free(msg);
+    msg = next;
+  }
+  diy_free(mq);
+}
+
+const msg_stat *msg_get_stat(){
+  return &stat;
+}
+
+// User side -----------------------------------------
+
+#define MSG_BENCH_COUNT 64
+#define MSG_BENCH_SIZE  (PAGE_SIZE * 16)
+
+/** Forked sender passes page aligned 64 kB messages to its parent.
+ * Buffers come from diy_malloc(), so pages are moved only if the shell has a page table of its own, which neither
+ * lab6 nor lab8 gives it. Otherwise every message is copied, and the output says so.
+*/
+void msg_bench(){
+  const int mom = sysc_getpid();
+  const msg_stat before = stat;
+  int bad = 0;
+
+  const uint64_t t0 = read_sysreg(cntpct_el0);
+  if(sysc_fork() == 0){
+    // Kid, sender
+    uint32_t *tx = diy_malloc(MSG_BENCH_SIZE);
+    for(uint32_t i=0; i<MSG_BENCH_COUNT; i++){
+      tx[0] = i;
+      tx[MSG_BENCH_SIZE / sizeof(uint32_t) - 1] = i;
+      sysc_msg_send(mom, tx, MSG_BENCH_SIZE);
+    }
+    diy_free(tx);
+    sysc_exit(0);
+  }
+
+  // Mom, receiver
+  uint32_t *rx = diy_malloc(MSG_BENCH_SIZE);
+  int from = 0;
+  for(uint32_t i=0; i<MSG_BENCH_COUNT; i++){
+    if(sysc_msg_recv(rx, MSG_BENCH_SIZE, &from) != MSG_BENCH_SIZE || rx[0] != i || rx[MSG_BENCH_SIZE / sizeof(uint32_t) - 1] != i)
+      bad++;
+  }
+  const uint64_t t1 = read_sysreg(cntpct_el0);
+  diy_free(rx);
+
+  const uint64_t us = (t1 - t0) * 1000000 / read_sysreg(cntfrq_el0);
+  const uint64_t bytes = (uint64_t)MSG_BENCH_COUNT * MSG_BENCH_SIZE;
+  uart_printf("passed %d messages of %d bytes in %lu us, %lu KB/s, %d corrupted\r\n",
+    MSG_BENCH_COUNT, MSG_BENCH_SIZE, us, us == 0 ? 0 : (bytes * 1000000 / 1024) / us, bad);
+  const uint64_t moved = stat.pages_moved - before.pages_moved;
+  uart_printf("pages moved=%lu, pages copied=%lu\r\n", moved, stat.pages_copied - before.pages_copied);
+  if(moved == 0)
+    uart_printf("no page was moved, buffers are not in a page table of the process, so this measures copying\r\n");
+}
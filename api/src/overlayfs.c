@@ -0,0 +1,222 @@
+#include "overlayfs.h"
+#include "diy_string.h"
+#include "diy_malloc.h"
+#include "uart.h"
+
+filesystem overlayfs = {.name="overlay", .setup_mount=overlay_setup_mount};
+file_operations overlay_fops = {.write=overlay_write, .read=overlay_read, .open=overlay_open, .close=overlay_close, .lseek64=overlay_lseek64};
+vnode_operations overlay_vops = {.lookup=overlay_lookup, .create=overlay_create, .mkdir=overlay_mkdir, .populate=overlay_populate, .unlink=overlay_unlink};
+
+static overlay_stat stat;
+
+// Root of the mount is root of the archive, nothing else is instantiated till it is looked up
+int overlay_setup_mount(struct filesystem *fs, mount *mount){
+  if(mount == NULL){
+    uart_printf("Error, overlay_setup_mount(), NULL pointer.");
+    return 1;
+  }
+  overlay_node *root = (overlay_node*)tmpfs_node_alloc_size("", sizeof(overlay_node));
+  if(root == NULL)
+    return 1;
+  root->has_lower = 1;
+  mount->root = &root->entry.node;
+  mount->fs = fs;
+  mount->root->comp->type = COMP_DIR;
+  mount->root->f_ops = &overlay_fops;
+  mount->root->v_ops = &overlay_vops;
+  return 0;
+}
+
+const overlay_stat *overlay_get_stat(){
+  return &stat;
+}
+
+// Create the vnode of file, an entry of the archive, under dir_node. A file refers to data in the archive
+static vnode *overlay_instantiate(vnode *dir_node, const cpio_file *file, const char *component_name){
+  overlay_node *node = (overlay_node*)tmpfs_node_alloc_size(component_name, sizeof(overlay_node));
+  if(node == NULL)
+    return NULL;
+  node->lower = file;
+  node->has_lower = 1;
+  vnode *vn = &node->entry.node;
+  vn->f_ops = &overlay_fops;
+  vn->v_ops = &overlay_vops;
+  if(file->is_dir)
+    vn->comp->type = COMP_DIR;
+  else{
+    vn->comp->type = COMP_FILE;
+    vn->comp->data = (char*)file->data_ptr;
+    vn->comp->len = file->file_size;
+  }
+  tmpfs_link(dir_node, vn);
+  return vn;
+}
+
+// Return 1 if name of lower was removed from dir
+static int overlay_whiteout_find(const overlay_node *dir, const char *name){
+  for(size_t i=0; i<dir->whiteout_cnt; i++){
+    if(strcmp_(dir->whiteouts[i], name) == 0)
+      return 1;
+  }
+  return 0;
+}
+
+static void overlay_whiteout_add(overlay_node *dir, const char *name){
+  if(overlay_whiteout_find(dir, name))
+    return;
+  if(dir->whiteout_cnt >= dir->whiteout_cap){
+    const size_t cap = dir->whiteout_cap == 0 ? OVERLAY_MIN_WHITEOUT : dir->whiteout_cap * 2;
+    char (*whiteouts)[TMPFS_MAX_COMPONENT_NAME] = diy_malloc(cap * TMPFS_MAX_COMPONENT_NAME);
+    if(dir->whiteouts != NULL){
+      memcpy_(whiteouts, dir->whiteouts, dir->whiteout_cnt * TMPFS_MAX_COMPONENT_NAME);
+      diy_free(dir->whiteouts);
+    }
+    dir->whiteouts = whiteouts;
+    dir->whiteout_cap = cap;
+  }
+  strcpy_(dir->whiteouts[dir->whiteout_cnt++], name);
+  stat.whiteouts++;
+}
+
+/** Move data of a file from the archive into tmpfs, only this file is copied.
+ * @return 0 on success
+*/
+static int overlay_copy_up(overlay_node *node){
+  vnode *vn = &node->entry.node;
+  const char *data = vn->comp->data;
+  const size_t len = vn->comp->len;
+
+  // Empty tmpfs file, inline till it grows, see tmpfs_write()
+  memset_(vn->comp->inline_data, 0, VFS_INLINE_DATA);
+  vn->comp->data_paged = 0;
+  vn->comp->len = 0;
+  node->has_lower = 0;
+
+  file upper = {.vnode = vn, .f_pos = 0, .f_ops = &overlay_fops, .flags = 0};
+  if(len > 0 && tmpfs_write(&upper, data, len) != (int)len){
+    uart_printf("Error, overlay_copy_up(), failed to copy %lu bytes of %s\r\n", len, vn->comp->comp_name);
+    return 1;
+  }
+  stat.copy_ups++;
+  stat.bytes_copied += len;
+  return 0;
+}
+
+// fops
+int overlay_write(file *file, const void *buf, size_t len){
+  if(file == NULL || file->vnode == NULL){
+    uart_printf("Error, overlay_write(), null file, file=0x%lX\r\n", (uint64_t)file);
+    return 1;
+  }
+  overlay_node *node = (overlay_node*)file->vnode;
+  if(node->has_lower && node->entry.node.comp->type == COMP_FILE && overlay_copy_up(node) != 0)
+    return 0;
+  return tmpfs_write(file, buf, len);
+}
+// Untouched files are read in place from the archive
+int overlay_read(file *file, void *buf, size_t len){
+  if(file == NULL || file->vnode == NULL){
+    uart_printf("Error, overlay_read(), null file, file=0x%lX\r\n", (uint64_t)file);
+    return 1;
+  }
+  if(((overlay_node*)file->vnode)->has_lower)
+    return initramfs_read(file, buf, len);
+  return tmpfs_read(file, buf, len);
+}
+int overlay_open(vnode* file_node, file** target){
+  return tmpfs_open(file_node, target);
+}
+int overlay_close(file *file){
+  return tmpfs_close(file);
+}
+long overlay_lseek64(file *file, long offset, int whence){
+  return tmpfs_lseek64(file, offset, whence);
+}
+
+// vops
+int overlay_mkdir(vnode *dir_node, vnode **target, const char *component_name){
+  if(overlay_create(dir_node, target, component_name) != 0){
+    uart_printf("Error, overlay_mkdir(), failed creating %s under %s\r\n", component_name, dir_node->comp->comp_name);
+    return 1;
+  }
+  (*target)->comp->type = COMP_DIR;
+  return 0;
+}
+// The new entry is only in upper, a directory of it hides what the archive had under the same name
+int overlay_create(vnode *dir_node, vnode **target, const char *component_name){
+  if(dir_node->comp->type != COMP_DIR){
+    uart_printf("Error, overlay_create(), failed creating %s, dir_node_name=%s, type=%d, not folder\r\n",
+      component_name, dir_node->comp->comp_name, dir_node->comp->type);
+    return 2;
+  }
+  if(overlay_lookup(dir_node, target, component_name) == 0){
+    uart_printf("Warning, overlay_create(), %s already exist under %s\r\n", component_name, dir_node->comp->comp_name);
+    return 1;
+  }
+
+  overlay_node *node = (overlay_node*)tmpfs_node_alloc_size(component_name, sizeof(overlay_node));
+  if(node == NULL)
+    return 3;
+  node->populated = 1;
+  *target = &node->entry.node;
+  (*target)->f_ops = &overlay_fops;
+  (*target)->v_ops = &overlay_vops;
+  tmpfs_link(dir_node, *target);
+  return 0;
+}
+int overlay_lookup(vnode *dir_node, vnode **target, const char *component_name){
+  if(tmpfs_lookup(dir_node, target, component_name) == 0)
+    return 0;   // in upper, or instantiated before
+  const overlay_node *dir = (overlay_node*)dir_node;
+  if(!dir->has_lower || dir->populated || overlay_whiteout_find(dir, component_name))
+    return 1;
+
+  const cpio_file *file = cpio_index_child(cpio_get_index(), dir->lower, component_name);
+  if(file == NULL)
+    return 1;   // not in lower either
+  *target = overlay_instantiate(dir_node, file, component_name);
+  return *target == NULL;
+}
+
+// Create vnodes of entries of lower directly under dir_node, except those removed, for listing
+int overlay_populate(vnode *dir_node){
+  overlay_node *dir = (overlay_node*)dir_node;
+  if(dir->populated || !dir->has_lower)
+    return 0;
+
+  const cpio_index *idx = cpio_get_index();
+  char name[TMPFS_MAX_COMPONENT_NAME];
+  vnode *node = NULL;
+  for(size_t i = cpio_index_next_child(idx, dir->lower, 0, name); i < idx->cnt; i = cpio_index_next_child(idx, dir->lower, i + 1, name)){
+    if(tmpfs_lookup(dir_node, &node, name) != 0 && !overlay_whiteout_find(dir, name))
+      overlay_instantiate(dir_node, &idx->files[i], name);
+  }
+  dir->populated = 1;
+  return 0;
+}
+
+/** Remove an entry, a directory has to be empty in both layers.
+ * Removing an entry of the archive leaves a whiteout in dir_node, the archive itself is never modified.
+ * @return 0 on success, 1 if not found, 2 if it cannot be removed
+*/
+int overlay_unlink(vnode *dir_node, const char *component_name){
+  vnode *target = NULL;
+  if(overlay_lookup(dir_node, &target, component_name) != 0)
+    return 1;
+  overlay_node *node = (overlay_node*)target;
+  const int is_overlay_dir = target->v_ops == &overlay_vops && target->comp->type == COMP_DIR;
+  if(is_overlay_dir)
+    overlay_populate(target);   // so entries only in lower count
+
+  const int ret = tmpfs_unlink(dir_node, component_name);  // refuses a mount point, which is not an overlay_node
+  if(ret != 0)
+    return ret;
+  if(node->lower != NULL)
+    overlay_whiteout_add((overlay_node*)dir_node, component_name);
+  if(is_overlay_dir && node->whiteouts != NULL){
+    diy_free(node->whiteouts);
+    node->whiteouts = NULL;
+    node->whiteout_cnt = node->whiteout_cap = 0;
+  }
+  return 0;
+}
@@ -0,0 +1,187 @@
+#include "pipe.h"
+#include "system_call.h"
+#include "diy_malloc.h"
+#include "diy_string.h"
+#include "sys_reg.h"
+#include "uart.h"
+#include "poll.h"
+
+static int pipe_read(file *file, void *buf, size_t len);
+static int pipe_write(file *file, const void *buf, size_t len);
+static int pipe_open(vnode *file_node, file **target);
+static int pipe_close(file *file);
+static int pipe_poll(file *file);
+
+file_operations pipe_fops = {.write=pipe_write, .read=pipe_read, .open=pipe_open, .close=pipe_close, .poll=pipe_poll};
+
+static inline pipe_t *pipe_of(file *file){
+  return (pipe_t*)file->vnode->comp->data;
+}
+
+/** Create a pipe, bytes written to wr can be read from rd.
+ * @return 0 on success
+*/
+int pipe_create(file **rd, file **wr){
+  pipe_t *p = diy_malloc(sizeof(pipe_t));
+  memset_(p, 0, sizeof(pipe_t));
+  p->buf = diy_malloc(PIPE_BUF_SIZE);
+  p->comp.comp_name = "pipe";
+  p->comp.type = COMP_FILE;
+  p->comp.data = (char*)p;
+  p->rd_node.comp = &p->comp;
+  p->rd_node.f_ops = &pipe_fops;
+  p->wr_node.comp = &p->comp;
+  p->wr_node.f_ops = &pipe_fops;
+
+  pipe_open(&p->rd_node, rd);
+  pipe_open(&p->wr_node, wr);
+  return 0;
+}
+
+/** Read at least 1 byte, blocks while the ring is empty and the write end is still opened.
+ * @return size read, 0 on end of file, i.e. all write ends closed, -1 on reading from the write end
+*/
+static int pipe_read(file *file, void *buf, size_t len){
+  pipe_t *p = pipe_of(file);
+  if(file->vnode != &p->rd_node){
+    uart_printf("Error, pipe_read(), reading from the write end\r\n");
+    return -1;
+  }
+  if(len == 0)
+    return 0;
+
+  uint32_t head = p->head;
+  uint32_t tail = __atomic_load_n(&p->tail, __ATOMIC_ACQUIRE);
+  while(tail == head){
+    if(p->writers == 0)
+      return 0;
+    thread_wait(&p->rd_wait);
+    tail = __atomic_load_n(&p->tail, __ATOMIC_ACQUIRE);
+  }
+
+  // Copy in at most 2 pieces, before and after wrapping
+  size_t n = (tail - head) < len ? (tail - head) : len;
+  const size_t offset = head & (PIPE_BUF_SIZE - 1);
+  const size_t first = n < (PIPE_BUF_SIZE - offset) ? n : (PIPE_BUF_SIZE - offset);
+  memcpy_(buf, p->buf + offset, first);
+  memcpy_((uint8_t*)buf + first, p->buf, n - first);
+  __atomic_store_n(&p->head, head + n, __ATOMIC_RELEASE);
+
+  thread_wake_all(&p->wr_wait);
+  poll_wake();
+  return n;
+}
+
+/** Write all len bytes, blocks while the ring is full.
+ * @return len, or -1 if the read end is closed or writing to the read end
+*/
+static int pipe_write(file *file, const void *buf, size_t len){
+  pipe_t *p = pipe_of(file);
+  if(file->vnode != &p->wr_node){
+    uart_printf("Error, pipe_write(), writing to the read end\r\n");
+    return -1;
+  }
+
+  const uint8_t *src = buf;
+  size_t left = len;
+  while(left > 0){
+    if(p->readers == 0)
+      return -1;  // broken pipe
+    const uint32_t tail = p->tail;
+    const uint32_t head = __atomic_load_n(&p->head, __ATOMIC_ACQUIRE);
+    const size_t space = PIPE_BUF_SIZE - (tail - head);
+    if(space == 0){
+      thread_wait(&p->wr_wait);
+      continue;
+    }
+    const size_t n = left < space ? left : space;
+    const size_t offset = tail & (PIPE_BUF_SIZE - 1);
+    const size_t first = n < (PIPE_BUF_SIZE - offset) ? n : (PIPE_BUF_SIZE - offset);
+    memcpy_(p->buf + offset, src, first);
+    memcpy_(p->buf, src + first, n - first);
+    __atomic_store_n(&p->tail, tail + n, __ATOMIC_RELEASE);
+    src += n;
+    left -= n;
+    thread_wake_all(&p->rd_wait);
+    poll_wake();
+  }
+  return len;
+}
+
+// Open another handle of an end, see vfs_dup()
+static int pipe_open(vnode *file_node, file **target){
+  pipe_t *p = (pipe_t*)file_node->comp->data;
+  *target = diy_malloc(sizeof(file));
+  (*target)->vnode = file_node;
+  (*target)->f_ops = &pipe_fops;
+  (*target)->f_pos = 0;
+  (*target)->flags = 0;
+  if(file_node == &p->rd_node) p->readers++;
+  else                         p->writers++;
+  return 0;
+}
+
+// Close a handle of an end, the pipe is freed when both ends are fully closed
+static int pipe_close(file *file){
+  pipe_t *p = pipe_of(file);
+  if(file->vnode == &p->rd_node){
+    p->readers--;
+    thread_wake_all(&p->wr_wait); // let writers see broken pipe
+  }
+  else{
+    p->writers--;
+    thread_wake_all(&p->rd_wait); // let readers see end of file
+  }
+  poll_wake();
+  diy_free(file);
+
+  if(p->readers == 0 && p->writers == 0){
+    diy_free(p->buf);
+    diy_free(p);
+  }
+  return 0;
+}
+
+// Read end is readable with bytes in ring, write end is writable with space in ring
+static int pipe_poll(file *file){
+  pipe_t *p = pipe_of(file);
+  const uint32_t used = __atomic_load_n(&p->tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&p->head, __ATOMIC_ACQUIRE);
+  if(file->vnode == &p->rd_node)
+    return (used > 0 ? POLLIN : 0) | (p->writers == 0 ? POLLHUP : 0);
+  return (used < PIPE_BUF_SIZE ? POLLOUT : 0) | (p->readers == 0 ? POLLERR : 0);
+}
+
+// Throughput of a pipe between a forked writer and its parent as reader
+void pipe_bench(){
+  const size_t total = 1 << 20;  // 1 MB
+  static const uint8_t chunk[512];
+  uint8_t buf[512];
+  int fds[2];
+  size_t received = 0;
+  long n = 0;
+
+  if(sysc_pipe(fds) != 0){
+    uart_printf("Error, pipe_bench(), sysc_pipe() failed\r\n");
+    return;
+  }
+
+  const uint64_t t0 = read_sysreg(cntpct_el0);
+  if(sysc_fork() == 0){
+    // Kid, writer
+    sysc_close(fds[0]);
+    for(size_t sent=0; sent<total; sent+=sizeof(chunk))
+      sysc_write(fds[1], chunk, sizeof(chunk));
+    sysc_close(fds[1]);
+    sysc_exit(0);
+  }
+
+  // Mom, reader
+  sysc_close(fds[1]);
+  while((n = (long)sysc_read(fds[0], buf, sizeof(buf))) > 0)
+    received += n;
+  sysc_close(fds[0]);
+  const uint64_t t1 = read_sysreg(cntpct_el0);
+
+  const uint64_t us = (t1 - t0) * 1000000 / read_sysreg(cntfrq_el0);
+  uart_printf("piped %lu bytes in %lu us, %lu KB/s\r\n", received, us, us == 0 ? 0 : (received * 1000000 / 1024) / us);
+}
@@ -0,0 +1,50 @@
+#include "poll.h"
+#include "thread.h"
+#include "sys_reg.h"
+#include "uart.h"
+
+static wait_queue pollers;
+static uint64_t wake_at = UINT64_MAX;  // earliest timeout of pollers, in ticks of cntpct_el0
+
+// Wake every poller to re-check its fds, called when a source may have become ready
+void poll_wake(){
+  if(pollers.head == NULL)
+    return;
+  wake_at = UINT64_MAX;
+  thread_wake_all(&pollers);
+}
+
+// Wake pollers if the earliest timeout expires, called in timer interrupt
+void poll_tick(){
+  if(pollers.head != NULL && read_sysreg(cntpct_el0) >= wake_at)
+    poll_wake();
+}
+
+/** Wait until any of fds is ready for its events, or timeout.
+ * Timeout is checked on timer interrupts, so it is rounded up to the time slice.
+ * @param timeout_ms: 0 to return at once, negative to wait without timeout
+ * @return count of fds with non-zero revents, 0 on timeout
+*/
+int poll_fds(pollfd *fds, int nfds, int timeout_ms){
+  thread_t *thd = thread_get_current();
+  const uint64_t deadline = timeout_ms < 0 ? UINT64_MAX :
+    read_sysreg(cntpct_el0) + (uint64_t)timeout_ms * read_sysreg(cntfrq_el0) / 1000;
+
+  while(1){
+    int ready = 0;
+    for(int i=0; i<nfds; i++){
+      const int fd = fds[i].fd;
+      file *fh = (fd >= 0 && fd < VFS_PROCESS_MAX_OPEN_FILE) ? thd->fd_table[fd] : NULL;
+      if(fh == NULL) fds[i].revents = POLLNVAL;
+      else           fds[i].revents = vfs_poll(fh) & (fds[i].events | POLLERR | POLLHUP);
+      if(fds[i].revents != 0)
+        ready++;
+    }
+    if(ready > 0 || timeout_ms == 0 || read_sysreg(cntpct_el0) >= deadline)
+      return ready;
+
+    if(deadline < wake_at)
+      wake_at = deadline;
+    thread_wait(&pollers);
+  }
+}
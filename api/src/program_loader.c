@@ -0,0 +1,352 @@
+#include "program_loader.h"
+#include "virtual_file_system.h"
+#include "diy_malloc.h"
+#include "cpio.h"
+#include "diy_string.h"
+#include "sys_reg.h"
+#include "mmu.h"
+#include "uart.h"
+
+static program_image *image_cache_head = NULL;
+
+static program_image *image_cache_find(vnode *node){
+  program_image *img = image_cache_head;
+  while(img != NULL){
+    if(img->node == node)
+      return img;
+    img = img->next;
+  }
+  return NULL;
+}
+
+/** Execute in place: use pages of the archive as the image if the file data starts on a page boundary,
+ * e.g. in an archive laid out by tools/cpio_page_align.py.
+ * The cache holds one reference on each page, so unmapping never frees them and a write to a copy-on-write mapping always copies.
+ * The last page is copied if the file ends inside it, since the rest of it is the next entry of the archive, not zeros.
+ * @return 1 if the image is in place, 0 if it has to be copied
+*/
+static int image_in_place(program_image *img, const vnode *node){
+  const uint64_t data = (uint64_t)node->comp->data;
+  const int full_pages = img->size / PAGE_SIZE;
+  if(data % PAGE_SIZE != 0)
+    return 0;
+  for(int i=0; i<full_pages; i++){
+    if(page_ref_get(data + i*PAGE_SIZE) < 0)
+      return 0;   // not a frame the reference count covers, a copy-on-write fault would take it over
+  }
+  if(full_pages < img->page_cnt){
+    img->tail = diy_malloc(PAGE_SIZE);
+    memset_(img->tail, 0, PAGE_SIZE);
+    memcpy_(img->tail, (const uint8_t*)data + full_pages*PAGE_SIZE, img->size - full_pages*PAGE_SIZE);
+  }
+  img->addr = (uint8_t*)data;
+  img->in_place = 1;
+  return 1;
+}
+
+// Kernel address of page i of img
+static uint64_t image_page(const program_image *img, int i){
+  if(i == img->page_cnt - 1 && img->tail != NULL)
+    return (uint64_t)img->tail;
+  return (uint64_t)img->addr + i*PAGE_SIZE;
+}
+
+/** Get the shared image of pathname, load it if it's not in the cache yet.
+ * Only files on initramfs are cached, since they never change after mount.
+ * The cache holds one reference on each page of the image, so the pages survive every process that maps them.
+ * @return the cached image, NULL if pathname is not found or not on a read-only file system
+*/
+program_image *program_image_get(const char *pathname){
+  vnode *node = NULL;
+  if(vfs_lookup((char*)pathname, &node) != 0 || node->comp->type != COMP_FILE)
+    return NULL;
+  if(node->f_ops != &initramfs_fops)
+    return NULL;
+
+  program_image *img = image_cache_find(node);
+  if(img != NULL){
+    img->exec_cnt++;
+    return img;
+  }
+
+  img = diy_malloc(sizeof(program_image));
+  img->node = node;
+  img->size = node->comp->len;
+  img->page_cnt = img->size / PAGE_SIZE + (img->size % PAGE_SIZE != 0);
+  img->page_cnt = img->page_cnt == 0 ? 1 : img->page_cnt;
+  img->in_place = 0;
+  img->tail = NULL;
+
+  // Load the whole file to page aligned space, unless it is page aligned in the archive already
+  if(!image_in_place(img, node)){
+    file *fh = NULL;
+    if(node->f_ops->open(node, &fh) != 0){
+      diy_free(img);
+      return NULL;
+    }
+    img->addr = diy_malloc(img->page_cnt * PAGE_SIZE);  // request >= PAGE_SIZE is served by whole pages
+    fh->f_ops->read(fh, img->addr, img->size);
+    fh->f_ops->close(fh);
+    memset_(img->addr + img->size, 0, img->page_cnt * PAGE_SIZE - img->size);  // pages are not cleared by diy_malloc()
+  }
+  for(int i=0; i<img->page_cnt; i++)
+    page_ref_inc(image_page(img, i));
+
+  img->exec_cnt = 1;
+  img->next = image_cache_head;
+  image_cache_head = img;
+  return img;
+}
+
+void program_image_dump(){
+  program_image *img = image_cache_head;
+  while(img != NULL){
+    uart_printf("image %s, addr=0x%p, size=%lu, pages=%d, in place=%d, exec_cnt=%d, ref of 1st page=%d\r\n",
+      img->node->comp->comp_name, img->addr, img->size, img->page_cnt, img->in_place, img->exec_cnt, page_ref_get((uint64_t)img->addr));
+    img = img->next;
+  }
+}
+
+/** Get the bytes of pathname to load from, without copying if they are already in memory.
+ * @param img: set to the shared image if the bytes are from the image cache, else NULL
+ * @param temp: set to a temporary copy the caller should diy_free(), else NULL
+ * @return address of the file content, NULL if pathname is not a file
+*/
+static const uint8_t *program_source(const char *pathname, size_t *size, program_image **img, uint8_t **temp){
+  vnode *node = NULL;
+  *img = NULL;
+  *temp = NULL;
+  if(vfs_lookup((char*)pathname, &node) != 0 || node->comp->type != COMP_FILE || node->comp->len == 0)
+    return NULL;
+  *size = node->comp->len;
+
+#ifdef VIRTUAL_MEM
+  // Page aligned, pages can be mapped to the process directly
+  *img = program_image_get(pathname);
+  if(*img != NULL)
+    return (*img)->addr;
+#else
+  // initramfs keeps file content in memory
+  if(node->f_ops == &initramfs_fops)
+    return (uint8_t*)node->comp->data;
+#endif
+
+  file *fh = NULL;
+  if(vfs_open((char*)pathname, 0, &fh) != 0)
+    return NULL;
+  *temp = diy_malloc(*size);
+  fh->f_ops->read(fh, *temp, *size);
+  fh->f_ops->close(fh);
+  return *temp;
+}
+
+#ifdef VIRTUAL_MEM
+// Map cnt pages of img from its page first at va
+static void map_image(uint64_t *pgd, uint64_t va, const program_image *img, int first, int cnt, int flags){
+  for(int i=0; i<cnt; i++)
+    map_pages_counted(pgd, va + i*PAGE_SIZE, image_page(img, first + i), 1, flags);
+}
+
+/** Map [va, va+len) of pgd to private pages, copying len bytes from src. Bytes around are zeroed.
+ * @param src: NULL to map zeroed pages
+*/
+static void map_private_copy(uint64_t *pgd, uint64_t va, const uint8_t *src, size_t len, int flags){
+  for(uint64_t page_va=PAGE_FLOOR(va); page_va<PAGE_CEIL(va + len); page_va+=PAGE_SIZE){
+    uint8_t *page = diy_malloc(PAGE_SIZE);
+    memset_(page, 0, PAGE_SIZE);
+    if(src != NULL){
+      uint64_t from = page_va > va ? page_va : va;
+      uint64_t to = (page_va + PAGE_SIZE) < (va + len) ? (page_va + PAGE_SIZE) : (va + len);
+      memcpy_(page + (from - page_va), src + (from - va), to - from);
+    }
+    map_pages_counted(pgd, page_va, (uint64_t)page, 1, flags);
+  }
+}
+#endif
+
+/** Load PT_LOAD segments of an ELF64 executable.
+ * With virtual memory, each segment is mapped at its p_vaddr: read-only segments are mapped from the shared image,
+ * writable ones are copied to private pages, and the .bss beyond the last file page is zero-filled on first access.
+ * Without virtual memory, segments are copied to one space keeping their relative layout.
+ * @return 0 on success, -1 if the headers are malformed
+*/
+static int elf_load(const uint8_t *src, size_t size, const program_image *img, thread_t *thd, uint64_t *entry, void **space){
+  elf64_header_t eh;
+  elf64_phdr_t ph;
+  memcpy_(&eh, src, sizeof(eh));  // src of initramfs is only 4-byte aligned
+  if(eh.e_phentsize != sizeof(elf64_phdr_t) || eh.e_phoff + (uint64_t)eh.e_phnum*sizeof(elf64_phdr_t) > size){
+    uart_printf("Error, elf_load(), malformed program header table, e_phoff=%lu, e_phnum=%u\r\n", eh.e_phoff, eh.e_phnum);
+    return -1;
+  }
+
+  uint64_t lo = (uint64_t)-1, hi = 0;
+  for(int i=0; i<eh.e_phnum; i++){
+    memcpy_(&ph, src + eh.e_phoff + i*sizeof(ph), sizeof(ph));
+    if(ph.p_type != ELF_PT_LOAD) continue;
+    if(ph.p_offset + ph.p_filesz > size || ph.p_filesz > ph.p_memsz){
+      uart_printf("Error, elf_load(), malformed segment %d, p_offset=%lu, p_filesz=%lu, p_memsz=%lu\r\n", 
+        i, ph.p_offset, ph.p_filesz, ph.p_memsz);
+      return -1;
+    }
+    if(PAGE_FLOOR(ph.p_vaddr) < lo)            lo = PAGE_FLOOR(ph.p_vaddr);
+    if(PAGE_CEIL(ph.p_vaddr + ph.p_memsz) > hi) hi = PAGE_CEIL(ph.p_vaddr + ph.p_memsz);
+  }
+  if(hi <= lo){
+    uart_printf("Error, elf_load(), no loadable segment\r\n");
+    return -1;
+  }
+
+#ifdef VIRTUAL_MEM
+  uint64_t *pgd = (uint64_t*)thd->ttbr0_el1;
+  thd->zero_area_cnt = 0;
+  for(int i=0; i<eh.e_phnum; i++){
+    memcpy_(&ph, src + eh.e_phoff + i*sizeof(ph), sizeof(ph));
+    if(ph.p_type != ELF_PT_LOAD) continue;
+    const uint64_t va = PAGE_FLOOR(ph.p_vaddr);
+    const uint64_t file_end = PAGE_CEIL(ph.p_vaddr + ph.p_filesz);
+    const uint64_t mem_end = PAGE_CEIL(ph.p_vaddr + ph.p_memsz);
+    const int flags = (ph.p_flags & ELF_PF_W) ? MMU_MAP_READ_WRITE : MMU_MAP_READ_ONLY;
+
+    if(flags == MMU_MAP_READ_ONLY && img != NULL && ph.p_memsz == ph.p_filesz && 
+       (ph.p_offset % PAGE_SIZE) == (ph.p_vaddr % PAGE_SIZE))
+      map_image(pgd, va, img, ph.p_offset / PAGE_SIZE, (file_end - va) / PAGE_SIZE, flags);
+    else
+      map_private_copy(pgd, ph.p_vaddr, src + ph.p_offset, ph.p_filesz, flags);
+
+    if(mem_end <= file_end) continue;
+    if(thd->zero_area_cnt < THREAD_MAX_ZERO_AREA){
+      // Pages left by previous program must not be seen as .bss
+      unmap_pages(pgd, file_end, (mem_end - file_end) / PAGE_SIZE);
+      thd->zero_areas[thd->zero_area_cnt].start = file_end;
+      thd->zero_areas[thd->zero_area_cnt].end = mem_end;
+      thd->zero_area_cnt++;
+    }
+    else
+      map_private_copy(pgd, file_end, NULL, mem_end - file_end, flags);
+  }
+  *entry = eh.e_entry;
+  *space = NULL;
+#else
+  // No MMU to fault on .bss, zero the whole space eagerly
+  uint8_t *base = diy_malloc(hi - lo);
+  memset_(base, 0, hi - lo);
+  for(int i=0; i<eh.e_phnum; i++){
+    memcpy_(&ph, src + eh.e_phoff + i*sizeof(ph), sizeof(ph));
+    if(ph.p_type != ELF_PT_LOAD) continue;
+    memcpy_(base + (ph.p_vaddr - lo), src + ph.p_offset, ph.p_filesz);
+  }
+  *entry = (uint64_t)base + (eh.e_entry - lo);
+  *space = base;
+#endif
+  return 0;
+}
+
+/** Load executable pathname for thd. ELF64 executables are loaded by segments, other files are loaded as flat image.
+ * With virtual memory, the program is mapped to thd->ttbr0_el1, and thd->zero_areas are set.
+ * @param entry: address to jump to
+ * @param space: kernel address of the space allocated for the program, for diy_free(),
+ *  NULL with virtual memory, since the pages are released with the page table
+ * @return 0 on success, -1 on failure
+*/
+int program_load(const char *pathname, thread_t *thd, uint64_t *entry, void **space){
+  size_t size = 0;
+  program_image *img = NULL;
+  uint8_t *temp = NULL;
+  const uint8_t *src = program_source(pathname, &size, &img, &temp);
+  if(src == NULL){
+    uart_printf("Error, program_load(), cannot access '%s': No such file\r\n", pathname);
+    return -1;
+  }
+
+  int ret = 0;
+  elf64_header_t eh;
+  memcpy_(&eh, src, size < sizeof(eh) ? size : sizeof(eh));
+  if(size >= sizeof(eh) && eh.e_magic == ELF_MAGIC && eh.e_class == ELF_CLASS_64 && 
+     eh.e_machine == ELF_MACHINE_AARCH64 && (eh.e_type == ELF_TYPE_EXEC || eh.e_type == ELF_TYPE_DYN)){
+    ret = elf_load(src, size, img, thd, entry, space);
+  }
+  else{
+    // Flat image, linked at DEFAULT_THREAD_VA_CODE_START
+#ifdef VIRTUAL_MEM
+    uint64_t *pgd = (uint64_t*)thd->ttbr0_el1;
+    const uint64_t file_end = DEFAULT_THREAD_VA_CODE_START + PAGE_CEIL(size);
+    const uint64_t space_end = DEFAULT_THREAD_VA_CODE_START + PROGRAM_FLAT_PAGES*PAGE_SIZE;
+    if(img != NULL)  // pages written by the process are copied on write
+      map_image(pgd, DEFAULT_THREAD_VA_CODE_START, img, 0, img->page_cnt, MMU_MAP_READ_ONLY | MMU_MAP_COPY_ON_WRITE);
+    else
+      map_private_copy(pgd, DEFAULT_THREAD_VA_CODE_START, src, size, MMU_MAP_READ_WRITE);
+
+    // The rest of the space is zero-filled on first access, pages left by previous program must not be seen
+    thd->zero_area_cnt = 0;
+    if(file_end < space_end){
+      unmap_pages(pgd, file_end, (space_end - file_end) / PAGE_SIZE);
+      thd->zero_areas[0].start = file_end;
+      thd->zero_areas[0].end = space_end;
+      thd->zero_area_cnt = 1;
+    }
+    *entry = DEFAULT_THREAD_VA_CODE_START;
+    *space = NULL;
+#else
+    // Same space as with virtual memory, the file then zeros for .bss, globals and heap
+    const size_t space_size = PAGE_CEIL(size) > PROGRAM_FLAT_PAGES*PAGE_SIZE ? PAGE_CEIL(size) : PROGRAM_FLAT_PAGES*PAGE_SIZE;
+    uint8_t *base = diy_malloc(space_size);  // page aligned for adrp
+    memcpy_(base, src, size);
+    memset_(base + size, 0, space_size - size);
+    *entry = (uint64_t)base;
+    *space = base;
+#endif
+  }
+
+  if(temp != NULL)
+    diy_free(temp);
+  return ret;
+}
+
+/** Compare load time of pathname by program_load() against the flat copy of 64 pages used before */
+void program_load_bench(const char *pathname){
+  const uint64_t cntfrq = read_sysreg(cntfrq_el0);
+  uint64_t t0, t1, t2, t3;
+  uint64_t entry = 0;
+  void *space = NULL;
+  file *fh = NULL;
+
+  // Flat copy
+  t0 = read_sysreg(cntpct_el0);
+  uint8_t *flat = diy_malloc(PAGE_SIZE*64);
+  if(vfs_open((char*)pathname, 0, &fh) != 0){
+    uart_printf("Error, program_load_bench(), cannot access '%s'\r\n", pathname);
+    diy_free(flat);
+    return;
+  }
+  fh->f_ops->read(fh, flat, PAGE_SIZE*64);
+  fh->f_ops->close(fh);
+  t1 = read_sysreg(cntpct_el0);
+  diy_free(flat);
+
+  // program_load() twice, the 2nd one may hit the image cache
+  thread_t *scratch = diy_malloc(sizeof(thread_t));
+  uint64_t ticks[2];
+  for(int i=0; i<2; i++){
+#ifdef VIRTUAL_MEM
+    scratch->ttbr0_el1 = KERNEL_VA_TO_PA(new_page_table());
+#endif
+    t2 = read_sysreg(cntpct_el0);
+    int ret = program_load(pathname, scratch, &entry, &space);
+    t3 = read_sysreg(cntpct_el0);
+    ticks[i] = t3 - t2;
+#ifdef VIRTUAL_MEM
+    free_page_table((uint64_t*)scratch->ttbr0_el1);
+#else
+    if(ret == 0) diy_free(space);
+#endif
+    if(ret != 0){
+      diy_free(scratch);
+      return;
+    }
+  }
+  diy_free(scratch);
+
+  uart_printf("flat copy of 64 pages: %lu ticks (%lu us)\r\n", t1 - t0, (t1 - t0)*1000000/cntfrq);
+  uart_printf("program_load() 1st   : %lu ticks (%lu us)\r\n", ticks[0], ticks[0]*1000000/cntfrq);
+  uart_printf("program_load() 2nd   : %lu ticks (%lu us)\r\n", ticks[1], ticks[1]*1000000/cntfrq);
+}
@@ -0,0 +1,200 @@
+#include "shm.h"
+#include "system_call.h"
+#include "diy_malloc.h"
+#include "diy_string.h"
+#include "sys_reg.h"
+#include "uart.h"
+
+static shm_segment segments[SHM_MAX_SEGMENT];
+
+// Kernel side ---------------------------------------
+
+/** Find the segment of key, or create a zeroed one of size bytes if there is none.
+ * @return id of the segment, -1 on failure
+*/
+int shm_get_or_create(int key, size_t size){
+  int idle = -1;
+  for(int i=0; i<SHM_MAX_SEGMENT; i++){
+    if(segments[i].used && !segments[i].unlinked && segments[i].key == key){
+      if(size > segments[i].pages * PAGE_SIZE){
+        uart_printf("Error, shm_get_or_create(), key=%d has %lu pages, smaller than size=%lu\r\n", key, segments[i].pages, size);
+        return -1;
+      }
+      return i;
+    }
+    if(!segments[i].used && idle < 0)
+      idle = i;
+  }
+  if(idle < 0){
+    uart_printf("Error, shm_get_or_create(), no more than %d segments\r\n", SHM_MAX_SEGMENT);
+    return -1;
+  }
+  if(size == 0){
+    uart_printf("Error, shm_get_or_create(), key=%d not found and size=0\r\n", key);
+    return -1;
+  }
+
+  shm_segment *seg = &segments[idle];
+  seg->pages = PAGE_CEIL(size) / PAGE_SIZE;
+  seg->addr = diy_malloc(seg->pages * PAGE_SIZE);  // page aligned, since size >= PAGE_SIZE
+  if(seg->addr == NULL){
+    uart_printf("Error, shm_get_or_create(), cannot allocate %lu pages\r\n", seg->pages);
+    return -1;
+  }
+  memset_(seg->addr, 0, seg->pages * PAGE_SIZE);
+  for(size_t i=0; i<seg->pages; i++)
+    page_ref_inc((uint64_t)seg->addr + i*PAGE_SIZE);
+  seg->key = key;
+  seg->unlinked = 0;
+  seg->used = 1;
+  return idle;
+}
+
+// Return segment of id, NULL if id is not a live segment
+shm_segment *shm_get(int id){
+  if(id < 0 || id >= SHM_MAX_SEGMENT || !segments[id].used)
+    return NULL;
+  return &segments[id];
+}
+
+/** Remove key from the namespace, the frames live until every mapping is gone.
+ * @return 0 on success, -1 if key is not found
+*/
+int shm_unlink(int key){
+  for(int i=0; i<SHM_MAX_SEGMENT; i++){
+    if(segments[i].used && !segments[i].unlinked && segments[i].key == key){
+      segments[i].unlinked = 1;
+      shm_reap();
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// Free unlinked segments no one maps anymore, called after mappings are dropped
+void shm_reap(){
+  for(int i=0; i<SHM_MAX_SEGMENT; i++){
+    shm_segment *seg = &segments[i];
+    if(!seg->used || !seg->unlinked || seg->kernel_maps > 0)
+      continue;
+    size_t p = 0;
+    while(p < seg->pages && page_ref_get((uint64_t)seg->addr + p*PAGE_SIZE) == 1)
+      p++;
+    if(p != seg->pages)
+      continue;
+    for(p=0; p<seg->pages; p++)
+      page_ref_dec((uint64_t)seg->addr + p*PAGE_SIZE);
+    diy_free(seg->addr);
+    memset_(seg, 0, sizeof(shm_segment));
+  }
+}
+
+/** Count a mapping of segment id at its kernel address.
+ * @param maps: SHM_MAX_SEGMENT elements, mappings of each segment held by the calling process
+ * @return 0 on success, -1 if id is not a live segment or the process maps it too many times
+*/
+int shm_kernel_map(int id, uint8_t *maps){
+  shm_segment *seg = shm_get(id);
+  if(seg == NULL || maps[id] == UINT8_MAX)
+    return -1;
+  maps[id]++;
+  seg->kernel_maps++;
+  return 0;
+}
+
+/** Drop a mapping counted by shm_kernel_map(), the segment is freed if it is unlinked and this was the last mapping.
+ * @return 0 on success, -1 if the process does not map segment id
+*/
+int shm_kernel_unmap(int id, uint8_t *maps){
+  shm_segment *seg = shm_get(id);
+  if(seg == NULL || maps[id] == 0)
+    return -1;
+  maps[id]--;
+  seg->kernel_maps--;
+  shm_reap();
+  return 0;
+}
+
+// Count mappings of maps once more, for a forked process which inherits maps from its parent
+void shm_kernel_dup(const uint8_t *maps){
+  for(int i=0; i<SHM_MAX_SEGMENT; i++)
+    segments[i].kernel_maps += maps[i];
+}
+
+// Drop every mapping in maps, for an exiting process
+void shm_kernel_release(uint8_t *maps){
+  for(int i=0; i<SHM_MAX_SEGMENT; i++){
+    segments[i].kernel_maps -= maps[i];
+    maps[i] = 0;
+  }
+  shm_reap();
+}
+
+// User side -----------------------------------------
+
+#define SHM_BENCH_KEY     0x5348
+#define SHM_BENCH_FRAMES  16
+#define SHM_BENCH_SLOTS   2                   // double buffering
+#define SHM_BENCH_FRAME   (1024 * 768 * 4)    // bytes of a frame of the framebuffer set in mbox.c
+
+/** Producer fills frames in the segment, consumer checks them in place.
+ * Only slot numbers go through pipes, frames are never copied.
+*/
+void shm_bench(){
+  int ready[2], free_slot[2];
+  uint8_t slot = 0;
+  int bad = 0;
+
+  const int id = sysc_shm_open(SHM_BENCH_KEY, SHM_BENCH_FRAME * SHM_BENCH_SLOTS);
+  if(id < 0 || sysc_pipe(ready) != 0 || sysc_pipe(free_slot) != 0){
+    uart_printf("Error, shm_bench(), cannot set up segment or pipes\r\n");
+    return;
+  }
+  uint32_t *frames = (uint32_t*)sysc_shm_map(id, NULL);
+  if(frames == NULL){
+    uart_printf("Error, shm_bench(), sysc_shm_map() failed\r\n");
+    return;
+  }
+  for(slot=0; slot<SHM_BENCH_SLOTS; slot++)
+    sysc_write(free_slot[1], &slot, 1);
+
+  const uint64_t t0 = read_sysreg(cntpct_el0);
+  if(sysc_fork() == 0){
+    // Kid, producer, inherits the mapping
+    sysc_close(ready[0]);
+    sysc_close(free_slot[1]);
+    for(uint32_t f=0; f<SHM_BENCH_FRAMES; f++){
+      sysc_read(free_slot[0], &slot, 1);
+      uint32_t *px = frames + slot * (SHM_BENCH_FRAME / sizeof(uint32_t));
+      for(size_t i=0; i<SHM_BENCH_FRAME / sizeof(uint32_t); i++)
+        px[i] = f;
+      sysc_write(ready[1], &slot, 1);
+    }
+    sysc_close(ready[1]);
+    sysc_close(free_slot[0]);
+    sysc_shm_unmap(id, frames);
+    sysc_exit(0);
+  }
+
+  // Mom, consumer
+  sysc_close(ready[1]);
+  sysc_close(free_slot[0]);
+  uint32_t f = 0;
+  while(sysc_read(ready[0], &slot, 1) == 1){
+    const uint32_t *px = frames + slot * (SHM_BENCH_FRAME / sizeof(uint32_t));
+    if(px[0] != f || px[SHM_BENCH_FRAME / sizeof(uint32_t) - 1] != f)
+      bad++;
+    f++;
+    sysc_write(free_slot[1], &slot, 1);
+  }
+  const uint64_t t1 = read_sysreg(cntpct_el0);
+  sysc_close(ready[0]);
+  sysc_close(free_slot[1]);
+  sysc_shm_unmap(id, frames);
+  sysc_shm_unlink(SHM_BENCH_KEY);
+
+  const uint64_t us = (t1 - t0) * 1000000 / read_sysreg(cntfrq_el0);
+  const uint64_t bytes = (uint64_t)f * SHM_BENCH_FRAME;
+  uart_printf("exchanged %u frames of %u bytes in %lu us, %lu KB/s, %d corrupted\r\n",
+    f, SHM_BENCH_FRAME, us, us == 0 ? 0 : (bytes * 1000000 / 1024) / us, bad);
+}
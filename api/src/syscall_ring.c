@@ -0,0 +1,152 @@
+#include "syscall_ring.h"
+#include "system_call.h"
+#include "virtual_file_system.h"
+#include "diy_malloc.h"
+#include "diy_string.h"
+#include "sys_reg.h"
+#include "uart.h"
+
+// Kernel side ---------------------------------------
+
+/** Allocate a zeroed ring. The ring holds one reference on each page for its process,
+ * each mapping to el0 adds one more.
+*/
+syscall_ring *syscall_ring_create(){
+  syscall_ring *ring = diy_malloc(SYSCALL_RING_PAGES * PAGE_SIZE);  // page aligned, since size >= PAGE_SIZE
+  memset_(ring, 0, SYSCALL_RING_PAGES * PAGE_SIZE);
+  for(int i=0; i<SYSCALL_RING_PAGES; i++)
+    page_ref_inc((uint64_t)ring + i*PAGE_SIZE);
+  return ring;
+}
+
+// Drop the reference of the process, the ring is freed after every mapping is gone
+void syscall_ring_release(syscall_ring *ring){
+  if(ring == NULL) return;
+  int ref = 0;
+  for(int i=0; i<SYSCALL_RING_PAGES; i++)
+    ref = page_ref_dec((uint64_t)ring + i*PAGE_SIZE);
+  if(ref == 0)  // pages are always mapped together, so they share the count
+    diy_free(ring);
+}
+
+// User side -----------------------------------------
+
+// Get the ring of current process, created on first call
+syscall_ring *ring_setup(){
+  return (syscall_ring*)sysc_ring_setup();
+}
+
+// Get next free submission entry, NULL if the submission ring is full
+ring_sqe *ring_get_sqe(syscall_ring *ring){
+  const uint32_t head = __atomic_load_n(&ring->sq_head, __ATOMIC_ACQUIRE);
+  if(ring->sqe_tail - head >= SYSCALL_RING_ENTRIES)
+    return NULL;
+  ring_sqe *sqe = &ring->sqes[ring->sqe_tail & (SYSCALL_RING_ENTRIES - 1)];
+  memset_(sqe, 0, sizeof(ring_sqe));
+  ring->sqe_tail++;   // kernel sees it after ring_submit(), once it is filled
+  return sqe;
+}
+
+void ring_prep_open(ring_sqe *sqe, const char *pathname, int flags, uint64_t user_data){
+  sqe->op = RING_OP_OPEN;
+  sqe->addr = (uint64_t)pathname;
+  sqe->flags = flags;
+  sqe->user_data = user_data;
+}
+
+void ring_prep_read(ring_sqe *sqe, int fd, void *buf, size_t len, uint64_t user_data){
+  sqe->op = RING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)buf;
+  sqe->len = len;
+  sqe->user_data = user_data;
+}
+
+void ring_prep_write(ring_sqe *sqe, int fd, const void *buf, size_t len, uint64_t user_data){
+  sqe->op = RING_OP_WRITE;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)buf;
+  sqe->len = len;
+  sqe->user_data = user_data;
+}
+
+void ring_prep_lseek(ring_sqe *sqe, int fd, long offset, int whence, uint64_t user_data){
+  sqe->op = RING_OP_LSEEK;
+  sqe->fd = fd;
+  sqe->off = offset;
+  sqe->flags = whence;
+  sqe->user_data = user_data;
+}
+
+void ring_prep_close(ring_sqe *sqe, int fd, uint64_t user_data){
+  sqe->op = RING_OP_CLOSE;
+  sqe->fd = fd;
+  sqe->user_data = user_data;
+}
+
+// Publish entries filled since the last call and submit all pending ones with one system call, return count consumed by kernel
+int ring_submit(syscall_ring *ring){
+  __atomic_store_n(&ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+  const uint32_t pending = ring->sq_tail - __atomic_load_n(&ring->sq_head, __ATOMIC_ACQUIRE);
+  if(pending == 0)
+    return 0;
+  return sysc_ring_enter(pending);
+}
+
+// Get the oldest unseen completion entry, NULL if there is none
+ring_cqe *ring_peek_cqe(syscall_ring *ring){
+  if(ring->cq_head == __atomic_load_n(&ring->cq_tail, __ATOMIC_ACQUIRE))
+    return NULL;
+  return &ring->cqes[ring->cq_head & (SYSCALL_RING_ENTRIES - 1)];
+}
+
+// Mark the entry from ring_peek_cqe() as consumed
+void ring_cqe_seen(syscall_ring *ring){
+  __atomic_store_n(&ring->cq_head, ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+// Compare 10k small writes by one system call each against batched by the ring
+void ring_bench(){
+  const int n = 10000;
+  const char c = 'r';
+  static const char fill[64];
+  uint64_t t0, t1, t2;
+  int traps = 0, submitted = 0, completed = 0;
+  ring_sqe *sqe = NULL;
+  ring_cqe *cqe = NULL;
+
+  syscall_ring *ring = ring_setup();
+  int fd = sysc_open("/ring_bench", O_CREAT);
+  if(ring == NULL || fd < 0){
+    uart_printf("Error, ring_bench(), ring=0x%p, fd=%d\r\n", ring, fd);
+    return;
+  }
+  // Write the file once first, so no write below allocates a page
+  for(int i=0; i<=n/sizeof(fill); i++)
+    sysc_write(fd, fill, sizeof(fill));
+
+  sysc_lseek64(fd, 0, SEEK_SET);
+  t0 = read_sysreg(cntpct_el0);
+  for(int i=0; i<n; i++)
+    sysc_write(fd, &c, 1);
+  t1 = read_sysreg(cntpct_el0);
+
+  sysc_lseek64(fd, 0, SEEK_SET);
+  while(completed < n){
+    while(submitted < n && (sqe = ring_get_sqe(ring)) != NULL)
+      ring_prep_write(sqe, fd, &c, 1, submitted++);
+    ring_submit(ring);
+    traps++;
+    while((cqe = ring_peek_cqe(ring)) != NULL){
+      completed++;
+      ring_cqe_seen(ring);
+    }
+  }
+  t2 = read_sysreg(cntpct_el0);
+  sysc_close(fd);
+
+  const uint64_t cntfrq = read_sysreg(cntfrq_el0);
+  uart_printf("%d writes of 1 byte each\r\n", n);
+  uart_printf("sysc_write()  : %d traps, %lu ticks (%lu us)\r\n", n, t1 - t0, (t1 - t0)*1000000/cntfrq);
+  uart_printf("syscall ring  : %d traps, %lu ticks (%lu us)\r\n", traps, t2 - t1, (t2 - t1)*1000000/cntfrq);
+}
@@ -10,6 +10,13 @@
 #include "mmu.h"
 #include "virtual_file_system.h"
 #include "diy_string.h"
+#include "program_loader.h"
+#include "syscall_abi.h"
+#include "syscall_ring.h"
+#include "pipe.h"
+#include "shm.h"
+#include "msg.h"
+#include "poll.h"
 
 #ifdef THREADS  // pass -DTHREADS to compiler for lab5
 // Lab5, basic 2 description: The system call numbers given below would be stored in x8
@@ -29,6 +36,24 @@
 #define SYSCALL_NUM_MOUNT      16
 #define SYSCALL_NUM_CHDIR      17
 #define SYSCALL_NUM_LSEEK      18
+#define SYSCALL_NUM_RING_SETUP 19
+#define SYSCALL_NUM_RING_ENTER 20
+#define SYSCALL_NUM_READV      21
+#define SYSCALL_NUM_WRITEV     22
+#define SYSCALL_NUM_PREAD64    23
+#define SYSCALL_NUM_PWRITE64   24
+#define SYSCALL_NUM_PIPE       25
+#define SYSCALL_NUM_SHM_OPEN   26
+#define SYSCALL_NUM_SHM_MAP    27
+#define SYSCALL_NUM_SHM_UNMAP  28
+#define SYSCALL_NUM_SHM_UNLINK 29
+#define SYSCALL_NUM_MSG_SEND   30
+#define SYSCALL_NUM_MSG_RECV   31
+#define SYSCALL_NUM_POLL       32
+#define SYSCALL_NUM_OPENAT     33
+#define SYSCALL_NUM_GETDENTS   34
+#define SYSCALL_NUM_UNLINK     35
+#define SYSCALL_NUM_SYNC       36
 
 extern void kid_thread_return_fork();   // defined in vect_table_and_execption_handler.S
 
@@ -42,6 +67,7 @@ static void   priv_exit(int status);
 static int    priv_mbox_call(unsigned char ch, unsigned int *mbox);
 static int    priv_kill(int pid);
 static int    priv_open(const char *pathname, int flags);
+static int    priv_openat(int dirfd, const char *pathname, int flags);
 static int    priv_close(int fd);
 static size_t priv_write(int fd, const void *buf, size_t count);
 static size_t priv_read(int fd, void *buf, size_t count);
@@ -49,8 +75,118 @@ static int    priv_mkdir(const char *pathname, unsigned mode);
 static int    priv_mount(const char *src, const char *target, const char *filesystem, unsigned long flags, const void *data);
 static int    priv_chdir(const char *path);
 static long   priv_lseek64(int fd, long offset, int whence);
+static uint64_t priv_ring_setup();
+static int    priv_ring_enter(unsigned to_submit);
+static long   priv_readv(int fd, const iovec *iov, int iovcnt);
+static long   priv_writev(int fd, const iovec *iov, int iovcnt);
+static long   priv_pread64(int fd, void *buf, size_t count, long offset);
+static long   priv_pwrite64(int fd, const void *buf, size_t count, long offset);
+static int    priv_pipe(int fds[2]);
+static int    priv_shm_open(int key, size_t size);
+static uint64_t priv_shm_map(int id, uint64_t va);
+static int    priv_shm_unmap(int id, uint64_t va);
+static int    priv_shm_unlink(int key);
+static long   priv_msg_send(int pid, const void *buf, size_t len);
+static long   priv_msg_recv(void *buf, size_t len, int *from);
+static int    priv_poll(pollfd *fds, int nfds, int timeout_ms);
+static long   priv_getdents(int fd, void *buf, size_t len);
+static int    priv_unlink(const char *pathname);
+static int    priv_sync();
 
 
+// Handler of system call taking arguments in x0..x4, return value goes to x0
+typedef uint64_t (*syscall_fn)(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4);
+// Handler of system call which modifies the trap frame, e.g. exec, fork
+typedef void (*syscall_tf_fn)(trap_frame *tf);
+
+static uint64_t sysh_getpid(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)     { return priv_getpid(); }
+static uint64_t sysh_uart_read(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)  { return priv_uart_read((char*)x0, x1); }
+static uint64_t sysh_uart_write(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4) { return priv_uart_write((char*)x0, x1); }
+static uint64_t sysh_exit(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)       { priv_exit((int)x0); return 0; }
+static uint64_t sysh_mbox_call(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)  { return priv_mbox_call((unsigned char)x0, (unsigned int*)x1); }
+static uint64_t sysh_kill(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)       { return priv_kill(x0); }
+static uint64_t sysh_open(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)       { return priv_open((const char*)x0, x1); }
+static uint64_t sysh_openat(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)     { return priv_openat(x0, (const char*)x1, x2); }
+static uint64_t sysh_close(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)      { return priv_close(x0); }
+static uint64_t sysh_write(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)      { return priv_write(x0, (const void*)x1, x2); }
+static uint64_t sysh_read(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)       { return priv_read(x0, (void*)x1, x2); }
+static uint64_t sysh_mkdir(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)      { return priv_mkdir((const char*)x0, x1); }
+static uint64_t sysh_mount(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4){
+  return priv_mount((const char*)x0, (const char*)x1, (const char*)x2, x3, (const void*)x4);
+}
+static uint64_t sysh_chdir(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)      { return priv_chdir((const char*)x0); }
+static uint64_t sysh_lseek64(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)    { return priv_lseek64(x0, x1, x2); }
+static uint64_t sysh_ring_setup(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)  { return priv_ring_setup(); }
+static uint64_t sysh_ring_enter(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)  { return priv_ring_enter(x0); }
+static uint64_t sysh_readv(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)      { return priv_readv(x0, (const iovec*)x1, x2); }
+static uint64_t sysh_writev(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)     { return priv_writev(x0, (const iovec*)x1, x2); }
+static uint64_t sysh_pread64(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)    { return priv_pread64(x0, (void*)x1, x2, x3); }
+static uint64_t sysh_pwrite64(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)   { return priv_pwrite64(x0, (const void*)x1, x2, x3); }
+static uint64_t sysh_pipe(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)       { return priv_pipe((int*)x0); }
+static uint64_t sysh_shm_open(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)   { return priv_shm_open(x0, x1); }
+static uint64_t sysh_shm_map(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)    { return priv_shm_map(x0, x1); }
+static uint64_t sysh_shm_unmap(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)  { return priv_shm_unmap(x0, x1); }
+static uint64_t sysh_shm_unlink(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4) { return priv_shm_unlink(x0); }
+static uint64_t sysh_msg_send(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)   { return priv_msg_send(x0, (const void*)x1, x2); }
+static uint64_t sysh_msg_recv(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)   { return priv_msg_recv((void*)x0, x1, (int*)x2); }
+static uint64_t sysh_poll(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)       { return priv_poll((pollfd*)x0, x1, x2); }
+static uint64_t sysh_getdents(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)   { return priv_getdents(x0, (void*)x1, x2); }
+static uint64_t sysh_unlink(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)     { return priv_unlink((const char*)x0); }
+static uint64_t sysh_sync(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4)       { return priv_sync(); }
+static void     sysh_exec(trap_frame *tf) { tf->x0 = priv_exec((char*)tf->x0, (char **)tf->x1, tf); }
+static void     sysh_fork(trap_frame *tf) { tf->x0 = priv_fork(tf); }
+
+static const syscall_fn syscall_table[SYSCALL_TABLE_SIZE] = {
+  [SYSCALL_NUM_GETPID]     = sysh_getpid,
+  [SYSCALL_NUM_UART_READ]  = sysh_uart_read,
+  [SYSCALL_NUM_UART_WRITE] = sysh_uart_write,
+  [SYSCALL_NUM_EXIT]       = sysh_exit,
+  [SYSCALL_NUM_MBOX_CALL]  = sysh_mbox_call,
+  [SYSCALL_NUM_KILL]       = sysh_kill,
+  [SYSCALL_NUM_OPEN]       = sysh_open,
+  [SYSCALL_NUM_CLOSE]      = sysh_close,
+  [SYSCALL_NUM_WRITE]      = sysh_write,
+  [SYSCALL_NUM_READ]       = sysh_read,
+  [SYSCALL_NUM_MKDIR]      = sysh_mkdir,
+  [SYSCALL_NUM_MOUNT]      = sysh_mount,
+  [SYSCALL_NUM_CHDIR]      = sysh_chdir,
+  [SYSCALL_NUM_LSEEK]      = sysh_lseek64,
+  [SYSCALL_NUM_RING_SETUP] = sysh_ring_setup,
+  [SYSCALL_NUM_RING_ENTER] = sysh_ring_enter,
+  [SYSCALL_NUM_READV]      = sysh_readv,
+  [SYSCALL_NUM_WRITEV]     = sysh_writev,
+  [SYSCALL_NUM_PREAD64]    = sysh_pread64,
+  [SYSCALL_NUM_PWRITE64]   = sysh_pwrite64,
+  [SYSCALL_NUM_PIPE]       = sysh_pipe,
+  [SYSCALL_NUM_SHM_OPEN]   = sysh_shm_open,
+  [SYSCALL_NUM_SHM_MAP]    = sysh_shm_map,
+  [SYSCALL_NUM_SHM_UNMAP]  = sysh_shm_unmap,
+  [SYSCALL_NUM_SHM_UNLINK] = sysh_shm_unlink,
+  [SYSCALL_NUM_MSG_SEND]   = sysh_msg_send,
+  [SYSCALL_NUM_MSG_RECV]   = sysh_msg_recv,
+  [SYSCALL_NUM_POLL]       = sysh_poll,
+  [SYSCALL_NUM_OPENAT]     = sysh_openat,
+  [SYSCALL_NUM_GETDENTS]   = sysh_getdents,
+  [SYSCALL_NUM_UNLINK]     = sysh_unlink,
+  [SYSCALL_NUM_SYNC]       = sysh_sync,
+};
+
+static const syscall_tf_fn syscall_tf_table[SYSCALL_TABLE_SIZE] = {
+  [SYSCALL_NUM_EXEC]       = sysh_exec,
+  [SYSCALL_NUM_FORK]       = sysh_fork,
+};
+
+/** System calls served by the fast path in sync_el0_64_ex_handler, vect_table_and_execption_handler.S.
+ * The fast path saves only x1..x18 and x30, which the caller of "svc 0" can see, and jumps here directly.
+ * So only calls that don't touch the trap frame and never block are listed: nothing that may schedule(), wait for
+ * a device or do SD card I/O, since another thread would run with the registers left unsaved.
+*/
+syscall_fn syscall_fast_table[SYSCALL_TABLE_SIZE] = {
+  [SYSCALL_NUM_GETPID]     = sysh_getpid,
+  [SYSCALL_NUM_LSEEK]      = sysh_lseek64,
+};
+uint32_t syscall_fast_enabled = 1; // read by sync_el0_64_ex_handler
+
 /**
  * How to invoke a system call:
  *  1. Call public function, let's say sysc_kill()
@@ -61,34 +197,60 @@ static long   priv_lseek64(int fd, long offset, int whence);
  *  6. In system_call(), get system call number from x8 in trap frame, and then execute the corresponding private system call
  *  7. x0..7 in trap frame can be read as parameters passing to system call, x0 is the return value
  *  8. In this case, sysc_kill() has 1 passed in parameter, pid in x0, and 1 return value
+ * Calls in syscall_fast_table from el0 skip step 3 to 6, see sync_el0_64_ex_handler
 */
 void system_call(trap_frame *tf){
   uint64_t num = tf->x8;
   thread_t *thd = NULL;
-  switch(num){
-    case SYSCALL_NUM_GETPID:      tf->x0 = priv_getpid();                                                 break;
-    case SYSCALL_NUM_UART_READ:   tf->x0 = priv_uart_read((char*)tf->x0, (size_t)tf->x1);                 break;
-    case SYSCALL_NUM_UART_WRITE:  tf->x0 = priv_uart_write((char*)tf->x0, (size_t)tf->x1);                break;
-    case SYSCALL_NUM_EXEC:        tf->x0 = priv_exec((char*)tf->x0, (char **)tf->x1, tf);                 break;
-    case SYSCALL_NUM_FORK:        tf->x0 = priv_fork(tf);                                                 break;
-    case SYSCALL_NUM_EXIT:        priv_exit((int)tf->x0);                                                 break;
-    case SYSCALL_NUM_MBOX_CALL:   tf->x0 = priv_mbox_call((unsigned char)tf->x0, (unsigned int*)tf->x1);  break;
-    case SYSCALL_NUM_KILL:        tf->x0 = priv_kill(tf->x0);                                             break;
-    case SYSCALL_NUM_OPEN:        tf->x0 = priv_open((const char*)tf->x0, tf->x1);                        break;
-    case SYSCALL_NUM_CLOSE:       tf->x0 = priv_close(tf->x0);                                            break;
-    case SYSCALL_NUM_WRITE:       tf->x0 = priv_write(tf->x0, (const void*)tf->x1, tf->x2);               break;
-    case SYSCALL_NUM_READ:        tf->x0 = priv_read(tf->x0, (void*)tf->x1, tf->x2);                      break;
-    case SYSCALL_NUM_MKDIR:       tf->x0 = priv_mkdir((const char*)tf->x0, tf->x1);                       break;
-    case SYSCALL_NUM_MOUNT:       
-      tf->x0 = priv_mount((const char*)tf->x0, (const char*)tf->x1, (const char*)tf->x2, tf->x3, (const void*)tf->x4);
-      break;
-    case SYSCALL_NUM_CHDIR:       tf->x0 = priv_chdir((const char*)tf->x0);                               break;
-    case SYSCALL_NUM_LSEEK:       tf->x0 = priv_lseek64(tf->x0, tf->x1, tf->x2);                          break;
+  if(num < SYSCALL_TABLE_SIZE && syscall_table[num] != NULL)
+    tf->x0 = syscall_table[num](tf->x0, tf->x1, tf->x2, tf->x3, tf->x4);
+  else if(num < SYSCALL_TABLE_SIZE && syscall_tf_table[num] != NULL)
+    syscall_tf_table[num](tf);
+  else{
+    thd = thread_get_current();
+    uart_printf("Exeception, unimplemented system call, num=%lu, pid=%d, elr_el1=%lX\r\n", num, thd->pid, thd->elr_el1);
+  }
+}
 
-    default:
-      thd = thread_get_current();
-      uart_printf("Exeception, unimplemented system call, num=%lu, pid=%d, elr_el1=%lX\r\n", num, thd->pid, thd->elr_el1);
+/** Synchronous exception taken by any lab: svc goes to system_call(), data abort to mmu_page_fault() of the current thread,
+ * e.g. the first write to a copy-on-write page of an exec'ed image, or the first access to its .bss.
+ * @return 0 if handled and the faulting instruction can be retried or returned from, non-0 otherwise
+*/
+int sync_exception_dispatch(trap_frame *tf){
+  const uint64_t ec = ESR_ELx_EC(tf->esr_el1);
+  if(ec == ESR_ELx_EC_SVC64){
+    system_call(tf);
+    return 0;
+  }
+  if(ec == ESR_ELx_EC_DABT_LOW || ec == ESR_ELx_EC_DABT_CUR){
+#ifdef VIRTUAL_MEM
+    thread_t *thd = thread_get_current();
+    return mmu_page_fault((uint64_t*)thd->ttbr0_el1, read_sysreg(far_el1), tf->esr_el1, thd->zero_areas, thd->zero_area_cnt);
+#endif
   }
+  return -1;
+}
+
+
+// Enable or disable the fast path of system call for every process, kernel side only, e.g. by the shell
+void syscall_fast_path_set(int enable){
+  syscall_fast_enabled = enable ? 1 : 0;
+}
+
+// Return 1 if the fast path of system call is enabled
+int syscall_fast_path_get(){
+  return syscall_fast_enabled;
+}
+
+// Round-trip time of a null system call (getpid), through the fast path or the full trap frame, as set now
+void syscall_bench(){
+  const int n = 10000;
+  const uint64_t cntfrq = read_sysreg(cntfrq_el0);
+  const uint64_t t0 = read_sysreg(cntpct_el0);
+  for(int i=0; i<n; i++) sysc_getpid();
+  const uint64_t t1 = read_sysreg(cntpct_el0);
+  uart_printf("%d null system calls through %s: %lu ticks, %lu ns/call\r\n", n,
+    syscall_fast_path_get() ? "fast path" : "full trap frame", t1 - t0, (t1 - t0) * 1000000000 / cntfrq / n);
 }
 
 int           sysc_getpid(){
@@ -154,40 +316,21 @@ int           sysc_exec(const char *name, char *const argv[]){
 }
 static int    priv_exec(const char *name, char *const argv[], trap_frame *tf){
   thread_t *thd = thread_get_current();
-  uint8_t *load_addr = NULL; // 64 pages
+  uint64_t entry = 0;
+  void *space = NULL;
   // if(thd->mode == KERNEL){
   //   uart_printf("sysc_exec() failed, current thread pid=%d, sysc_exec() for KERNEL thread is now unimplemented\r\n", thd->pid);
   //   return -1;
   // }
 
-  // Copy image to a dynamic allocated space
-  load_addr = diy_malloc(PAGE_SIZE*64);
-  file *fh = NULL;
-  int ret = vfs_open((char*)name, 0, &fh);
-  if(ret == 0){
-    fh->f_ops->read(fh, load_addr, PAGE_SIZE*64);
-    fh->f_ops->close(fh);
-  }
-  else{
+  // ELF is loaded by segments, other files as flat image.
+  // With virtual memory, the program is mapped to thd->ttbr0_el1 and entry is a virtual address
+  if(program_load(name, thd, &entry, &space) != 0)
     return -1;
-  }
-  // if(cpio_copy((char*)name, load_addr) != 0){
-  //   uart_printf("sysc_exec() failed, failed to locate file %s.\r\n", name);
-  //   return -1;
-  // }
-
-#ifdef VIRTUAL_MEM
-  // Map custom virtual address to dynamic allocated address
-  // Note that diy_malloc() return virtual (with kernel prefix), map_pages() remove it for physical
-  map_pages((uint64_t*)thd->ttbr0_el1, DEFAULT_THREAD_VA_CODE_START,  (uint64_t)load_addr, 64);  // map for code space
-  
-  // Use virtual address instead
-  load_addr = (void*) DEFAULT_THREAD_VA_CODE_START;
-#endif
 
   // Modify trap frame, 
   // so when returning from execeptio, eret sets sp to sp_el0 and jumps to elr_el12
-  tf->elr_el1 = (uint64_t)load_addr;
+  tf->elr_el1 = entry;
   tf->sp_el0 = (uint64_t)thd->user_sp;
   return 0;
   // should call eret here, exec the program direcctly
@@ -196,16 +339,21 @@ static int    priv_exec(const char *name, char *const argv[], trap_frame *tf){
 #ifdef VIRTUAL_MEM
 int           exec_from_kernel_to_user_vm(const char *name){
   thread_t *thd = thread_get_current();   // raise syn exception if running under el0
-  uint8_t *load_addr = NULL; // 64 pages
+  uint64_t entry = 0;
+  void *space = NULL;
   if(thd->mode != KERNEL){
     uart_printf("exec_from_kernel_to_user_vm() failed, current thread pid=%d is not kernel thread.\r\n", thd->pid);
     return -1;
   }
 
-  // Copy image to a dynamic allocated space
-  load_addr = diy_malloc(PAGE_SIZE*64);
-  if(cpio_copy((char*)name, load_addr) != 0){
-    uart_printf("exec_from_kernel_to_user_vm() failed, failed to locate file %s.\r\n", name);
+  // Load the program to a new page table
+  uint64_t *pgd = (uint64_t*)KERNEL_VA_TO_PA(new_page_table());
+  const uint64_t ttbr0_el1 = thd->ttbr0_el1;
+  thd->ttbr0_el1 = (uint64_t)pgd;
+  if(program_load(name, thd, &entry, &space) != 0){
+    uart_printf("exec_from_kernel_to_user_vm() failed, failed to load file %s.\r\n", name);
+    thd->ttbr0_el1 = ttbr0_el1;
+    free_page_table(pgd);
     return -1;
   }
 
@@ -214,19 +362,18 @@ int           exec_from_kernel_to_user_vm(const char *name){
   // Map custom virtual address to dynamic allocated address
   // Note that diy_malloc() return virtual (with kernel prefix), map_pages() remove it for physical
   void *user_space = diy_malloc(PAGE_SIZE*4);
-  uint64_t *pgd = (uint64_t*)KERNEL_VA_TO_PA(new_page_table());
-  map_pages(pgd, DEFAULT_THREAD_VA_CODE_START,  (uint64_t)load_addr, 64);  // map for code space
   map_pages(pgd, DEFAULT_THREAD_VA_STACK_START, (uint64_t)user_space, 4);  // map for stack
+  map_pages_counted(pgd, VDSO_VA, (uint64_t)thd->vdso, 1, MMU_MAP_READ_ONLY);  // data page, see vdso.h
+  thd->shm_next_va = SHM_VA_START;
   
   // Use virtual address instead
-  load_addr = (void*) DEFAULT_THREAD_VA_CODE_START;
   user_space = (void*) DEFAULT_THREAD_VA_STACK_START;
 
-  thd->target_func = load_addr;
+  thd->target_func = (void*)entry;
   thd->user_space = user_space;
   thd->user_sp = user_space + DEFAULT_THREAD_SIZE - 1;
   thd->user_sp = (void*)(  (uint64_t)thd->user_sp - ((uint64_t)thd->user_sp % 16)  ); // round down to multiple of 16
-  thd->ttbr0_el1 = (uint64_t)pgd;
+  thread_set_vdso(thd);
 
   // Change ttbr0_el1
   write_gen_reg(x0, thd->ttbr0_el1);
@@ -278,6 +425,9 @@ static int    priv_fork(trap_frame *tf_mom){
     thd_backup.ppid           = thd_mom->pid;
     thd_backup.state          = thd_kid->state;
     thd_backup.next           = thd_kid->next;
+    thd_backup.vdso           = thd_kid->vdso;
+    thd_backup.all_next       = thd_kid->all_next;
+    memcpy_(thd_backup.fd_table, thd_kid->fd_table, sizeof(thd_backup.fd_table));
 
     // Copy momther thread's entire stack and thread info
     copy_src  = (uint8_t*)thd_mom->allocated_addr;
@@ -292,6 +442,21 @@ static int    priv_fork(trap_frame *tf_mom){
     thd_kid->ppid           = thd_backup.ppid;
     thd_kid->state          = thd_backup.state;
     thd_kid->next           = thd_backup.next;
+    thd_kid->vdso           = thd_backup.vdso;
+    thd_kid->vdso->ppid     = thd_kid->ppid;
+    thd_kid->ring           = NULL;   // kid calls sysc_ring_setup() for its own ring
+    thd_kid->mq             = NULL;   // pending messages stay with mom
+    thd_kid->all_next       = thd_backup.all_next;
+    shm_kernel_dup(thd_kid->shm_maps);  // kid inherits mom's segments mapped at their kernel address
+
+    // Kid gets its own handle of every file mom opened, so both can close them, e.g. ends of a pipe
+    for(int i=0; i<VFS_PROCESS_MAX_OPEN_FILE; i++){
+      if(thd_backup.fd_table[i] != NULL)
+        vfs_close(thd_backup.fd_table[i]);  // opened by thread_create()
+      thd_kid->fd_table[i] = NULL;
+      if(thd_mom->fd_table[i] != NULL)
+        vfs_dup(thd_mom->fd_table[i], &thd_kid->fd_table[i]);
+    }
 
     // Copy mother thread's user stack if it's a user thread
     if(thd_kid->mode == USER){
@@ -315,6 +480,9 @@ static int    priv_fork(trap_frame *tf_mom){
   copy_page_table((uint64_t*)thd_mom->ttbr0_el1, (uint64_t*)thd_kid->ttbr0_el1);
   map_pages((uint64_t*)thd_kid->ttbr0_el1, DEFAULT_THREAD_VA_STACK_START, (uint64_t)thd_kid->user_space, DEFAULT_THREAD_SIZE/PAGE_SIZE);
   map_pages((uint64_t*)thd_kid->ttbr0_el1, KERNEL_PA_TO_VA(0x3c000000), 0x3c000000, (0x3f000000-0x3c000000)/PAGE_SIZE);
+  map_pages_counted((uint64_t*)thd_kid->ttbr0_el1, VDSO_VA, (uint64_t)thd_kid->vdso, 1, MMU_MAP_READ_ONLY);
+  if(thd_mom->ring != NULL)
+    unmap_pages((uint64_t*)thd_kid->ttbr0_el1, SYSCALL_RING_VA, SYSCALL_RING_PAGES);
   thd_kid->user_space = (void*)DEFAULT_THREAD_VA_STACK_START;
   thd_kid->user_sp = thd_mom->user_sp;
 #else // Set fp, sp_el0 offset if virtual memory not enabled
@@ -389,21 +557,64 @@ int           sysc_open(const char *pathname, int flags){
   return ret_val;
 }
 static int    priv_open(const char *pathname, int flags){
+  return priv_openat(AT_FDCWD, pathname, flags);
+}
+
+/** Find where pathname of an *at() system call starts, so the cwd or dirfd prefix is not walked again.
+ * Relative paths start from the vnode of cwd or dirfd, unless ".." climbs above it, vnodes don't know their parents.
+ * @param path: output, pathname normalized relative to the returned directory, TMPFS_MAX_PATH_LEN bytes
+ * @return directory to look up path under, NULL on error
+*/
+static vnode *priv_path_at(thread_t *thd, int dirfd, const char *pathname, char *path){
+  if(pathname[0] == '/')
+    return to_abs_path(path, "/", pathname) == 0 ? root_mount.root : NULL;
+
+  const int above = normalize_path(path, pathname);
+  if(above < 0)
+    return NULL;
+  if(dirfd == AT_FDCWD){
+    if(above == 0 && thd->cwd_node != NULL)
+      return thd->cwd_node;
+    return to_abs_path(path, thd->cwd, pathname) == 0 ? root_mount.root : NULL;  // from root through cwd string
+  }
+
+  file *fh = (dirfd >= 0 && dirfd < VFS_PROCESS_MAX_OPEN_FILE) ? thd->fd_table[dirfd] : NULL;
+  if(fh == NULL || !(fh->flags & O_DIRECTORY)){
+    uart_printf("Error, priv_path_at(), dirfd=%d is not an opened directory, pid=%d\r\n", dirfd, thd->pid);
+    return NULL;
+  }
+  if(above > 0){
+    uart_printf("Error, priv_path_at(), \"..\" above dirfd=%d is not supported, path=%s, pid=%d\r\n", dirfd, pathname, thd->pid);
+    return NULL;
+  }
+  return fh->vnode;
+}
+
+// Return file descriptor, pathname is relative to dirfd or cwd if dirfd is AT_FDCWD
+int           sysc_openat(int dirfd, const char *pathname, int flags){
+  write_gen_reg(x8, SYSCALL_NUM_OPENAT);
+  write_gen_reg(x2, flags);
+  write_gen_reg(x1, pathname);  // write_gen_reg() seems to use x0 as buffer
+  write_gen_reg(x0, dirfd);     // so write to x0 should be the last one performed
+  asm volatile("svc 0");
+  int ret_val = read_gen_reg(x0);
+  return ret_val;
+}
+static int    priv_openat(int dirfd, const char *pathname, int flags){
   thread_t *thd = thread_get_current();
   int fd = thread_get_idle_fd(thd);
   if(fd < 0){
-    uart_printf("Error, priv_open(), cannot open more file for pid=%d\r\n", thd->pid);
+    uart_printf("Error, priv_openat(), cannot open more file for pid=%d\r\n", thd->pid);
     return -1;
   }
 
-  // Translate to absolute path
-  char abs_path[TMPFS_MAX_PATH_LEN];
-  abs_path[0] = '\0';
-  to_abs_path(abs_path, thd->cwd, pathname);
+  char path[TMPFS_MAX_PATH_LEN];
+  vnode *dir = priv_path_at(thd, dirfd, pathname, path);
+  if(dir == NULL)
+    return -1;
 
   file *fh = NULL;
-  int ret = vfs_open((char*)abs_path, flags, &fh);
-  uart_printf("Debug, priv_open(), abs_path=%s, flags=0x%X, ret=%d\r\n", abs_path, flags, ret);
+  int ret = vfs_open_at(dir, path, flags, &fh);
   if(ret == 0){
     thd->fd_table[fd] = fh;
     return fd;
@@ -526,17 +737,24 @@ int           sysc_chdir(const char *path){
 static int    priv_chdir(const char *path){
   thread_t *thd = thread_get_current();
   char changed_path[TMPFS_MAX_PATH_LEN];
-  int ret = 0;
+  int ret = 1;
   vnode *node = NULL;
-  changed_path[0] = '\0';
-  to_abs_path(changed_path, thd->cwd, path);
-  if(changed_path[strlen_(changed_path)-1] != '/')
-    strcat_(changed_path, "/");
-  ret = vfs_lookup(changed_path, &node);
-  if(ret == 0)
-    strcpy_(thd->cwd, changed_path);
 
-  uart_printf("Debug, priv_chdir(), pid=%d, path=%s, cwd=%s\r\n", thd->pid, path, thd->cwd);
+  vnode *dir = priv_path_at(thd, AT_FDCWD, path, changed_path);
+  if(dir != NULL)
+    ret = lookup_recur(changed_path, dir, &node, 0);
+  if(ret == 0 && node->comp->type != COMP_DIR){
+    uart_printf("Error, priv_chdir(), %s is not a directory, pid=%d\r\n", path, thd->pid);
+    ret = 1;
+  }
+
+  // Keep both the path for ".." and the vnode so relative lookups start there
+  if(ret == 0 && to_abs_path(changed_path, thd->cwd, path) == 0){
+    if(changed_path[strlen_(changed_path)-1] != '/')
+      strcat_(changed_path, "/");
+    strcpy_(thd->cwd, changed_path);
+    thd->cwd_node = node;
+  }
   return ret;
 }
 
@@ -547,7 +765,428 @@ static long   priv_lseek64(int fd, long offset, int whence){
     uart_printf("Error, priv_lseek64(), unrecognized fd=%d, pid=%d\r\n", fd, thd->pid);
     return 0;
   }
+  if(fh->f_ops->lseek64 == NULL){
+    uart_printf("Error, priv_lseek64(), fd=%d is not seekable, pid=%d\r\n", fd, thd->pid);
+    return -1;
+  }
   return fh->f_ops->lseek64(fh, offset, whence);
 }
 
+long          sysc_lseek64(int fd, long offset, int whence){
+  write_gen_reg(x8, SYSCALL_NUM_LSEEK);
+  write_gen_reg(x2, whence);
+  write_gen_reg(x1, offset);  // write_gen_reg() seems to use x0 as buffer
+  write_gen_reg(x0, fd);      // so write to x0 should be the last one performed
+  asm volatile("svc 0");
+  long ret_val = read_gen_reg(x0);
+  return ret_val;
+}
+
+// Return total size read, which goes through vfs_read() once per iovec in a single trap
+long          sysc_readv(int fd, const iovec *iov, int iovcnt){
+  write_gen_reg(x8, SYSCALL_NUM_READV);
+  write_gen_reg(x2, iovcnt);
+  write_gen_reg(x1, iov);  // write_gen_reg() seems to use x0 as buffer
+  write_gen_reg(x0, fd);   // so write to x0 should be the last one performed
+  asm volatile("svc 0");
+  long ret_val = read_gen_reg(x0);
+  return ret_val;
+}
+static long   priv_readv(int fd, const iovec *iov, int iovcnt){
+  thread_t *thd = thread_get_current();
+  file *fh = (fd >= 0 && fd < VFS_PROCESS_MAX_OPEN_FILE) ? thd->fd_table[fd] : NULL;
+  if(fh == NULL){
+    uart_printf("Error, priv_readv(), unrecognized fd=%d, pid=%d\r\n", fd, thd->pid);
+    return -1;
+  }
+  return vfs_readv(fh, iov, iovcnt);
+}
+
+// Return total size wrote, which goes through vfs_write() once per iovec in a single trap
+long          sysc_writev(int fd, const iovec *iov, int iovcnt){
+  write_gen_reg(x8, SYSCALL_NUM_WRITEV);
+  write_gen_reg(x2, iovcnt);
+  write_gen_reg(x1, iov);  // write_gen_reg() seems to use x0 as buffer
+  write_gen_reg(x0, fd);   // so write to x0 should be the last one performed
+  asm volatile("svc 0");
+  long ret_val = read_gen_reg(x0);
+  return ret_val;
+}
+static long   priv_writev(int fd, const iovec *iov, int iovcnt){
+  thread_t *thd = thread_get_current();
+  file *fh = (fd >= 0 && fd < VFS_PROCESS_MAX_OPEN_FILE) ? thd->fd_table[fd] : NULL;
+  if(fh == NULL){
+    uart_printf("Error, priv_writev(), unrecognized fd=%d, pid=%d\r\n", fd, thd->pid);
+    return -1;
+  }
+  return vfs_writev(fh, iov, iovcnt);
+}
+
+// Read at offset without lseek, f_pos of fd is not changed
+long          sysc_pread64(int fd, void *buf, size_t count, long offset){
+  write_gen_reg(x8, SYSCALL_NUM_PREAD64);
+  write_gen_reg(x3, offset);
+  write_gen_reg(x2, count);
+  write_gen_reg(x1, buf);  // write_gen_reg() seems to use x0 as buffer
+  write_gen_reg(x0, fd);   // so write to x0 should be the last one performed
+  asm volatile("svc 0");
+  long ret_val = read_gen_reg(x0);
+  return ret_val;
+}
+static long   priv_pread64(int fd, void *buf, size_t count, long offset){
+  thread_t *thd = thread_get_current();
+  file *fh = (fd >= 0 && fd < VFS_PROCESS_MAX_OPEN_FILE) ? thd->fd_table[fd] : NULL;
+  if(fh == NULL || offset < 0){
+    uart_printf("Error, priv_pread64(), unrecognized fd=%d or offset=%ld, pid=%d\r\n", fd, offset, thd->pid);
+    return -1;
+  }
+  return vfs_pread(fh, buf, count, offset);
+}
+
+// Write at offset without lseek, f_pos of fd is not changed
+long          sysc_pwrite64(int fd, const void *buf, size_t count, long offset){
+  write_gen_reg(x8, SYSCALL_NUM_PWRITE64);
+  write_gen_reg(x3, offset);
+  write_gen_reg(x2, count);
+  write_gen_reg(x1, buf);  // write_gen_reg() seems to use x0 as buffer
+  write_gen_reg(x0, fd);   // so write to x0 should be the last one performed
+  asm volatile("svc 0");
+  long ret_val = read_gen_reg(x0);
+  return ret_val;
+}
+static long   priv_pwrite64(int fd, const void *buf, size_t count, long offset){
+  thread_t *thd = thread_get_current();
+  file *fh = (fd >= 0 && fd < VFS_PROCESS_MAX_OPEN_FILE) ? thd->fd_table[fd] : NULL;
+  if(fh == NULL || offset < 0){
+    uart_printf("Error, priv_pwrite64(), unrecognized fd=%d or offset=%ld, pid=%d\r\n", fd, offset, thd->pid);
+    return -1;
+  }
+  return vfs_pwrite(fh, buf, count, offset);
+}
+
+// List entries of a directory opened with O_DIRECTORY, as many dirent as fit in buf. Return bytes filled, 0 at the end
+long          sysc_getdents(int fd, void *buf, size_t len){
+  write_gen_reg(x8, SYSCALL_NUM_GETDENTS);
+  write_gen_reg(x2, len);
+  write_gen_reg(x1, buf);  // write_gen_reg() seems to use x0 as buffer
+  write_gen_reg(x0, fd);   // so write to x0 should be the last one performed
+  asm volatile("svc 0");
+  long ret_val = read_gen_reg(x0);
+  return ret_val;
+}
+static long   priv_getdents(int fd, void *buf, size_t len){
+  thread_t *thd = thread_get_current();
+  file *fh = (fd >= 0 && fd < VFS_PROCESS_MAX_OPEN_FILE) ? thd->fd_table[fd] : NULL;
+  if(fh == NULL){
+    uart_printf("Error, priv_getdents(), unrecognized fd=%d, pid=%d\r\n", fd, thd->pid);
+    return -1;
+  }
+  return vfs_getdents(fh, buf, len);
+}
+
+// Remove a file or an empty directory. Return 0 on success
+int           sysc_unlink(const char *pathname){
+  write_gen_reg(x8, SYSCALL_NUM_UNLINK);
+  write_gen_reg(x0, pathname);
+  asm volatile("svc 0");
+  int ret_val = read_gen_reg(x0);
+  return ret_val;
+}
+static int    priv_unlink(const char *pathname){
+  thread_t *thd = thread_get_current();
+  char path[TMPFS_MAX_PATH_LEN];
+  vnode *dir = priv_path_at(thd, AT_FDCWD, pathname, path);
+  if(dir == NULL)
+    return -1;
+  return vfs_unlink_at(dir, path);
+}
+
+// Write cached metadata of file systems back to storage. Return sectors written
+int           sysc_sync(){
+  write_gen_reg(x8, SYSCALL_NUM_SYNC);
+  asm volatile("svc 0");
+  int ret_val = read_gen_reg(x0);
+  return ret_val;
+}
+static int    priv_sync(){
+  return vfs_sync();
+}
+
+// Create a pipe, fds[0] is the read end and fds[1] is the write end. Return 0 on success
+int           sysc_pipe(int fds[2]){
+  write_gen_reg(x8, SYSCALL_NUM_PIPE);
+  write_gen_reg(x0, fds);
+  asm volatile("svc 0");
+  int ret_val = read_gen_reg(x0);
+  return ret_val;
+}
+static int    priv_pipe(int fds[2]){
+  thread_t *thd = thread_get_current();
+  file *rd = NULL, *wr = NULL;
+  const int fd_rd = thread_get_idle_fd(thd);
+  if(fd_rd < 0){
+    uart_printf("Error, priv_pipe(), cannot open more file for pid=%d\r\n", thd->pid);
+    return -1;
+  }
+  thd->fd_table[fd_rd] = (file*)1; // reserve, so next idle fd differs
+  const int fd_wr = thread_get_idle_fd(thd);
+  thd->fd_table[fd_rd] = NULL;
+  if(fd_wr < 0){
+    uart_printf("Error, priv_pipe(), cannot open more file for pid=%d\r\n", thd->pid);
+    return -1;
+  }
+
+  if(pipe_create(&rd, &wr) != 0)
+    return -1;
+  thd->fd_table[fd_rd] = rd;
+  thd->fd_table[fd_wr] = wr;
+  fds[0] = fd_rd;
+  fds[1] = fd_wr;
+  return 0;
+}
+
+// Get the shared memory segment of key, create one of size bytes if there is none. Return id of the segment, -1 on failure
+int           sysc_shm_open(int key, size_t size){
+  write_gen_reg(x8, SYSCALL_NUM_SHM_OPEN);
+  write_gen_reg(x1, size);  // write_gen_reg() seems to use x0 as buffer
+  write_gen_reg(x0, key);   // so write to x0 should be the last one performed
+  asm volatile("svc 0");
+  int ret_val = read_gen_reg(x0);
+  return ret_val;
+}
+static int    priv_shm_open(int key, size_t size){
+  return shm_get_or_create(key, size);
+}
+
+/** Map a segment into current process.
+ * @param va page aligned address to map at, NULL to let kernel choose. Ignored without a page table of the process.
+ * @return address of the segment as seen by the process, NULL on failure
+*/
+void         *sysc_shm_map(int id, void *va){
+  write_gen_reg(x8, SYSCALL_NUM_SHM_MAP);
+  write_gen_reg(x1, va);  // write_gen_reg() seems to use x0 as buffer
+  write_gen_reg(x0, id);  // so write to x0 should be the last one performed
+  asm volatile("svc 0");
+  void *ret_val = (void*)read_gen_reg(x0);
+  return ret_val;
+}
+static uint64_t priv_shm_map(int id, uint64_t va){
+  thread_t *thd = thread_get_current();
+  shm_segment *seg = shm_get(id);
+  if(seg == NULL){
+    uart_printf("Error, priv_shm_map(), unrecognized id=%d, pid=%d\r\n", id, thd->pid);
+    return 0;
+  }
+#ifdef VIRTUAL_MEM
+  // Every mapping holds one reference on each frame, dropped by unmap_pages() or free_page_table()
+  if(thd->ttbr0_el1 != PAGE_TABLE_STATICS_START_ADDR){
+    if(va == 0){
+      va = thd->shm_next_va;
+      thd->shm_next_va += (seg->pages + 1) * PAGE_SIZE; // one unmapped page as guard between mappings
+    }
+    else if(va != PAGE_FLOOR(va)){
+      uart_printf("Error, priv_shm_map(), va=0x%lx is not page aligned, pid=%d\r\n", va, thd->pid);
+      return 0;
+    }
+    map_pages_counted((uint64_t*)thd->ttbr0_el1, va, (uint64_t)seg->addr, seg->pages, MMU_MAP_READ_WRITE);
+    return va;
+  }
+#endif
+  // No page table of its own, the process sees kernel address, counted until sysc_shm_unmap() or exit
+  if(shm_kernel_map(id, thd->shm_maps) != 0){
+    uart_printf("Error, priv_shm_map(), id=%d mapped too many times, pid=%d\r\n", id, thd->pid);
+    return 0;
+  }
+  return (uint64_t)seg->addr;
+}
+
+// Unmap a segment mapped at va by sysc_shm_map(). Return 0 on success
+int           sysc_shm_unmap(int id, void *va){
+  write_gen_reg(x8, SYSCALL_NUM_SHM_UNMAP);
+  write_gen_reg(x1, va);  // write_gen_reg() seems to use x0 as buffer
+  write_gen_reg(x0, id);  // so write to x0 should be the last one performed
+  asm volatile("svc 0");
+  int ret_val = read_gen_reg(x0);
+  return ret_val;
+}
+static int    priv_shm_unmap(int id, uint64_t va){
+  thread_t *thd = thread_get_current();
+  shm_segment *seg = shm_get(id);
+  if(seg == NULL){
+    uart_printf("Error, priv_shm_unmap(), unrecognized id=%d, pid=%d\r\n", id, thd->pid);
+    return -1;
+  }
+#ifdef VIRTUAL_MEM
+  if(thd->ttbr0_el1 != PAGE_TABLE_STATICS_START_ADDR){
+    // Only release pages which really map the segment, va may point anywhere
+    va = PAGE_FLOOR(va);
+    for(size_t i=0; i<seg->pages; i++){
+      uint64_t *pte = page_table_walk((uint64_t*)thd->ttbr0_el1, va + i*PAGE_SIZE, 0);
+      if(pte == NULL || *pte == 0 || ENTRY_GET_PA(*pte) != KERNEL_VA_TO_PA(seg->addr + i*PAGE_SIZE)){
+        uart_printf("Error, priv_shm_unmap(), va=0x%lx does not map id=%d, pid=%d\r\n", va, id, thd->pid);
+        return -1;
+      }
+    }
+    unmap_pages((uint64_t*)thd->ttbr0_el1, va, seg->pages);
+    shm_reap();
+    return 0;
+  }
+#endif
+  if(va != (uint64_t)seg->addr || shm_kernel_unmap(id, thd->shm_maps) != 0){
+    uart_printf("Error, priv_shm_unmap(), va=0x%lx does not map id=%d, pid=%d\r\n", va, id, thd->pid);
+    return -1;
+  }
+  return 0;
+}
+
+// Remove key, so later sysc_shm_open() creates a new segment. Frames are freed after every mapping is gone. Return 0 on success
+int           sysc_shm_unlink(int key){
+  write_gen_reg(x8, SYSCALL_NUM_SHM_UNLINK);
+  write_gen_reg(x0, key);
+  asm volatile("svc 0");
+  int ret_val = read_gen_reg(x0);
+  return ret_val;
+}
+static int    priv_shm_unlink(int key){
+  if(shm_unlink(key) != 0){
+    uart_printf("Error, priv_shm_unlink(), key=%d not found\r\n", key);
+    return -1;
+  }
+  return 0;
+}
+
+/** Send len bytes of buf to process pid, blocks while pid has MSG_QUEUE_MAX messages pending.
+ * With virtual memory, whole pages of a page aligned buf are moved instead of copied, and are unmapped from the sender.
+ * @return len, -1 on failure
+*/
+long          sysc_msg_send(int pid, const void *buf, size_t len){
+  write_gen_reg(x8, SYSCALL_NUM_MSG_SEND);
+  write_gen_reg(x2, len);
+  write_gen_reg(x1, buf);  // write_gen_reg() seems to use x0 as buffer
+  write_gen_reg(x0, pid);  // so write to x0 should be the last one performed
+  asm volatile("svc 0");
+  long ret_val = read_gen_reg(x0);
+  return ret_val;
+}
+static long   priv_msg_send(int pid, const void *buf, size_t len){
+  return msg_send(pid, buf, len);
+}
+
+/** Receive the oldest message, blocks while there is none.
+ * With virtual memory, whole pages of a page aligned buf are replaced by pages of the message.
+ * @param from: set to pid of sender if not NULL
+ * @return bytes received, at most len
+*/
+long          sysc_msg_recv(void *buf, size_t len, int *from){
+  write_gen_reg(x8, SYSCALL_NUM_MSG_RECV);
+  write_gen_reg(x2, from);
+  write_gen_reg(x1, len);  // write_gen_reg() seems to use x0 as buffer
+  write_gen_reg(x0, buf);  // so write to x0 should be the last one performed
+  asm volatile("svc 0");
+  long ret_val = read_gen_reg(x0);
+  return ret_val;
+}
+static long   priv_msg_recv(void *buf, size_t len, int *from){
+  return msg_recv(buf, len, from);
+}
+
+/** Sleep until any of fds is ready for its events, see poll_fds()
+ * @param timeout_ms: 0 to return at once, negative to wait without timeout
+ * @return count of fds with non-zero revents, 0 on timeout
+*/
+int           sysc_poll(pollfd *fds, int nfds, int timeout_ms){
+  write_gen_reg(x8, SYSCALL_NUM_POLL);
+  write_gen_reg(x2, timeout_ms);
+  write_gen_reg(x1, nfds);  // write_gen_reg() seems to use x0 as buffer
+  write_gen_reg(x0, fds);   // so write to x0 should be the last one performed
+  asm volatile("svc 0");
+  int ret_val = read_gen_reg(x0);
+  return ret_val;
+}
+static int    priv_poll(pollfd *fds, int nfds, int timeout_ms){
+  return poll_fds(fds, nfds, timeout_ms);
+}
+
+// Return address of the ring of current process as seen by the process, 0 on failure
+uint64_t      sysc_ring_setup(){
+  write_gen_reg(x8, SYSCALL_NUM_RING_SETUP);
+  asm volatile("svc 0");
+  uint64_t ret_val = read_gen_reg(x0);
+  return ret_val;
+}
+static uint64_t priv_ring_setup(){
+  thread_t *thd = thread_get_current();
+  if(thd->ring == NULL){
+    thd->ring = syscall_ring_create();
+#ifdef VIRTUAL_MEM
+    if(thd->ttbr0_el1 != PAGE_TABLE_STATICS_START_ADDR)
+      map_pages_counted((uint64_t*)thd->ttbr0_el1, SYSCALL_RING_VA, (uint64_t)thd->ring, SYSCALL_RING_PAGES, MMU_MAP_READ_WRITE);
+#endif
+  }
+#ifdef VIRTUAL_MEM
+  if(thd->ttbr0_el1 != PAGE_TABLE_STATICS_START_ADDR)
+    return SYSCALL_RING_VA;
+#endif
+  return (uint64_t)thd->ring;
+}
+
+// Execute one submission entry, return value goes to the completion entry.
+// sqe must be a kernel copy of the entry, see priv_ring_enter()
+static int64_t ring_execute(const ring_sqe *sqe){
+  if(sqe->op != RING_OP_NOP && sqe->op != RING_OP_OPEN && (sqe->fd < 0 || sqe->fd >= VFS_PROCESS_MAX_OPEN_FILE))
+    return -1;
+  switch(sqe->op){
+    case RING_OP_NOP:   return 0;
+    case RING_OP_OPEN:  return priv_open((const char*)sqe->addr, sqe->flags);
+    case RING_OP_READ:  return priv_read(sqe->fd, (void*)sqe->addr, sqe->len);
+    case RING_OP_WRITE: return priv_write(sqe->fd, (const void*)sqe->addr, sqe->len);
+    case RING_OP_LSEEK: return priv_lseek64(sqe->fd, sqe->off, sqe->flags);
+    case RING_OP_CLOSE: return priv_close(sqe->fd);
+    default:
+      uart_printf("Error, ring_execute(), unknown op=%u\r\n", sqe->op);
+      return -1;
+  }
+}
+
+// Return count of submission entries consumed, completion entries are posted for each of them
+int           sysc_ring_enter(unsigned to_submit){
+  write_gen_reg(x8, SYSCALL_NUM_RING_ENTER);
+  write_gen_reg(x0, to_submit);
+  asm volatile("svc 0");
+  int ret_val = read_gen_reg(x0);
+  return ret_val;
+}
+/** Execute up to to_submit entries in the submission ring, in order.
+ * Every operation completes before returning, so the completions are ready for the caller without waiting.
+ * Stops early if the completion ring is full.
+*/
+static int    priv_ring_enter(unsigned to_submit){
+  thread_t *thd = thread_get_current();
+  syscall_ring *ring = thd->ring;
+  if(ring == NULL){
+    uart_printf("Error, priv_ring_enter(), no ring for pid=%d, call sysc_ring_setup() first\r\n", thd->pid);
+    return -1;
+  }
+
+  uint32_t sq_head = ring->sq_head;
+  uint32_t cq_tail = ring->cq_tail;
+  const uint32_t sq_tail = __atomic_load_n(&ring->sq_tail, __ATOMIC_ACQUIRE);
+  const uint32_t cq_head = __atomic_load_n(&ring->cq_head, __ATOMIC_ACQUIRE);
+  unsigned done = 0;
+  while(done < to_submit && sq_head != sq_tail && (cq_tail - cq_head) < SYSCALL_RING_ENTRIES){
+    // The ring stays writable by the process, so the entry is read once, then checked and executed from the copy
+    ring_sqe sqe;
+    memcpy_(&sqe, &ring->sqes[sq_head & (SYSCALL_RING_ENTRIES - 1)], sizeof(ring_sqe));
+    ring_cqe *cqe = &ring->cqes[cq_tail & (SYSCALL_RING_ENTRIES - 1)];
+    cqe->user_data = sqe.user_data;
+    cqe->res = ring_execute(&sqe);
+    sq_head++;
+    cq_tail++;
+    done++;
+  }
+  __atomic_store_n(&ring->sq_head, sq_head, __ATOMIC_RELEASE);
+  __atomic_store_n(&ring->cq_tail, cq_tail, __ATOMIC_RELEASE);
+  return done;
+}
+
 #endif
\ No newline at end of file
@@ -5,6 +5,9 @@
 #include "timer.h"
 #include "diy_string.h"
 #include "virtual_file_system.h"
+#include "mmu.h"
+#include "shm.h"
+#include "msg.h"
 
 #ifdef THREADS  // pass -DTHREADS to compiler for lab5
 
@@ -24,6 +27,7 @@ static int pid_count = PID_KERNEL_MAIN;        // 0 for main() from kernel, who
 static thread_t *run_q_head = NULL;   // run queue, .state = WAIT_TO_RUN
 static thread_t *run_q_tail = NULL;
 static thread_t *exited_ll_head = NULL;   // exited linked list, .state = EXITED, waiting to be cleaned
+static thread_t *all_head = NULL;         // all threads not exited yet, linked by .all_next
 static void run_q_insert_tail(thread_t *thd){
   if(thd == run_q_tail){
     uart_printf("Exception, in run_q_insert_tail(), thd == run_q_tail, pid=%d\r\n", thd->pid);
@@ -66,6 +70,13 @@ static void exited_ll_insert_head(thread_t *thd){
     exited_ll_head = thd;
   }
 }
+static void all_remove(thread_t *thd){
+  thread_t **link = &all_head;
+  while(*link != NULL && *link != thd)
+    link = &(*link)->all_next;
+  if(*link != NULL)
+    *link = thd->all_next;
+}
 static void threads_dump(thread_t *head){
   thread_t *thd = head;
   const uint64_t stack_grows = (uint64_t)thd->allocated_addr + DEFAULT_THREAD_SIZE - thd->sp;
@@ -92,11 +103,21 @@ static void clean_exited(){
         uart_printf("Exception, in clean_exited(), thd.mode=USER but thd.user_space=NULL\r\n");
     }
 
+#ifdef VIRTUAL_MEM
+    // Release page table of the process, kernel threads use the static one
+    if(thd->ttbr0_el1 != PAGE_TABLE_STATICS_START_ADDR)
+      free_page_table((uint64_t*)thd->ttbr0_el1);
+#endif
+    shm_kernel_release(thd->shm_maps); // also reaps segments mapped by the process, which may be gone now
+
     // Close opened files
     for(int i=0; i<VFS_PROCESS_MAX_OPEN_FILE; i++){
       if(thd->fd_table[i] != NULL)
         vfs_close(thd->fd_table[i]);
     }
+    vdso_release(thd->vdso);
+    syscall_ring_release(thd->ring);
+    msg_queue_release(thd->mq);
 
     thd = thd->next;
     diy_free(temp);
@@ -138,6 +159,7 @@ void start_scheduling(){
   core_timer_state(1);
 
   // Jumps to idle(), never return
+  thread_set_vdso(thd);
   go_to_thread(thd);
   uart_printf("Exception, in start_scheduling(), should not get here\r\n");
 }
@@ -151,6 +173,7 @@ void idle(){
 
 void thread_init(){
   pid_count = PID_IDLE;
+  vdso_init();
   thread_create(idle, KERNEL);
 }
 
@@ -163,6 +186,14 @@ thread_t *thread_get_current(){
   return (thread_t*) value;
 }
 
+// Return thread of pid, NULL if there is no such thread or it has exited
+thread_t *thread_find(int pid){
+  thread_t *thd = all_head;
+  while(thd != NULL && thd->pid != pid)
+    thd = thd->all_next;
+  return thd;
+}
+
 thread_t *thread_create(void *func, enum task_exeception_level mode){
   if(pid_count == PID_KERNEL_MAIN){
     uart_printf("Error, in thread_create(), failed to create thread, please call thread_init() first.\r\n");
@@ -204,6 +235,7 @@ thread_t *thread_create(void *func, enum task_exeception_level mode){
   // Init parameters for virtual file system
   thd_new->cwd[0] = '\0'; // clear string
   strcpy_(thd_new->cwd, "/"); // should copy parent's cwd if there is a parent (but failed on HW)
+  thd_new->cwd_node = NULL;
   memset_(thd_new->fd_table, 0, sizeof(thd_new->fd_table)); // init file table
 
   // Open stdin, stdout, stderr for the process
@@ -212,8 +244,18 @@ thread_t *thread_create(void *func, enum task_exeception_level mode){
   vfs_open("/dev/uart", 0, &fh);  thd_new->fd_table[FD_STDOUT] = fh;
   vfs_open("/dev/uart", 0, &fh);  thd_new->fd_table[FD_STDERR] = fh;
 
+  thd_new->vdso = vdso_create(thd_new->pid, thd_new->ppid);
+  thd_new->ring = NULL;
+  thd_new->mq = NULL;
+  thd_new->wq = NULL;
+  memset_(thd_new->shm_maps, 0, sizeof(thd_new->shm_maps));
+  thd_new->all_next = all_head;
+  all_head = thd_new;
+
 #ifdef VIRTUAL_MEM
   thd_new->ttbr0_el1 = read_sysreg(ttbr0_el1);
+  thd_new->zero_area_cnt = 0;
+  thd_new->shm_next_va = SHM_VA_START;
 #endif
   run_q_insert_tail(thd_new);
   pid_count++;
@@ -240,15 +282,26 @@ void schedule(){
   if(thd_next == NULL && thd_now->pid == 1)
     return;
 
+  // Other states, e.g. WAITING or EXITED, are kept, the thread is already on its queue
   if(thd_now->state == RUNNNING){
     run_q_insert_tail(thd_now);
+    thd_now->state = WAIT_TO_RUN;
   }
-
-  thd_now->state = WAIT_TO_RUN;
   thd_next->state = RUNNNING;
+  thread_set_vdso(thd_next);
   switch_to(thd_now, thd_next);
 }
 
+// Let tpidrro_el0 point to the data page of thd, as seen from el0 of thd
+void thread_set_vdso(thread_t *thd){
+  uint64_t addr = (uint64_t)thd->vdso;
+#ifdef VIRTUAL_MEM
+  if(thd->ttbr0_el1 != PAGE_TABLE_STATICS_START_ADDR)
+    addr = VDSO_VA; // process with its own page table, see exec_from_kernel_to_user_vm()
+#endif
+  write_sysreg(tpidrro_el0, addr);
+}
+
 void r_q_dump(){
   threads_dump(run_q_head);
 }
@@ -260,38 +313,76 @@ void exit_call_by_syscall_only(){
   thread_t *thd = thread_get_current();
   // current thread is not in run queue, so no need to remove it from run queue
   thd->state = EXITED;
+  all_remove(thd);
+  msg_queue_close(thd->mq);
   exited_ll_insert_head(thd);
   schedule();
 }
 
-int kill_call_by_syscall_only(int pid){
-  thread_t *thd = run_q_head;
+// Unlink thd from the singly linked list at *head, return 1 if found
+static int list_remove(thread_t **head, thread_t *thd, thread_t **tail){
   thread_t *prev = NULL;
-
-  // Search pid in run queue
-  while(thd != NULL){
-    if(thd->pid == pid)
-      break;
-    prev = thd;
-    thd = thd->next;
+  thread_t **link = head;
+  while(*link != NULL && *link != thd){
+    prev = *link;
+    link = &(*link)->next;
   }
+  if(*link == NULL)
+    return 0;
+  *link = thd->next;
+  if(tail != NULL && *tail == thd)
+    *tail = prev;
+  return 1;
+}
 
-  if(thd == NULL){
+/** Terminate thread of pid, waiting to run or blocked on a wait_queue.
+ * @return 0 on success, -1 if pid is not found, idle, or the current thread
+*/
+int kill_call_by_syscall_only(int pid){
+  thread_t *thd = thread_find(pid);
+  if(thd == NULL || pid == PID_IDLE || thd == thread_get_current())
+    return -1;
+
+  // Take it out of the queue it is on
+  if(thd->state == WAITING)
+    list_remove(&thd->wq->head, thd, NULL);
+  else if(!list_remove(&run_q_head, thd, &run_q_tail)){
+    uart_printf("Exception, kill_call_by_syscall_only(), pid=%d state=%d but not in run queue\r\n", pid, thd->state);
     return -1;
   }
 
-  // Remove pid from run quue
   thd->state = EXITED;
-  if(run_q_tail == thd)       // pid is the end of run queue
-    run_q_tail = prev;
-  if(prev != NULL)            // pid in the middle of run queue
-    prev->next = thd->next;
-  else // prev == NULL        // pid is the head of run queue
-    run_q_head = thd->next;
-
+  thd->wq = NULL;
+  all_remove(thd);
+  msg_queue_close(thd->mq);
   exited_ll_insert_head(thd);
+  return 0;
+}
 
-  return 0;  
+/** Block current thread on wq until thread_wake_all(wq). Call in el1 only, e.g. in a system call.
+ * Callers should re-check their condition after return, since every waiter is woken up.
+*/
+void thread_wait(wait_queue *wq){
+  thread_t *thd = thread_get_current();
+  thd->state = WAITING;
+  thd->wq = wq;
+  thd->next = wq->head;
+  wq->head = thd;
+  schedule();
+}
+
+// Move all threads blocked on wq back to run queue
+void thread_wake_all(wait_queue *wq){
+  thread_t *thd = wq->head;
+  thread_t *next = NULL;
+  wq->head = NULL;
+  while(thd != NULL){
+    next = thd->next;
+    thd->state = WAIT_TO_RUN;
+    thd->wq = NULL;
+    run_q_insert_tail(thd);
+    thd = next;
+  }
 }
 
 int thread_get_idle_fd(thread_t *thd){
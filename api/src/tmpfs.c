@@ -3,13 +3,230 @@
 #include "uart.h"
 #include "diy_string.h"
 #include "diy_malloc.h"
+#include "diy_printf.h"
+#include "dcache.h"
+#include "sys_reg.h"
 
 
 filesystem tmpfs = {.name="tmpfs", .setup_mount=tmpfs_setup_mount};
-file_operations tmpfs_fops = {.write=tmpfs_write, .read=tmpfs_read, .open=tmpfs_open, .close=tmpfs_close};
-vnode_operations tmpfs_vops = {.lookup=tmpfs_lookup, .create=tmpfs_create, .mkdir=tmpfs_mkdir};
+file_operations tmpfs_fops = {.write=tmpfs_write, .read=tmpfs_read, .open=tmpfs_open, .close=tmpfs_close, .lseek64=tmpfs_lseek64};
+vnode_operations tmpfs_vops = {.lookup=tmpfs_lookup, .create=tmpfs_create, .mkdir=tmpfs_mkdir, .unlink=tmpfs_unlink};
 
 
+static void *tmpfs_zalloc(size_t size){
+  void *p = diy_malloc(size);
+  if(p != NULL)
+    memset_(p, 0, size);
+  return p;
+}
+
+/** Allocate a vnode together with its component and name, everything else is zeroed.
+ * Lookups then find vnode, comp and a short name in one chunk instead of three.
+ * Names shorter than TMPFS_INLINE_NAME are kept inline, longer ones get their own allocation.
+*/
+vnode *tmpfs_node_alloc(const char *name){
+  return tmpfs_node_alloc_size(name, sizeof(tmpfs_entry));
+}
+
+// Same as tmpfs_node_alloc(), for file systems which keep more after the tmpfs_entry, size >= sizeof(tmpfs_entry)
+vnode *tmpfs_node_alloc_size(const char *name, size_t size){
+  tmpfs_entry *entry = tmpfs_zalloc(size);
+  if(entry == NULL){
+    uart_printf("Error, tmpfs_node_alloc(), out of memory, name=%s\r\n", name);
+    return NULL;
+  }
+  const size_t len = strlen_(name);
+  entry->node.comp = &entry->comp;
+  entry->comp.comp_name = len < TMPFS_INLINE_NAME ? entry->name : diy_malloc(len + 1);
+  memcpy_(entry->comp.comp_name, name, len + 1);
+  return &entry->node;
+}
+
+// Radix tree of file pages ----------------------------
+
+// Pages addressable by a tree of height levels
+static size_t tmpfs_pages_span(int height){
+  return (size_t)1 << (TMPFS_RADIX_BITS * height);
+}
+
+/** Find page index of a file.
+ * @param create: 1 to allocate missing nodes and a zeroed page, 0 to only look up
+ * @return kernel address of the page, NULL for a hole or if the page cannot be allocated
+*/
+static uint8_t *tmpfs_page_get(tmpfs_pages *pages, size_t index, int create){
+
+  // Grow the tree from the top until index fits, old root becomes the first slot of the new one
+  while(index >= tmpfs_pages_span(pages->height)){
+    if(!create || pages->height >= TMPFS_RADIX_MAX_HEIGHT)
+      return NULL;
+    if(pages->root != NULL){
+      radix_node *node = tmpfs_zalloc(sizeof(radix_node));
+      if(node == NULL) return NULL;
+      node->slots[0] = pages->root;
+      pages->root = node;
+    }
+    pages->height++;
+  }
+
+  void **slot = &pages->root;
+  for(int h=pages->height; h>0; h--){
+    if(*slot == NULL){
+      if(!create || (*slot = tmpfs_zalloc(sizeof(radix_node))) == NULL)
+        return NULL;
+    }
+    slot = &((radix_node*)*slot)->slots[(index >> (TMPFS_RADIX_BITS * (h-1))) & (TMPFS_RADIX_SLOTS-1)];
+  }
+  if(*slot == NULL){
+    if(!create || (*slot = tmpfs_zalloc(PAGE_SIZE)) == NULL)
+      return NULL;
+    pages->page_cnt++;
+  }
+  return *slot;
+}
+
+static void tmpfs_radix_free(void *node, int height){
+  if(node == NULL)
+    return;
+  if(height > 0){
+    for(int i=0; i<TMPFS_RADIX_SLOTS; i++)
+      tmpfs_radix_free(((radix_node*)node)->slots[i], height-1);
+  }
+  diy_free(node);
+}
+
+/** Move data of a tiny file from comp->inline_data to pages, it shares storage with comp->pages
+ * @return 0 on success, 1 if out of memory, the file is left inline
+*/
+static int tmpfs_data_promote(vnode_comp *comp){
+  char tiny[VFS_INLINE_DATA];
+  tmpfs_pages *pages = tmpfs_zalloc(sizeof(tmpfs_pages));
+  uint8_t *page = NULL;
+  if(pages == NULL || (comp->len > 0 && (page = tmpfs_page_get(pages, 0, 1)) == NULL)){
+    tmpfs_pages_release(pages);
+    uart_printf("Error, tmpfs_data_promote(), out of memory, node_name=%s\r\n", comp->comp_name);
+    return 1;
+  }
+  memcpy_(tiny, comp->inline_data, comp->len);
+  if(page != NULL)
+    memcpy_(page, tiny, comp->len);
+  comp->pages = pages;
+  comp->data_paged = 1;
+  return 0;
+}
+
+// Free every page of a file and the tree itself
+void tmpfs_pages_release(tmpfs_pages *pages){
+  if(pages == NULL)
+    return;
+  tmpfs_radix_free(pages->root, pages->height);
+  diy_free(pages);
+}
+
+
+static uint32_t dir_name_hash(const char *name){
+  uint32_t hash = DCACHE_HASH_INIT;
+  while(*name != '\0')
+    hash = dcache_hash_step(hash, *name++);
+  return hash;
+}
+
+// Return entry named name under dir, NULL if not found
+static vnode *dir_find(const vnode_comp *dir, const char *name, uint32_t hash){
+  const dir_index *index = dir->index;
+  if(index == NULL)
+    return NULL;
+  const size_t mask = index->slot_cnt - 1;
+  for(size_t i = hash & mask; index->slots[i].node != NULL; i = (i + 1) & mask){
+    if(index->slots[i].hash == hash && strcmp_(name, index->slots[i].node->comp->comp_name) == 0)
+      return index->slots[i].node;
+  }
+  return NULL;
+}
+
+static void dir_slot_insert(dir_index *index, vnode *node, uint32_t hash){
+  const size_t mask = index->slot_cnt - 1;
+  size_t i = hash & mask;
+  while(index->slots[i].node != NULL)
+    i = (i + 1) & mask;
+  index->slots[i].hash = hash;
+  index->slots[i].node = node;
+}
+
+// Take the slot of node out of index, later slots of the same cluster move back so no probe stops early
+static void dir_slot_remove(dir_index *index, const vnode *node, uint32_t hash){
+  const size_t mask = index->slot_cnt - 1;
+  size_t hole = hash & mask;
+  while(index->slots[hole].node != node)
+    hole = (hole + 1) & mask;
+  for(size_t i = (hole + 1) & mask; index->slots[i].node != NULL; i = (i + 1) & mask){
+    const size_t home = index->slots[i].hash & mask;
+    if(hole <= i ? (hole < home && home <= i) : (hole < home || home <= i))
+      continue;   // home is after the hole, the slot is reached without passing it
+    index->slots[hole] = index->slots[i];
+    hole = i;
+  }
+  index->slots[hole].node = NULL;
+  index->slots[hole].hash = 0;
+}
+
+// Count of entries in dir, without those removed
+static size_t dir_live(const vnode_comp *dir){
+  return dir->index == NULL ? 0 : dir->len - dir->index->removed;
+}
+
+// Squeeze removed entries out of dir, only when no handle is listing it, since they use index of entries as cookie
+static void dir_compact(vnode_comp *dir){
+  dir_index *index = dir->index;
+  if(index == NULL || index->removed == 0 || dir->dir_handles > 0)
+    return;
+  size_t n = 0;
+  for(size_t i=0; i<dir->len; i++){
+    if(dir->entries[i] != NULL)
+      dir->entries[n++] = dir->entries[i];
+  }
+  dir->len = n;
+  index->removed = 0;
+}
+
+// Append node to entries of dir, both entries and slots are doubled when full, so it's O(1) amortized
+static void dir_add(vnode_comp *dir, vnode *node, uint32_t hash){
+  dir_compact(dir);
+  dir_index *index = dir->index;
+  if(index == NULL){
+    index = diy_malloc(sizeof(dir_index));
+    index->cap = TMPFS_DIR_MIN_ENTRY;
+    index->slot_cnt = TMPFS_DIR_MIN_ENTRY * 2;
+    index->slots = diy_malloc(sizeof(dir_slot) * index->slot_cnt);
+    memset_(index->slots, 0, sizeof(dir_slot) * index->slot_cnt);
+    index->removed = 0;
+    dir->entries = diy_malloc(sizeof(vnode*) * index->cap);
+    dir->len = 0;
+    dir->index = index;
+  }
+
+  if(dir->len >= index->cap){
+    vnode **entries = diy_malloc(sizeof(vnode*) * index->cap * 2);
+    memcpy_(entries, dir->entries, sizeof(vnode*) * dir->len);
+    diy_free(dir->entries);
+    dir->entries = entries;
+    index->cap *= 2;
+  }
+
+  if((dir->len + 1) * 2 > index->slot_cnt){
+    diy_free(index->slots);
+    index->slot_cnt *= 2;
+    index->slots = diy_malloc(sizeof(dir_slot) * index->slot_cnt);
+    memset_(index->slots, 0, sizeof(dir_slot) * index->slot_cnt);
+    for(size_t i=0; i<dir->len; i++){
+      if(dir->entries[i] != NULL)
+        dir_slot_insert(index, dir->entries[i], dir_name_hash(dir->entries[i]->comp->comp_name));
+    }
+  }
+
+  dir->entries[dir->len++] = node;
+  dir_slot_insert(index, node, hash);
+}
+
 int tmpfs_write(file *file, const void *buf, size_t len){
 
   // Return on null pointers
@@ -35,26 +252,40 @@ int tmpfs_write(file *file, const void *buf, size_t len){
     return 2;
   }
 
-  // Reallocate new space if current size is not big enough
-  const size_t ideal_final_pos = file->f_pos + len;
-  if(ideal_final_pos > comp->len && comp->len < TMPFS_MAX_FILE_SIZE){
-    size_t new_len = ideal_final_pos >= TMPFS_MAX_FILE_SIZE ? TMPFS_MAX_FILE_SIZE : ideal_final_pos;
-    new_len = new_len > TMPFS_MAX_FILE_SIZE ? TMPFS_MAX_FILE_SIZE : new_len;  // truncate to TMPFS_MAX_FILE_SIZE
-    char *new_space = diy_malloc(sizeof(char) * new_len);
-    if(comp->len > 0){
-      memcpy_(new_space, comp->data, comp->len);
-      memset_(new_space+comp->len, 0, new_len - comp->len); // clear the rest
-      memset_(comp->data, 0, comp->len);                    // clear before free
-      diy_free(comp->data);
+  // Nothing can be written beyond the max size
+  if(file->f_pos >= TMPFS_MAX_FILE_SIZE)
+    return 0;
+  const size_t wrtie_able = file->f_pos + len > TMPFS_MAX_FILE_SIZE ? (TMPFS_MAX_FILE_SIZE - file->f_pos) : len;
+
+  // Tiny files stay in comp itself, and move to pages once they grow past VFS_INLINE_DATA
+  if(!comp->data_paged){
+    if(file->f_pos + wrtie_able <= VFS_INLINE_DATA){
+      memcpy_(comp->inline_data + file->f_pos, buf, wrtie_able);
+      file->f_pos += wrtie_able;
+      if(file->f_pos > comp->len)
+        comp->len = file->f_pos;
+      return wrtie_able;
     }
-    comp->len = new_len;
-    comp->data = new_space;
+    if(tmpfs_data_promote(comp) != 0)
+      return 0;
   }
 
-  const size_t wrtie_able = ideal_final_pos >= TMPFS_MAX_FILE_SIZE ? (TMPFS_MAX_FILE_SIZE-file->f_pos) : len;
-  memcpy_(comp->data + file->f_pos, buf, wrtie_able);
-  file->f_pos += wrtie_able;
-  return wrtie_able;
+  // Only pages covering [f_pos, f_pos+len) are touched, the rest of the file is left as is
+  size_t done = 0;
+  while(done < wrtie_able){
+    const size_t pos = file->f_pos + done;
+    const size_t offset = pos % PAGE_SIZE;
+    const size_t chunk = (PAGE_SIZE - offset) < (wrtie_able - done) ? (PAGE_SIZE - offset) : (wrtie_able - done);
+    uint8_t *page = tmpfs_page_get(comp->pages, pos / PAGE_SIZE, 1);
+    if(page == NULL)
+      break;
+    memcpy_(page + offset, (const uint8_t*)buf + done, chunk);
+    done += chunk;
+  }
+  file->f_pos += done;
+  if(file->f_pos > comp->len)
+    comp->len = file->f_pos;
+  return done;
 }
 int tmpfs_read(file *file, void *buf, size_t len){
 
@@ -81,9 +312,27 @@ int tmpfs_read(file *file, void *buf, size_t len){
     return 2;
   }
 
+  if(file->f_pos >= comp->len)
+    return 0;  // end of file
   const size_t ideal_final_pos = file->f_pos + len;
   const size_t read_able = ideal_final_pos >= comp->len ? (comp->len - file->f_pos) : len;
-  memcpy_(buf, comp->data, read_able);
+  if(!comp->data_paged){
+    memcpy_(buf, comp->inline_data + file->f_pos, read_able);
+    file->f_pos += read_able;
+    return read_able;
+  }
+  size_t done = 0;
+  while(done < read_able){
+    const size_t pos = file->f_pos + done;
+    const size_t offset = pos % PAGE_SIZE;
+    const size_t chunk = (PAGE_SIZE - offset) < (read_able - done) ? (PAGE_SIZE - offset) : (read_able - done);
+    const uint8_t *page = comp->pages == NULL ? NULL : tmpfs_page_get(comp->pages, pos / PAGE_SIZE, 0);
+    if(page == NULL)
+      memset_((uint8_t*)buf + done, 0, chunk);  // hole
+    else
+      memcpy_((uint8_t*)buf + done, page + offset, chunk);
+    done += chunk;
+  }
   file->f_pos += read_able;
   return read_able;
 }
@@ -103,6 +352,25 @@ int tmpfs_open(vnode *file_node, file **file_handle){
   (*file_handle)->vnode = file_node;
   return 0;
 }
+/** Move f_pos of file, also used by file systems which keep file size in comp->len
+ * @return the new f_pos, -1 on unknown whence or negative position
+*/
+long tmpfs_lseek64(file *file, long offset, int whence){
+  long pos = 0;
+  if     (whence == SEEK_SET) pos = offset;
+  else if(whence == SEEK_CUR) pos = (long)file->f_pos + offset;
+  else if(whence == SEEK_END) pos = (long)file->vnode->comp->len + offset;
+  else{
+    uart_printf("Error, tmpfs_lseek64(), unknown whence=%d\r\n", whence);
+    return -1;
+  }
+  if(pos < 0){
+    uart_printf("Error, tmpfs_lseek64(), negative position=%ld\r\n", pos);
+    return -1;
+  }
+  file->f_pos = (size_t)pos;
+  return pos;
+}
 int tmpfs_close(file *file){
   if(file == NULL){
     uart_printf("Error, tmpfs_close(), file=NULL\r\n");
@@ -117,13 +385,12 @@ int tmpfs_setup_mount(struct filesystem *fs, mount *mount){
   if(mount == NULL){
     uart_printf("Error, tmpfs_setup_mount(), NULL pointer.");
   }
-  mount->root = diy_malloc(sizeof(vnode));
+  mount->root = tmpfs_node_alloc("");
   mount->fs = fs;
   mount->root->mount = NULL;
-  mount->root->comp = diy_malloc(sizeof(vnode_comp));
-  mount->root->comp->comp_name = "";
   mount->root->comp->len = 0;
   mount->root->comp->entries = NULL;
+  mount->root->comp->index = NULL;
   mount->root->comp->type = COMP_DIR;
   mount->root->f_ops = &tmpfs_fops;
   mount->root->v_ops = &tmpfs_vops;
@@ -159,30 +426,19 @@ int tmpfs_create(vnode *dir_node, vnode **target, const char *component_name){
   }
   
   // Return if already exist
-  vnode *entry = NULL;
-  for(size_t i=0; i<dir_node->comp->len; i++){
-    entry = dir_node->comp->entries[i];
-    if(strcmp_(component_name, entry->comp->comp_name) == 0){
-      uart_printf("Warning, tmpfs_create(), %s already exist under %s, entry=0x%lX, dir_node=0x%lX, \r\n",
-        component_name, dir_node->comp->comp_name, (uint64_t)entry, (uint64_t)dir_node);
-      *target = entry;
-      return 1;
-    }
-  }
-
-  // Return if TMPFS_MAX_ENTRY already created
-  if(dir_node->comp->len >= TMPFS_MAX_ENTRY){
-    uart_printf("Error, tmpfs_create(), failed creating %s, no more entry allowed\r\n", component_name);
+  const uint32_t hash = dir_name_hash(component_name);
+  vnode *entry = dir_find(dir_node->comp, component_name, hash);
+  if(entry != NULL){
+    uart_printf("Warning, tmpfs_create(), %s already exist under %s, entry=0x%lX, dir_node=0x%lX, \r\n",
+      component_name, dir_node->comp->comp_name, (uint64_t)entry, (uint64_t)dir_node);
+    *target = entry;
     return 1;
   }
   
   // Create vnode, note that type is not specified here
-  *target = diy_malloc(sizeof(vnode));
-  (*target)->comp = diy_malloc(sizeof(vnode_comp));
-  (*target)->comp->comp_name = diy_malloc(strlen_(component_name));
-  strcpy_((*target)->comp->comp_name, component_name);
-  (*target)->comp->data = NULL;
-  (*target)->comp->len = 0;
+  *target = tmpfs_node_alloc(component_name);
+  if(*target == NULL)
+    return 3;
   
   // Inherit from dir node
   (*target)->f_ops = dir_node->f_ops;
@@ -190,10 +446,67 @@ int tmpfs_create(vnode *dir_node, vnode **target, const char *component_name){
   (*target)->mount = NULL; // no mount point
   
   // Update dir node
-  if(dir_node->comp->entries == NULL) dir_node->comp->entries = diy_malloc(sizeof(vnode*) * TMPFS_MAX_ENTRY);
-  dir_node->comp->entries[dir_node->comp->len] = *target;
-  dir_node->comp->len++;
+  dir_add(dir_node->comp, *target, hash);
+  return 0;
+}
+/** Add node made by tmpfs_node_alloc() under dir_node, for file systems which create entries themselves
+ * @return 0 on success, 1 if an entry of the same name exists
+*/
+int tmpfs_link(vnode *dir_node, vnode *node){
+  const uint32_t hash = dir_name_hash(node->comp->comp_name);
+  if(dir_find(dir_node->comp, node->comp->comp_name, hash) != NULL){
+    uart_printf("Error, tmpfs_link(), %s already exist under %s\r\n", node->comp->comp_name, dir_node->comp->comp_name);
+    return 1;
+  }
+  dir_add(dir_node->comp, node, hash);
+  return 0;
+}
+/** Remove the entry named component_name from dir_node, a directory has to be empty.
+ * While dir_node is open with O_DIRECTORY, the entry leaves NULL in its place, so cookies of vfs_getdents() stay
+ * valid, and entries are compacted by a later tmpfs_link() or tmpfs_unlink() once no handle is open.
+ * Only data of the entry is released. Its vnode, and its name if longer than TMPFS_INLINE_NAME, are leaked on purpose:
+ * open handles, cwd_node of threads and the dcache may still point to it, and vnodes have no reference count.
+ * @return 0 on success, 1 if not found, 2 if it is a mount point or a directory not empty
+*/
+int tmpfs_unlink(vnode *dir_node, const char *component_name){
+  vnode_comp *dir = dir_node->comp;
+  if(dir->type != COMP_DIR){
+    uart_printf("Error, tmpfs_unlink(), failed removing %s, dir_node_name=%s, type=%d, not folder\r\n",
+      component_name, dir->comp_name, dir->type);
+    return 2;
+  }
+  const uint32_t hash = dir_name_hash(component_name);
+  vnode *entry = dir_find(dir, component_name, hash);
+  if(entry == NULL)
+    return 1;
+  vnode_comp *comp = entry->comp;
+  if(entry->mount != NULL || (comp->type == COMP_DIR && dir_live(comp) > 0)){
+    uart_printf("Error, tmpfs_unlink(), %s under %s is a mount point or a directory not empty\r\n", component_name, dir->comp_name);
+    return 2;
+  }
 
+  // Entries keep their order for listing
+  dir_slot_remove(dir->index, entry, hash);
+  size_t i = 0;
+  while(dir->entries[i] != entry)
+    i++;
+  dir->entries[i] = NULL;
+  dir->index->removed++;
+  dir_compact(dir);
+
+  if(comp->type == COMP_DIR && comp->index != NULL){
+    diy_free(comp->entries);
+    diy_free(comp->index->slots);
+    diy_free(comp->index);
+    comp->entries = NULL;
+    comp->index = NULL;
+  }
+  else if(comp->type == COMP_FILE && comp->data_paged){
+    tmpfs_pages_release(comp->pages);
+    comp->pages = NULL;
+    comp->data_paged = 0;
+  }
+  comp->len = 0;
   return 0;
 }
 int tmpfs_lookup(vnode *dir_node, vnode **target, const char *component_name){
@@ -205,18 +518,77 @@ int tmpfs_lookup(vnode *dir_node, vnode **target, const char *component_name){
     return 2;
   }
 
-  vnode *entry = NULL;
-  for(size_t i=0; i<dir_node->comp->len; i++){
-    entry = dir_node->comp->entries[i];
-    if(strcmp_(component_name, entry->comp->comp_name) == 0){
-      *target = entry->mount == NULL ? entry : (entry->mount->root);
-      return 0;
-    }
+  vnode *entry = dir_find(dir_node->comp, component_name, dir_name_hash(component_name));
+  if(entry == NULL)
+    return 1; // not found under dir_node
+  *target = entry->mount == NULL ? entry : (entry->mount->root);
+  return 0;
+}
+
+// Time to create n files in one directory, and to look each of them up
+void tmpfs_dir_bench(int n){
+  const char *dir_path = "/dir_bench";
+  char path[TMPFS_MAX_PATH_LEN];
+  vnode *dir = NULL, *node = NULL;
+  file *fh = NULL;
+  int found = 0;
+
+  if(vfs_lookup((char*)dir_path, &dir) != 0 && vfs_mkdir((char*)dir_path) != 0)
+    return;
+  vfs_lookup((char*)dir_path, &dir);
+  const size_t len_before = dir->comp->len;
+
+  const uint64_t t0 = read_sysreg(cntpct_el0);
+  for(int i=0; i<n; i++){
+    sprintf_(path, "%s/f%d", dir_path, i);
+    if(vfs_open(path, O_CREAT, &fh) == 0)
+      vfs_close(fh);
+  }
+  const uint64_t t1 = read_sysreg(cntpct_el0);
+  for(int i=0; i<n; i++){
+    sprintf_(path, "f%d", i);
+    if(tmpfs_lookup(dir, &node, path) == 0)
+      found++;
   }
+  const uint64_t t2 = read_sysreg(cntpct_el0);
 
-  // not found under dir_node
-  return 1;
+  const uint64_t freq = read_sysreg(cntfrq_el0);
+  uart_printf("%s: %lu entries before, %lu after, create %d in %lu us, lookup %d found in %lu us\r\n",
+    dir_path, len_before, dir->comp->len, n, (t1 - t0) * 1000000 / freq, found, (t2 - t1) * 1000000 / freq);
+  uart_printf("%lu bytes per entry of name shorter than %d, in one diy_malloc() chunk\r\n",
+    (sizeof(tmpfs_entry) + sizeof(uint64_t) + 8) & ~(size_t)7, TMPFS_INLINE_NAME);  // chunk header and round up as diy_malloc()
 }
 
+// Write a page at growing offsets up to 1 GB, then read back data and a hole
+void tmpfs_sparse_bench(){
+  const char *path = "/sparse_bench";
+  static uint8_t buf[PAGE_SIZE];
+  file *fh = NULL;
+  int bad = 0;
 
+  if(vfs_open((char*)path, O_CREAT, &fh) != 0)
+    return;
+  const uint64_t t0 = read_sysreg(cntpct_el0);
+  for(size_t pos=PAGE_SIZE; pos<=((size_t)1 << 30); pos<<=1){
+    memset_(buf, (uint8_t)(pos >> 12), PAGE_SIZE);
+    tmpfs_lseek64(fh, pos, SEEK_SET);
+    if(vfs_write(fh, buf, PAGE_SIZE) != PAGE_SIZE)
+      bad++;
+  }
+  const uint64_t t1 = read_sysreg(cntpct_el0);
+  for(size_t pos=PAGE_SIZE; pos<=((size_t)1 << 30); pos<<=1){
+    tmpfs_lseek64(fh, pos, SEEK_SET);
+    if(vfs_read(fh, buf, PAGE_SIZE) != PAGE_SIZE || buf[0] != (uint8_t)(pos >> 12) || buf[PAGE_SIZE-1] != (uint8_t)(pos >> 12))
+      bad++;
+  }
+  tmpfs_lseek64(fh, 0, SEEK_SET);
+  if(vfs_read(fh, buf, PAGE_SIZE) != PAGE_SIZE || buf[0] != 0 || buf[PAGE_SIZE-1] != 0)
+    bad++;  // page 0 is a hole
+  const uint64_t t2 = read_sysreg(cntpct_el0);
 
+  const tmpfs_pages *pages = fh->vnode->comp->pages;
+  const uint64_t freq = read_sysreg(cntfrq_el0);
+  uart_printf("%s: size=%lu, %lu pages allocated, tree height=%d, write in %lu us, read in %lu us, %d corrupted\r\n",
+    path, fh->vnode->comp->len, pages->page_cnt, pages->height, (t1 - t0) * 1000000 / freq, (t2 - t1) * 1000000 / freq, bad);
+  vfs_close(fh);
+}
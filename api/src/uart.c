@@ -160,6 +160,22 @@ int uart_gets_n(int n, char *str, int echo){
   }
 }
 
+// Return 1 if a byte is waiting in rx FIFO, so uart_read_byte() does not block
+int uart_rx_ready(){
+  return *AUX_MU_LSR & 0x01;
+}
+
+// Raise interrupt once a byte is received. Unlike uart_rx_tx_handler(), the byte is left in FIFO for the reader
+void uart_rx_irq_arm(){
+  _enable_rx_interrupt();
+  _enable_uart_interrupt();
+}
+
+// Stop the interrupt armed by uart_rx_irq_arm(), rx interrupt keeps firing while FIFO is not empty otherwise
+void uart_rx_irq_disarm(){
+  _disable_rx_interrupt();
+}
+
 void _putchar(char character){
   uart_send(character);
 }
@@ -0,0 +1,70 @@
+#include "vdso.h"
+#include "diy_malloc.h"
+#include "diy_string.h"
+#include "system_call.h"
+#include "sys_reg.h"
+#include "uart.h"
+
+static uint64_t boot_cntpct = 0;
+
+// Record the base of monotonic time, should be called once before any thread is created
+void vdso_init(){
+  boot_cntpct = read_sysreg(cntpct_el0);
+}
+
+/** Allocate and fill the data page of a process.
+ * The page holds one reference for the process, each mapping to el0 adds one more.
+ * @return kernel address of the page
+*/
+vdso_data *vdso_create(int pid, int ppid){
+  vdso_data *vdso = diy_malloc(PAGE_SIZE);
+  memset_(vdso, 0, PAGE_SIZE);
+  vdso->pid = pid;
+  vdso->ppid = ppid;
+  vdso->cntfrq = read_sysreg(cntfrq_el0);
+  vdso->boot_cntpct = boot_cntpct;
+  page_ref_inc((uint64_t)vdso);
+  return vdso;
+}
+
+// Drop the reference of the process, the page is freed after every mapping is gone
+void vdso_release(vdso_data *vdso){
+  if(vdso != NULL && page_ref_dec((uint64_t)vdso) == 0)
+    diy_free(vdso);
+}
+
+static inline const volatile vdso_data *vdso_get(){
+  return (const volatile vdso_data*)read_sysreg(tpidrro_el0);
+}
+
+int vdso_getpid(){
+  return vdso_get()->pid;
+}
+
+int vdso_getppid(){
+  return vdso_get()->ppid;
+}
+
+// Time since boot in micro seconds
+uint64_t vdso_uptime_us(){
+  const volatile vdso_data *vdso = vdso_get();
+  return (read_sysreg(cntpct_el0) - vdso->boot_cntpct) * 1000000 / vdso->cntfrq;
+}
+
+// Compare getpid by system call against getpid by reading the data page
+void vdso_bench(){
+  const int n = 10000;
+  volatile int pid = 0;
+  uint64_t t0, t1, t2;
+
+  t0 = read_sysreg(cntpct_el0);
+  for(int i=0; i<n; i++) pid = sysc_getpid();
+  t1 = read_sysreg(cntpct_el0);
+  for(int i=0; i<n; i++) pid = vdso_getpid();
+  t2 = read_sysreg(cntpct_el0);
+
+  const uint64_t cntfrq = read_sysreg(cntfrq_el0);
+  uart_printf("pid=%d, %d calls each\r\n", pid, n);
+  uart_printf("getpid via trap: %lu ticks, %lu ns/call\r\n", t1 - t0, (t1 - t0) * 1000000000 / cntfrq / n);
+  uart_printf("getpid via page: %lu ticks, %lu ns/call\r\n", t2 - t1, (t2 - t1) * 1000000000 / cntfrq / n);
+}
@@ -6,17 +6,15 @@
 #include "cpio.h"
 #include "devfs.h"
 #include "fat32_on_SD.h"
-
-#define CURRENT_DIR "."
-#define PARENT_DIR ".."
+#include "overlayfs.h"
+#include "dcache.h"
 
 vnode root_vnode;
 mount root_mount = {.fs=NULL, .root=&root_vnode};
+static mount *mounts = NULL; // mounts made by vfs_mount(), linked by .next
 
-static char *skip_first_comp(char *pathname);
-static int first_component(char *pathname, char *comp_name);
-
-/** Search pathname under dir_node recursively. Return 0 on found. Create if requested.
+/** Search pathname under dir_node component by component. Return 0 on found. Create if requested.
+ * Components are hashed in place while scanning, and looked up in dcache before asking the file system.
  * @param pathname: relative path to dir_node, if dir_node is root_vnode, than this is abs path
  * @param dir_node: Directory node to look under
  * @param node_found: Output of this function. The node pointer if file/dir specified with pathname exists.
@@ -25,160 +23,144 @@ static int first_component(char *pathname, char *comp_name);
  * @return 0 on found, non-0 otherwise. If create==1 and not found, return create()
 */
 int lookup_recur(char *pathname, vnode *dir_node, vnode **node_found, int create){
-  char *rest_path = NULL;
+  const char *comp = pathname;
   char comp_name[TMPFS_MAX_COMPONENT_NAME];
-  rest_path = skip_first_comp(pathname);
-  first_component(pathname, comp_name);
-
-  // Cross mount point, don't know if this is the right way to do it
-  if(dir_node->mount != NULL)
-    return lookup_recur(pathname, dir_node->mount->root, node_found, create);
-
-  // Return if dir_node is not COMP_DIR
-  if(dir_node->comp->type != COMP_DIR){
-    uart_printf("Error, lookup_recur(), failed, pathname=%s, search_under_name=%s, dir_node=0x%lX, type=%d, not folder\r\n", 
-      pathname, dir_node->comp->comp_name, (uint64_t)dir_node, dir_node->comp->type);
-    return 2;
-  }
+  vnode *next = NULL;
+  *node_found = dir_node;
 
-  // Search comp_name under dir_node
-  if(dir_node->v_ops->lookup(dir_node, node_found, comp_name) == 0){
-    dir_node = *node_found;
+  while(1){
+    while(*comp == '/') comp++;   // skip leading '/'
+    if(*comp == '\0')
+      return 0;                   // pathname found
 
-    // More to lookup and can lookup deeper
-    if     (rest_path[0] != '\0' && dir_node->comp->type == COMP_DIR)
-      return lookup_recur(rest_path, dir_node, node_found, create);
+    // Cross mount point
+    while(dir_node->mount != NULL)
+      dir_node = dir_node->mount->root;
 
     // More to lookup and cannot lookup deeper, return not found
-    else if(rest_path[0] != '\0' && dir_node->comp->type == COMP_FILE)
+    if(dir_node->comp->type != COMP_DIR)
       return 1;
 
-    // No more to lookup, return found
-    else if(rest_path[0] == '\0')
-      return 0; // pathname found
-
-    // Exception
-    else{
-      uart_printf("Exception, lookup_recur(), should not get here, dir_node=%lX, comp_name=%s, type=%d\r\n",
-        (uint64_t)dir_node, dir_node->comp->comp_name, dir_node->comp->type);
-      return 3;
+    // Hash the component in place, till end of string or '/'
+    uint32_t hash = DCACHE_HASH_INIT;
+    size_t len = 0;
+    while(comp[len] != '\0' && comp[len] != '/'){
+      hash = dcache_hash_step(hash, comp[len]);
+      len++;
+    }
+    if(len >= TMPFS_MAX_COMPONENT_NAME){
+      uart_printf("Error, lookup_recur(), component too long, pathname=%s\r\n", pathname);
+      return 2;
+    }
+    memcpy_(comp_name, comp, len);
+    comp_name[len] = '\0';
+
+    // Search comp_name under dir_node, the result is cached either found or not
+    if(dcache_lookup(dir_node, comp, len, hash, &next) == 0){
+      if(dir_node->v_ops->lookup(dir_node, &next, comp_name) != 0)
+        next = NULL;
+      dcache_insert(dir_node, comp, len, hash, next);
     }
-  }
 
-  // Create entry iteratively if not found
-  // Should be refactored, too many return point in this function. but I'm lazy
-  else if(create == 1){
-    char *rest_comps[VFS_MAX_DEPTH];
-    char path_copy[TMPFS_MAX_PATH_LEN];
-    int comp_count = 0;
-    int mkdir_ret = 0;
-    // uart_printf("Debug, lookup_recur(), path=%s, rest=%s, comp=%s\r\n", pathname, rest_path, comp_name);
-    // copy string since rest_path is from pathname, where pathname should not be changed
-    strcpy_(path_copy, pathname);
-    comp_count = str_spilt(rest_comps, path_copy, "/");
-    for(int i=0; i<comp_count; i++){
-      if(rest_comps[i][0] == '\0') continue; // skip NULL strings
-      // uart_printf("Debug, lookup_recur(), create, i=%d, dir=0x%lX, %s\r\n", i, (uint64_t)dir_node, rest_comps[i]);
-      mkdir_ret = dir_node->v_ops->create(dir_node, node_found, rest_comps[i]);
-      if(mkdir_ret == 0){
-        dir_node = *node_found;
-        dir_node->comp->type = COMP_DIR; // last component will be set to COMP_FILE in vfs_open()
-      }
-      else{
-        uart_printf("Error, lookup_recur(), failed to create(), %s, rest_comps[%d]=%s\r\n", path_copy, i, rest_comps[i]);
-        return mkdir_ret;
+    // Create entry if not found
+    if(next == NULL){
+      if(create != 1)
+        return 1; // comp_name not found under dir_node
+      const int create_ret = dir_node->v_ops->create(dir_node, &next, comp_name);
+      if(create_ret != 0){
+        uart_printf("Error, lookup_recur(), failed to create(), %s, component=%s\r\n", pathname, comp_name);
+        return create_ret;
       }
+      next->comp->type = COMP_DIR; // last component will be set to COMP_FILE in vfs_open()
+      dcache_insert(dir_node, comp, len, hash, next);
     }
-    return 0;
-  }
 
-  // comp_name not found under dir_node
-  else
-    return 1;
-}
-static char *skip_first_comp(char *pathname){ // return the string pointer right after '/' or '\0'
-  int i = 0;
-  if(pathname[i] == '/') i++;                           // skip leading '/'
-  while(pathname[i] != '\0' && pathname[i] != '/') i++; // skip first directory
-  if(pathname[i] == '/') i++;                           // skip leading '/'
-  return &pathname[i];
+    *node_found = next;
+    dir_node = next;
+    comp += len;
+  }
 }
-static int first_component(char *pathname, char *comp_name){
-  int i = 0;
-  if(pathname[i] == '/') pathname++;                    // skip leading '/'
-  while(pathname[i] != '\0' && pathname[i] != '/'){     // copy until end of string or '/'
-    comp_name[i] = pathname[i];
-    i++;
-  }
-  comp_name[i] = '\0';
-  // uart_printf("first_component(), pathname=%s, comp_name=%s\r\n", pathname, comp_name);
-  return 0;
+
+/** Append components of path to the normalized path out[0..*w), "." and ".." are resolved in a single pass.
+ * out is kept as "" or "/c1/c2" without trailing '/', so ".." just cuts out back to the last '/'.
+ * Every byte is written once and cut at most once, nothing is rescanned.
+ * @return count of ".." which went above the start of out, -1 if out would not fit TMPFS_MAX_PATH_LEN
+*/
+static int path_append(char *out, size_t *w, const char *path){
+  int above = 0;
+  while(1){
+    while(*path == '/') path++;
+    if(*path == '\0')
+      break;
+    size_t len = 0;
+    while(path[len] != '\0' && path[len] != '/')
+      len++;
+
+    if(len == 1 && path[0] == '.')
+      ;                                         // ".", skip
+    else if(len == 2 && path[0] == '.' && path[1] == '.'){
+      if(*w == 0)
+        above++;                                // ".." of the start
+      else
+        while(*w > 0 && out[--(*w)] != '/');    // pop last component
+    }
+    else{
+      if(*w + 1 + len >= TMPFS_MAX_PATH_LEN)
+        return -1;
+      out[(*w)++] = '/';
+      memcpy_(out + *w, path, len);
+      *w += len;
+    }
+    path += len;
+  }
+  out[*w] = '\0';
+  return above;
 }
 
 /** Translate (absolute/relative) path to absolute path. "." and ".." is also handled.
- * @param abs_path: output abs path
- * @param cwd: current working directory, used when @param path is relative path. Starts and ends with '/'
+ * @param abs_path: output abs path, TMPFS_MAX_PATH_LEN bytes
+ * @param cwd: current working directory, used when @param path is relative path. Starts and ends with '/', already normalized
  * @param path: Start with '/' for absolute path, relative path otherwise
- * @return 0 on success, 1 on cwd either starts or ends without '/'
- * @note If ".." meets root "/", ".." accumulates at the begining.
+ * @return 0 on success, 1 on cwd either starts or ends without '/', 2 on path too long
+ * @note ".." of root "/" is root itself.
 */
 int to_abs_path(char *abs_path, const char *cwd, const char *path){
+  size_t w = 0;
 
-  // Input abs path, copy directly and return
-  if(path[0] == '/'){
-    strcpy_(abs_path, path);
-    return 0;
-  }
-
-  // Return if cwd not starts or not ends with '/'
-  if(cwd[0] != '/' || cwd[strlen_(cwd)-1] != '/'){
-    uart_printf("Error, to_abs_path(), cwd should stars and ends with \"/\", cwd=%s\r\n", cwd);
-    return 1;
-  }
-
-  // Concatenate cwd and input path
-  char untrans[TMPFS_MAX_PATH_LEN]; // "." and ".." are untranslated yet
-  untrans[0] = '\0';
-  strcat_(untrans, cwd);
-  strcat_(untrans, path);
-
-  // Spilt string by "/"
-  char *comps[VFS_MAX_DEPTH]; // component string array
-  int count = str_spilt(comps, untrans, "/");
-
-  // Translate "." and ".."
-  int w = 0;  // write(update) index, w-- is like pop, w++ is like push. in place FILO
-  int r = 0;  // read index, always advance by 1. in place FIFO
-  while(w < count && r < count){
-    // Skip blank and "."
-    while(comps[r][0] == '\0' || strcmp_(comps[r], CURRENT_DIR) == 0)
-      r++;
-
-    // Handle ".."
-    if(strcmp_(comps[r], PARENT_DIR) == 0){
-      // when stack empty (w==0) or stack top is "..", then push ".."
-      if(w == 0 || strcmp_(comps[w-1], PARENT_DIR)==0)
-        comps[w++] = comps[r];   // push ".."
-      else
-        comps[w--] = NULL;    // pop, just "w--;" also does the job
+  // Relative path continues from cwd, which needs no translation
+  if(path[0] != '/'){
+    w = strlen_(cwd);
+    if(cwd[0] != '/' || cwd[w-1] != '/' || w > TMPFS_MAX_PATH_LEN){
+      uart_printf("Error, to_abs_path(), cwd should stars and ends with \"/\", cwd=%s\r\n", cwd);
+      return 1;
     }
-
-    // Push normal component
-    else
-      comps[w++] = comps[r];
-
-    r++;
+    w--;  // drop trailing '/'
+    memcpy_(abs_path, cwd, w);
   }
 
-  count = w; // items after w are ignored
-  abs_path[0] = '\0'; // clear string
-  for(int i=0; i<count; i++){
-    strcat_(abs_path, "/");
-    strcat_(abs_path, comps[i]);
+  if(path_append(abs_path, &w, path) < 0){
+    uart_printf("Error, to_abs_path(), path too long, cwd=%s, path=%s\r\n", cwd, path);
+    return 2;
   }
+  if(w == 0)
+    strcpy_(abs_path, "/");
   return 0;
 }
 
+/** Normalize relative path, for lookup under a directory vnode instead of root
+ * @param out: output, "/" or "/c1/c2", TMPFS_MAX_PATH_LEN bytes
+ * @return count of ".." above the directory, -1 on path too long
+*/
+int normalize_path(char *out, const char *path){
+  size_t w = 0;
+  const int above = path_append(out, &w, path);
+  if(above < 0)
+    uart_printf("Error, normalize_path(), path too long, path=%s\r\n", path);
+  if(w == 0)
+    strcpy_(out, "/");
+  return above;
+}
+
 int register_filesystem(filesystem *fs){
   // register the file system to the kernel.
 
@@ -198,6 +180,15 @@ int register_filesystem(filesystem *fs){
   return -1;
 }
 
+// Mount fs on node, setup_mount() of fs is left to the caller
+static mount *mount_new(vnode *node, filesystem *fs){
+  node->mount = diy_malloc(sizeof(mount));
+  node->mount->fs = fs;
+  node->mount->next = mounts;
+  mounts = node->mount;
+  return node->mount;
+}
+
 int vfs_mount(char *pathname, const char *fs_name){
   vnode *mount_at_node = NULL;
 
@@ -206,34 +197,38 @@ int vfs_mount(char *pathname, const char *fs_name){
     uart_printf("Error, vfs_mount(), pathname %s not found\r\n", pathname);
     return 1;
   }
+  dcache_flush(); // entries under the mount point are hidden from now on
 
   if     (strcmp_(fs_name, tmpfs.name) == 0){
-    mount_at_node->mount = diy_malloc(sizeof(mount));
-    mount_at_node->mount->fs = &tmpfs;
+    mount_new(mount_at_node, &tmpfs);
     const int ret = mount_at_node->mount->fs->setup_mount(&tmpfs, mount_at_node->mount); // init of tmpfs
     uart_printf("Debug, vfs_mount(), path=%s, fs=%s, root_vnode=0x%lX, mount_at=0x%lX, mount_to=0x%lX\r\n", 
       pathname, fs_name, (uint64_t)&root_vnode, (uint64_t)mount_at_node, (uint64_t)mount_at_node->mount->root);
     return ret;
   }
   else if(strcmp_(fs_name, initramfs.name) == 0){
-    mount_at_node->mount = diy_malloc(sizeof(mount));
-    mount_at_node->mount->fs = &initramfs;
+    mount_new(mount_at_node, &initramfs);
     const int ret = mount_at_node->mount->fs->setup_mount(&tmpfs, mount_at_node->mount); // init of tmpfs
     uart_printf("Debug, vfs_mount(), path=%s, fs=%s, root_vnode=0x%lX, mount_at=0x%lX, mount_to=0x%lX\r\n", 
       pathname, fs_name, (uint64_t)&root_vnode, (uint64_t)mount_at_node, (uint64_t)mount_at_node->mount->root);
     return ret;
   }
   else if(strcmp_(fs_name, devfs.name) == 0){
-    mount_at_node->mount = diy_malloc(sizeof(mount));
-    mount_at_node->mount->fs = &devfs;
+    mount_new(mount_at_node, &devfs);
     const int ret = mount_at_node->mount->fs->setup_mount(&tmpfs, mount_at_node->mount); // init of tmpfs
     uart_printf("Debug, vfs_mount(), path=%s, fs=%s, root_vnode=0x%lX, mount_at=0x%lX, mount_to=0x%lX\r\n", 
       pathname, fs_name, (uint64_t)&root_vnode, (uint64_t)mount_at_node, (uint64_t)mount_at_node->mount->root);
     return ret;
   }
+  else if(strcmp_(fs_name, overlayfs.name) == 0){
+    mount_new(mount_at_node, &overlayfs);
+    const int ret = mount_at_node->mount->fs->setup_mount(&overlayfs, mount_at_node->mount);
+    uart_printf("Debug, vfs_mount(), path=%s, fs=%s, root_vnode=0x%lX, mount_at=0x%lX, mount_to=0x%lX\r\n", 
+      pathname, fs_name, (uint64_t)&root_vnode, (uint64_t)mount_at_node, (uint64_t)mount_at_node->mount->root);
+    return ret;
+  }
   else if(strcmp_(fs_name, fat32fs.name) == 0){
-    mount_at_node->mount = diy_malloc(sizeof(mount));
-    mount_at_node->mount->fs = &fat32fs;
+    mount_new(mount_at_node, &fat32fs);
     const int ret = mount_at_node->mount->fs->setup_mount(&tmpfs, mount_at_node->mount); // init of tmpfs
     uart_printf("Debug, vfs_mount(), path=%s, fs=%s, root_vnode=0x%lX, mount_at=0x%lX, mount_to=0x%lX\r\n", 
       pathname, fs_name, (uint64_t)&root_vnode, (uint64_t)mount_at_node, (uint64_t)mount_at_node->mount->root);
@@ -257,15 +252,32 @@ int vfs_lookup(char *pathname, vnode **target){
 }
 
 int vfs_open(char *pathname, int flags, file **file_handle){
+  return vfs_open_at(&root_vnode, pathname, flags, file_handle);
+}
+
+// Make a handle of directory node, which only holds the vnode, f_ops->open() of file systems refuses directories
+static void dir_handle_new(vnode *node, int flags, size_t f_pos, file **file_handle){
+  *file_handle = diy_malloc(sizeof(file));
+  (*file_handle)->f_ops = node->f_ops;
+  (*file_handle)->f_pos = f_pos;
+  (*file_handle)->vnode = node;
+  (*file_handle)->flags = flags;
+  node->comp->dir_handles++;
+}
+
+/** Open pathname under dir_node, e.g. cwd of a process, so the path up to dir_node is not walked again
+ * @param flags: O_CREAT to create a missing file, O_DIRECTORY to open a directory, e.g. as dirfd of openat()
+*/
+int vfs_open_at(vnode *dir_node, char *pathname, int flags, file **file_handle){
   vnode *node = NULL;
   int ret = 0;
 
   // Lookup pathname
-  ret = vfs_lookup(pathname, &node);
+  ret = lookup_recur(pathname, dir_node, &node, 0);
   
   // Create a new file if vnode not found and O_CREAT
-  if(ret != 0 && (flags & O_CREAT)){
-    ret = lookup_recur(pathname, &root_vnode, &node, 1); // create via lookup_recur()
+  if(ret != 0 && (flags & O_CREAT) && !(flags & O_DIRECTORY)){
+    ret = lookup_recur(pathname, dir_node, &node, 1); // create via lookup_recur()
     if(ret == 0) node->comp->type = COMP_FILE;
     else{
       uart_printf("Exception, vfs_open(), failed to create %s, ret=%d\r\n", pathname, ret);
@@ -277,6 +289,18 @@ int vfs_open(char *pathname, int flags, file **file_handle){
     return ret;
   }
 
+  // Directory handles are the same for every file system, they only hold the vnode
+  if(flags & O_DIRECTORY){
+    while(node->mount != NULL)
+      node = node->mount->root;
+    if(node->comp->type != COMP_DIR){
+      uart_printf("Error, vfs_open(), O_DIRECTORY but %s is not a directory\r\n", pathname);
+      return 3;
+    }
+    dir_handle_new(node, flags, 0, file_handle);
+    return 0;
+  }
+
   // Open file through fops of this node
   ret = node->f_ops->open(node, file_handle);
   if(ret == 0)
@@ -293,9 +317,25 @@ int vfs_open(char *pathname, int flags, file **file_handle){
 int vfs_close(file *file){
   // 1. release the file handle
   // 2. Return error code if fails
+  if(file->flags & O_DIRECTORY)
+    file->vnode->comp->dir_handles--;
   return file->f_ops->close(file);
 }
 
+// Open another handle of the same vnode at the same position, e.g. for the fd_table of a forked kid
+int vfs_dup(file *file, struct file **target){
+  if(file->flags & O_DIRECTORY){
+    dir_handle_new(file->vnode, file->flags, file->f_pos, target);
+    return 0;
+  }
+  const int ret = file->vnode->f_ops->open(file->vnode, target);
+  if(ret == 0){
+    (*target)->f_pos = file->f_pos;
+    (*target)->flags = file->flags;
+  }
+  return ret;
+}
+
 int vfs_write(file *file, void *buf, size_t len){
   // 1. write len byte from buf to the opened file.
   // 2. return written size or error code if an error occurs.
@@ -309,6 +349,117 @@ int vfs_read(file *file, void *buf, size_t len){
   return file->f_ops->read(file, buf, len);
 }
 
+/** Read to iovcnt buffers in order, stops at the first short read
+ * @return total size read, or the error code of the first read
+*/
+long vfs_readv(file *file, const iovec *iov, int iovcnt){
+  long total = 0;
+  for(int i=0; i<iovcnt; i++){
+    const int ret = file->f_ops->read(file, iov[i].iov_base, iov[i].iov_len);
+    if(ret < 0)
+      return total > 0 ? total : ret;
+    total += ret;
+    if(ret < iov[i].iov_len)
+      break;
+  }
+  return total;
+}
+
+/** Write from iovcnt buffers in order, stops at the first short write
+ * @return total size wrote, or the error code of the first write
+*/
+long vfs_writev(file *file, const iovec *iov, int iovcnt){
+  long total = 0;
+  for(int i=0; i<iovcnt; i++){
+    const int ret = file->f_ops->write(file, iov[i].iov_base, iov[i].iov_len);
+    if(ret < 0)
+      return total > 0 ? total : ret;
+    total += ret;
+    if(ret < iov[i].iov_len)
+      break;
+  }
+  return total;
+}
+
+// Move f_pos of file to offset through its fops. Return 0 on success, -1 if file cannot seek, e.g. a pipe or uart
+static int vfs_seek_to(file *file, size_t offset){
+  if(file->f_ops->lseek64 == NULL || file->f_ops->lseek64(file, (long)offset, SEEK_SET) < 0){
+    uart_printf("Error, vfs_seek_to(), file cannot seek to %lu\r\n", offset);
+    return -1;
+  }
+  return 0;
+}
+
+// Read at offset, f_pos is not changed. Return -1 if file cannot seek
+int vfs_pread(file *file, void *buf, size_t len, size_t offset){
+  const size_t f_pos = file->f_pos;
+  if(vfs_seek_to(file, offset) != 0)
+    return -1;
+  const int ret = file->f_ops->read(file, buf, len);
+  file->f_pos = f_pos;
+  return ret;
+}
+
+// Write at offset, f_pos is not changed. Return -1 if file cannot seek
+int vfs_pwrite(file *file, const void *buf, size_t len, size_t offset){
+  const size_t f_pos = file->f_pos;
+  if(vfs_seek_to(file, offset) != 0)
+    return -1;
+  const int ret = file->f_ops->write(file, buf, len);
+  file->f_pos = f_pos;
+  return ret;
+}
+
+/** Fill buf with as many entries of a directory handle as fit, starting from entry f_pos.
+ * f_pos is the cookie, it moves past the entries filled so the next call resumes there.
+ * @param dir: handle opened with O_DIRECTORY
+ * @return bytes filled, 0 at the end of directory, -1 if dir is not a directory or buf cannot hold the next entry
+*/
+long vfs_getdents(file *dir, void *buf, size_t len){
+  vnode *node = dir->vnode;
+  if(!(dir->flags & O_DIRECTORY) || node->comp->type != COMP_DIR){
+    uart_printf("Error, vfs_getdents(), not a directory handle, node_name=%s\r\n", node->comp->comp_name);
+    return -1;
+  }
+
+  if(dir->f_pos == 0 && node->v_ops != NULL && node->v_ops->populate != NULL)
+    node->v_ops->populate(node);
+
+  size_t filled = 0;
+  while(dir->f_pos < node->comp->len){
+    if(node->comp->entries[dir->f_pos] == NULL){  // removed while listing
+      dir->f_pos++;
+      continue;
+    }
+    const vnode_comp *comp = node->comp->entries[dir->f_pos]->comp;
+    const size_t name_len = strlen_(comp->comp_name);
+    const size_t reclen = (offsetof(dirent, name) + name_len + 1 + 7) & ~(size_t)7;
+    if(filled + reclen > len)
+      break;
+
+    dirent *d = (dirent*)((uint8_t*)buf + filled);
+    d->size = comp->len;
+    d->off = dir->f_pos + 1;
+    d->reclen = reclen;
+    d->type = comp->type;
+    memcpy_(d->name, comp->comp_name, name_len + 1);
+    filled += reclen;
+    dir->f_pos++;
+  }
+  if(filled == 0 && dir->f_pos < node->comp->len){
+    uart_printf("Error, vfs_getdents(), len=%lu too small for the next entry\r\n", len);
+    return -1;
+  }
+  return filled;
+}
+
+// Return POLL* events of file ready now, regular files never block
+int vfs_poll(file *file){
+  if(file->f_ops->poll == NULL)
+    return POLLIN | POLLOUT;
+  return file->f_ops->poll(file);
+}
+
 int vfs_mkdir(char *pathname){
   vnode *node = NULL;
   if(vfs_lookup(pathname, &node) == 0){
@@ -327,13 +478,77 @@ int vfs_mkdir(char *pathname){
   }
 }
 
+int vfs_unlink(char *pathname){
+  return vfs_unlink_at(&root_vnode, pathname);
+}
+
+/** Remove the last component of pathname from its directory, through unlink() of that file system.
+ * @param pathname: relative to dir_node, normalized, i.e. no "." or ".."
+ * @return 0 on success, non-0 if not found or the entry cannot be removed
+*/
+int vfs_unlink_at(vnode *dir_node, char *pathname){
+  char parent[TMPFS_MAX_PATH_LEN];
+  char name[TMPFS_MAX_COMPONENT_NAME];
+  vnode *dir = NULL;
+
+  // Split pathname into its directory and the last component
+  size_t end = strlen_(pathname);
+  while(end > 0 && pathname[end - 1] == '/')
+    end--;
+  size_t start = end;
+  while(start > 0 && pathname[start - 1] != '/')
+    start--;
+  if(end == start || end - start >= TMPFS_MAX_COMPONENT_NAME || start >= TMPFS_MAX_PATH_LEN){
+    uart_printf("Error, vfs_unlink(), invalid pathname %s\r\n", pathname);
+    return 1;
+  }
+  memcpy_(parent, pathname, start);
+  parent[start] = '\0';
+  memcpy_(name, pathname + start, end - start);
+  name[end - start] = '\0';
+
+  if(lookup_recur(parent, dir_node, &dir, 0) != 0){
+    uart_printf("Error, vfs_unlink(), no such directory %s\r\n", parent);
+    return 1;
+  }
+  while(dir->mount != NULL)
+    dir = dir->mount->root;
+  if(dir->comp->type != COMP_DIR || dir->v_ops->unlink == NULL){
+    uart_printf("Error, vfs_unlink(), cannot remove %s, file system of %s is read-only\r\n", name, dir->comp->comp_name);
+    return 2;
+  }
+  const int ret = dir->v_ops->unlink(dir, name);
+  if(ret == 0){
+    // Replace what dcache knows of name with a negative entry
+    uint32_t hash = DCACHE_HASH_INIT;
+    for(size_t i=0; name[i] != '\0'; i++)
+      hash = dcache_hash_step(hash, name[i]);
+    dcache_insert(dir, name, end - start, hash, NULL);
+  }
+  return ret;
+}
+
+// Write back what every mounted file system keeps dirty in memory. Return sectors written
+int vfs_sync(){
+  int cnt = 0;
+  for(mount *m = mounts; m != NULL; m = m->next){
+    if(m->fs->sync != NULL)
+      cnt += m->fs->sync(m);
+  }
+  return cnt;
+}
+
 void vfs_dump_under(vnode *node, int depth){
   if(node->mount != NULL)
     vfs_dump_under(node->mount->root, depth);
   else if(node->comp->type == COMP_DIR){
     vnode *entry = NULL;
+    if(node->v_ops != NULL && node->v_ops->populate != NULL)
+      node->v_ops->populate(node);
     for(size_t i=0; i<node->comp->len; i++){
       entry = node->comp->entries[i];
+      if(entry == NULL)
+        continue;
       for(int k=0; k<depth; k++) uart_printf("    ");
       uart_printf("%lu, 0x%lX, %s, type=%d, len=%lu\r\n", 
         i, (uint64_t)entry, entry->comp->comp_name, entry->comp->type, entry->comp->len);
@@ -12,6 +12,7 @@
 #include "sys_reg.h"
 #include "system_call.h"
 #include "mmu.h"
+#include "poll.h"
 #include <stdint.h>
 
 #define MACHINE_NAME "rpi-baremetal-lab6$ "
@@ -80,7 +81,13 @@ static void sys_init(void *dtb_addr){
   uart_init();
 
   // Device tree parse
-  const long int dtb_size = fdtb_parse((void*)((uint64_t)dtb_addr | VM_KERNEL_PREFIX), 0, cpio_parse);
+  const long int dtb_size = fdtb_parse((void*)((uint64_t)dtb_addr | VM_KERNEL_PREFIX), 0, NULL);
+  uint64_t initrd_start = 0, initrd_end = 0;
+  if(fdtb_get_initrd(&initrd_start, &initrd_end) != 0){
+    initrd_start = (uint64_t)CPIO_ADDR | VM_KERNEL_PREFIX;  // not given by the boot loader, only an uncompressed archive can be found there
+    initrd_end = 0;
+  }
+  cpio_parse_extent((void*)initrd_start, (void*)initrd_end);
 
   // Memory init
   uint32_t *mem_start_addr = 0;
@@ -91,7 +98,7 @@ static void sys_init(void *dtb_addr){
   mem_reserve_kernel_vm(0x0, 0x1000);                                       // spin tables for multicore boot
   mem_reserve_kernel_vm((uint64_t)&__image_start, (uint64_t)&__image_end);  // kernel image
   mem_reserve_kernel_vm((uint64_t)&__stack_end, (uint64_t)&__stack_start);  // stack, grows downward, so range is from end to start
-  mem_reserve_kernel_vm(0x8000000, 0x8000000 + 248320);                     // initramfs, hard coded
+  mem_reserve(initrd_start, initrd_start + cpio_image_size());              // initramfs, as booted, e.g. page aligned by make run
   mem_reserve_kernel_vm((uint64_t)dtb_addr, (uint64_t)dtb_addr + dtb_size); // device tree
   mem_reserve_kernel_vm(PAGE_TABLE_STATICS_START_ADDR, PAGE_TABLE_STATICS_END_ADDR); // reserve space for static(PGD, PUD, PMD) page table, for basic 1
   alloc_page_init();
@@ -108,9 +115,11 @@ void general_exception_handler(uint64_t cause, trap_frame *tf){
   EL1_ARM_INTERRUPT_DISABLE();
 
   switch(cause){
-    // synchornous (svc)
+    // synchornous (svc or page fault), do not schedule after system calls
     case 5:  case 9:
-      system_call(tf);  // do not schedule after system calls
+      if(sync_exception_dispatch(tf) != 0)
+        uart_printf("Unhandled synchronous exception, esr_el1=0x%08lX, elr_el1=0x%08lX, far_el1=0x%08lX, cause=%lu\r\n",
+          tf->esr_el1, tf->elr_el1, read_sysreg(far_el1), cause);
       break;
     
     // IRQ
@@ -135,9 +144,10 @@ void general_exception_handler(uint64_t cause, trap_frame *tf){
 }
 
 static void irq_handler(){
-  // uart interrupt fired
+  // uart interrupt fired, armed by devfs_poll() for pollers of uart
   if(*IRQS1_PENDING & AUX_INT){
-    uart_printf("Exception, uart interrtupt not enabled but fired\r\n");
+    uart_rx_irq_disarm(); // the byte is left in FIFO for the reader
+    poll_wake();
   }
 
   // arm core 0 timer interrupt fired
@@ -148,6 +158,7 @@ static void irq_handler(){
     // uart_printf("ticks=%ld, freq=%ld, time elapsed=%ldms\r\n", 
     //   cntpct, cntfrq, (cntpct*1000) / cntfrq);
     write_sysreg(cntp_tval_el0, cntfrq >> 5); // set next tick to 1/32 second, which is, time slice for round robin
+    poll_tick();
   }
 
   // Unknown interrupt fired
@@ -13,6 +13,17 @@
 #include "system_call.h"
 #include "virtual_file_system.h"
 #include "sd.h"
+#include "mmu.h"
+#include "program_loader.h"
+#include "vdso.h"
+#include "syscall_ring.h"
+#include "pipe.h"
+#include "shm.h"
+#include "msg.h"
+#include "poll.h"
+#include "dcache.h"
+#include "overlayfs.h"
+#include "fat32_on_SD.h"
 #include <stdint.h>
 
 #define MACHINE_NAME "rpi-baremetal-lab8$ "
@@ -27,13 +38,33 @@
 #define CMD_DUMP_PAGE     "dump_page"
 #define CMD_DUMP_CHUNK    "dump_chunk"
 #define CMD_DUMP_RQ       "dump_rq"
+#define CMD_DUMP_IMAGE    "dump_img"
+#define CMD_BENCH_GETPID  "bench_getpid"
+#define CMD_BENCH_SYSCALL "bench_syscall"
+#define CMD_FAST_PATH     "fast_path"
+#define CMD_BENCH_RING    "bench_ring"
+#define CMD_BENCH_PIPE    "bench_pipe"
+#define CMD_BENCH_SHM     "bench_shm"
+#define CMD_BENCH_MSG     "bench_msg"
+#define CMD_WAIT_KEY      "wait_key"
+#define CMD_DCACHE        "dcache"
+#define CMD_BENCH_DIR     "bench_dir"
+#define CMD_BENCH_SPARSE  "bench_sparse"
+#define CMD_BENCH_CPIO    "bench_cpio"
 #define CMD_EXEC          "exec"
+#define CMD_BENCH_LOAD    "bench_load"
 #define CMD_WRITE         "write"
 #define CMD_READ          "read"
 #define CMD_MKDIR         "mkdir"
 #define CMD_LS            "ls"
+#define CMD_LSDIR         "lsdir"
 #define CMD_CD            "cd"
 #define CMD_MOUNT         "mount"
+#define CMD_RM            "rm"
+#define CMD_OVERLAY       "overlay"
+#define CMD_FAT           "fat"
+#define CMD_SYNC          "sync"
+#define CMD_BENCH_FAT     "bench_fat"
 
 #define ADDR_IMAGE_START 0x80000
 
@@ -45,6 +76,7 @@ static void foo();
 static void shell();
 static void irq_handler();
 static void mailbox_test();
+static void list_dir(const char *path);
 extern uint64_t __image_start, __image_end;
 extern uint64_t __stack_start, __stack_end;
 void main(void *dtb_addr)
@@ -62,12 +94,15 @@ void main(void *dtb_addr)
   vfs_mount("/", "tmpfs");
   vfs_mkdir("/initramfs");
   vfs_mount("/initramfs", "initramfs");
+  vfs_mkdir("/overlay");
+  vfs_mount("/overlay", "overlay");
   vfs_mkdir("/dev");
   vfs_mount("/dev", "devfs");
   vfs_mkdir("/boot");
   vfs_mount("/boot", "fat32fs");
 
   thread_init();
+  thread_create(fat32fs_flusher, KERNEL);
   thread_create(shell, USER);
   thread_create(foo, USER);
   r_q_dump();
@@ -92,7 +127,13 @@ static void sys_init(void *dtb_addr){
   uart_init();
 
   // Device tree parse
-  const long int dtb_size = fdtb_parse(dtb_addr, 0, cpio_parse);
+  const long int dtb_size = fdtb_parse(dtb_addr, 0, NULL);
+  uint64_t initrd_start = 0, initrd_end = 0;
+  if(fdtb_get_initrd(&initrd_start, &initrd_end) != 0){
+    initrd_start = (uint64_t)CPIO_ADDR;   // not given by the boot loader, only an uncompressed archive can be found there
+    initrd_end = 0;
+  }
+  cpio_parse_extent((void*)initrd_start, (void*)initrd_end);
 
   // Memory init
   uint32_t *mem_start_addr = 0;
@@ -102,7 +143,7 @@ static void sys_init(void *dtb_addr){
   mem_reserve(0x0, 0x1000);                                       // spin tables for multicore boot
   mem_reserve((uint64_t)&__image_start, (uint64_t)&__image_end);  // kernel image
   mem_reserve((uint64_t)&__stack_end, (uint64_t)&__stack_start);  // stack, grows downward, so range is from end to start
-  mem_reserve(0x8000000, 0x8000000 + 247296);                     // initramfs, hard coded
+  mem_reserve(initrd_start, initrd_start + cpio_image_size());    // initramfs, compressed or not
   mem_reserve((uint64_t)dtb_addr, (uint64_t)dtb_addr + dtb_size); // device tree
   alloc_page_init();
 
@@ -123,9 +164,11 @@ void general_exception_handler(uint64_t cause, trap_frame *tf){
   // thread_t *thd = thread_get_current();
   // uart_printf("In exception handler, pid=%d, cause=%lu, elr_el1=0x%lX\r\n", thd->pid, cause, tf->elr_el1);
   switch(cause){
-    // synchornous (svc)
+    // synchornous (svc or page fault), do not schedule after system calls
     case 5:  case 9:
-      system_call(tf);  // do not schedule after system calls
+      if(sync_exception_dispatch(tf) != 0)
+        uart_printf("Unhandled synchronous exception, esr_el1=0x%08lX, elr_el1=0x%08lX, far_el1=0x%08lX, cause=%lu\r\n",
+          tf->esr_el1, tf->elr_el1, read_sysreg(far_el1), cause);
       break;
     
     // IRQ
@@ -149,10 +192,12 @@ void general_exception_handler(uint64_t cause, trap_frame *tf){
   // schedule();
 }
 
+
 static void irq_handler(){
-  // uart interrupt fired
+  // uart interrupt fired, armed by devfs_poll() for pollers of uart
   if(*IRQS1_PENDING & AUX_INT){
-    uart_printf("Exception, uart interrtupt not enabled but fired\r\n");
+    uart_rx_irq_disarm(); // the byte is left in FIFO for the reader
+    poll_wake();
   }
 
   // arm core 0 timer interrupt fired
@@ -163,6 +208,8 @@ static void irq_handler(){
     // uart_printf("ticks=%ld, freq=%ld, time elapsed=%ldms\r\n", 
     //   cntpct, cntfrq, (cntpct*1000) / cntfrq);
     write_sysreg(cntp_tval_el0, cntfrq >> 5); // set next tick to 1/32 second, which is, time slice for round robin
+    poll_tick();
+    fat32fs_tick();
   }
 
   // Unknown interrupt fired
@@ -175,7 +222,7 @@ static void irq_handler(){
 }
 
 static void foo(){
-  int pid = sysc_getpid();
+  int pid = vdso_getpid();
   while(1){
     uint64_t tk;
     uart_printf("foo(), pid=%d, in background", pid);
@@ -234,6 +281,30 @@ static void mailbox_test(){
   uart_printf("pid = %d, exitting mailbox test\r\n", pid);
 }
 
+// List a directory from user side, entries come in batches so a large directory takes a few traps
+static void list_dir(const char *path){
+  static uint64_t buf[64];  // 512 bytes, dirent are 8-byte aligned
+  int traps = 0, cnt = 0;
+  long filled = 0;
+
+  const int fd = sysc_openat(AT_FDCWD, path, O_DIRECTORY);
+  if(fd < 0){
+    uart_printf("shell(): Failed to open directory: %s\r\n", path);
+    return;
+  }
+  while((filled = sysc_getdents(fd, buf, sizeof(buf))) > 0){
+    traps++;
+    for(long pos=0; pos<filled; ){
+      const dirent *d = (const dirent*)((uint8_t*)buf + pos);
+      uart_printf("%s%s\t%lu\r\n", d->name, d->type == COMP_DIR ? "/" : "", d->size);
+      pos += d->reclen;
+      cnt++;
+    }
+  }
+  sysc_close(fd);
+  uart_printf("%d entries in %d getdents calls\r\n", cnt, traps + 1);
+}
+
 static void shell(){
   char input_s[64];
   char *args[10];
@@ -259,13 +330,33 @@ static void shell(){
         uart_printf(CMD_MALLOC " <size>\t: Allocate memory, <size> in bytes\r\n");
         uart_printf(CMD_FREE " <addr>\t: Free memory, <addr> in hex without 0x\r\n");
         uart_printf(CMD_DUMP_RQ "\t\t: Dump run queue\r\n");
-        uart_printf(CMD_EXEC " <file> \t: Reallocate the file (img) and jumps to it.\r\n");
+        uart_printf(CMD_DUMP_IMAGE "\t: Dump program images shared between processes\r\n");
+        uart_printf(CMD_BENCH_GETPID "\t: Compare getpid via system call against via data page\r\n");
+        uart_printf(CMD_BENCH_SYSCALL "\t: Time null system call through the fast path or full trap frame, see " CMD_FAST_PATH "\r\n");
+        uart_printf(CMD_FAST_PATH " <on|off>\t: Serve getpid and lseek by the system call fast path or not\r\n");
+        uart_printf(CMD_BENCH_RING "\t: Compare 10k small writes by system call against batched by ring\r\n");
+        uart_printf(CMD_BENCH_PIPE "\t: Throughput of a pipe between forked processes\r\n");
+        uart_printf(CMD_BENCH_SHM "\t: Exchange framebuffer sized frames through shared memory between forked processes\r\n");
+        uart_printf(CMD_BENCH_MSG "\t: Pass 64 kB messages between forked processes, counting pages moved and copied, copied without MMU\r\n");
+        uart_printf(CMD_WAIT_KEY "\t: Sleep in poll() on stdin until a key is pressed, reporting every second\r\n");
+        uart_printf(CMD_DCACHE "\t\t: VFS: Hit rate of path component cache\r\n");
+        uart_printf(CMD_BENCH_DIR " <n>\t: VFS: Create n files in /dir_bench and look them up\r\n");
+        uart_printf(CMD_BENCH_SPARSE "\t: VFS: Write far apart pages of a tmpfs file, holes take no memory\r\n");
+        uart_printf(CMD_BENCH_CPIO " <n>\t: Index a generated cpio archive of n files and look them up\r\n");
+        uart_printf(CMD_EXEC " <file> \t: Load the file (ELF or img) and jumps to it.\r\n");
+        uart_printf(CMD_BENCH_LOAD " <file>\t: Compare load time of the file against flat copy of 64 pages\r\n");
         uart_printf(CMD_LS "\t\t: VFS: List entries recursively\r\n");
+        uart_printf(CMD_LSDIR " [path]\t: VFS: List entries of a directory by getdents, default to cwd\r\n");
         uart_printf(CMD_MKDIR " <dir_path>\t: VFS: Create directory\r\n");
         uart_printf(CMD_WRITE " <file> <str>\t: VFS: Write string to file, create if not exist, rewrite if exist\r\n");
         uart_printf(CMD_READ " <file> <len>\t: VFS: Read len bytes from file, print as string\r\n");
         uart_printf(CMD_CD       " <path>\t\t: VFS: Change directory\r\n");
         uart_printf(CMD_MOUNT " <path> <fs>\t: VFS: Mount specific file system on path\r\n");
+        uart_printf(CMD_RM " <path>\t\t: VFS: Remove file or empty directory\r\n");
+        uart_printf(CMD_OVERLAY "\t\t: VFS: Files copied up and whiteouts of the writable initramfs at /overlay\r\n");
+        uart_printf(CMD_FAT "\t\t: VFS: Metadata sector I/O and free clusters of FAT32 at /boot\r\n");
+        uart_printf(CMD_SYNC "\t\t: VFS: Write cached metadata back to SD card\r\n");
+        uart_printf(CMD_BENCH_FAT "\t: VFS: Write a file of FAT32 in 100 chunks, counting sector reads and writes\r\n");
         
       }
       else if(strcmp_(args[0], CMD_REBOOT) == 0){
@@ -332,6 +423,67 @@ static void shell(){
         uart_printf("Shell dump run queue:\r\n");
         r_q_dump();
       }
+      else if(strcmp_(args[0], CMD_DUMP_IMAGE) == 0){
+        program_image_dump();
+      }
+      else if(strcmp_(args[0], CMD_BENCH_GETPID) == 0){
+        vdso_bench();
+      }
+      else if(strcmp_(args[0], CMD_BENCH_SYSCALL) == 0){
+        syscall_bench();
+      }
+      else if(strcmp_(args[0], CMD_FAST_PATH) == 0){
+        if(args_cnt > 1 && (strcmp_(args[1], "on") == 0 || strcmp_(args[1], "off") == 0))
+          syscall_fast_path_set(strcmp_(args[1], "on") == 0);
+        else
+          uart_printf("Usage: " CMD_FAST_PATH " <on|off>\r\n");
+        uart_printf("system call fast path is %s\r\n", syscall_fast_path_get() ? "on" : "off");
+      }
+      else if(strcmp_(args[0], CMD_BENCH_RING) == 0){
+        ring_bench();
+      }
+      else if(strcmp_(args[0], CMD_BENCH_PIPE) == 0){
+        pipe_bench();
+      }
+      else if(strcmp_(args[0], CMD_BENCH_SHM) == 0){
+        shm_bench();
+      }
+      else if(strcmp_(args[0], CMD_BENCH_MSG) == 0){
+        msg_bench();
+      }
+      else if(strcmp_(args[0], CMD_BENCH_DIR) == 0){
+        if(args_cnt > 1){
+          int n = 0;
+          sscanf_(args[1], "%d", &n);
+          tmpfs_dir_bench(n);
+        }
+        else
+          uart_printf("Usage: " CMD_BENCH_DIR " <n>\r\n");
+      }
+      else if(strcmp_(args[0], CMD_BENCH_CPIO) == 0){
+        if(args_cnt > 1){
+          int n = 0;
+          sscanf_(args[1], "%d", &n);
+          cpio_bench(n);
+        }
+        else
+          uart_printf("Usage: " CMD_BENCH_CPIO " <n>\r\n");
+      }
+      else if(strcmp_(args[0], CMD_BENCH_SPARSE) == 0){
+        tmpfs_sparse_bench();
+      }
+      else if(strcmp_(args[0], CMD_DCACHE) == 0){
+        dcache_dump_stat();
+      }
+      else if(strcmp_(args[0], CMD_WAIT_KEY) == 0){
+        pollfd pfd = {.fd=0, .events=POLLIN, .revents=0}; // fd 0 is stdin, opened by thread_create()
+        int waited = 0;
+        char c = 0;
+        while(sysc_poll(&pfd, 1, 1000) == 0)
+          uart_printf("no key in %d s\r\n", ++waited);
+        sysc_read(0, &c, 1);
+        uart_printf("got key 0x%02X after %d s\r\n", c, waited);
+      }
       else if(strcmp_(args[0], CMD_EXEC) == 0){
         if(args_cnt > 1){
           sysc_exec(args[1], NULL);
@@ -341,6 +493,12 @@ static void shell(){
         else
           uart_printf("Usage: " CMD_EXEC " <file>\r\n");
       }
+      else if(strcmp_(args[0], CMD_BENCH_LOAD) == 0){
+        if(args_cnt > 1)
+          program_load_bench(args[1]);
+        else
+          uart_printf("Usage: " CMD_BENCH_LOAD " <file>\r\n");
+      }
       else if(strcmp_(args[0], CMD_MKDIR) == 0){
         if(args_cnt == 2){
           int ret = sysc_mkdir(args[1], 0);
@@ -382,6 +540,9 @@ static void shell(){
       else if(strcmp_(args[0], CMD_LS) == 0){
         vfs_dump_root();
       }
+      else if(strcmp_(args[0], CMD_LSDIR) == 0){
+        list_dir(args_cnt > 1 ? args[1] : ".");
+      }
       else if(strcmp_(args[0], CMD_CD) == 0){
         if(args_cnt == 2)
           sysc_chdir(args[1]);
@@ -394,6 +555,30 @@ static void shell(){
         else
         uart_printf("Usage:" CMD_MOUNT " <path> <fs>\t: VFS: Mount specific file system on path\r\n");
       }
+      else if(strcmp_(args[0], CMD_RM) == 0){
+        if(args_cnt == 2){
+          if(sysc_unlink(args[1]) != 0)
+            uart_printf("shell(): Failed to remove: %s\r\n", args[1]);
+        }
+        else
+          uart_printf("Usage:" CMD_RM " <path>\t: VFS: Remove file or empty directory\r\n");
+      }
+      else if(strcmp_(args[0], CMD_OVERLAY) == 0){
+        const overlay_stat *st = overlay_get_stat();
+        uart_printf("overlay: %lu files copied up, %lu bytes, %lu whiteouts\r\n", st->copy_ups, st->bytes_copied, st->whiteouts);
+      }
+      else if(strcmp_(args[0], CMD_FAT) == 0){
+        const fat32_stat *st = fat32fs_get_stat();
+        uart_printf("fat32fs: %lu sector reads, %lu sector writes, cache %lu hits %lu misses, %u of %u clusters free, next free %u\r\n",
+          st->sd_reads, st->sd_writes, st->cache_hits, st->cache_misses, st->free_clusters, st->clusters, st->next_free);
+        uart_printf("fat32fs: %lu data reads, %lu data writes, %lu flushes\r\n", st->data_reads, st->data_writes, st->flushes);
+      }
+      else if(strcmp_(args[0], CMD_SYNC) == 0){
+        uart_printf("sync: %d sectors written\r\n", sysc_sync());
+      }
+      else if(strcmp_(args[0], CMD_BENCH_FAT) == 0){
+        fat32fs_bench();
+      }
       else if(strcmp_(args[0], "run") == 0){
         sysc_exec("/initramfs/vfs2.img", NULL);
       }
@@ -0,0 +1,83 @@
+"""Rewrite a newc cpio archive so data of each large regular file starts on a page boundary.
+
+The kernel then maps such files into a process in place, without copying them, see program_image_get().
+Padding goes into the pathname field: c_namesize grows and the pathname is followed by extra NUL bytes,
+which every newc reader skips since the pathname ends at its first NUL.
+
+    python3 cpio_page_align.py initramfs.cpio initramfs.aligned.cpio   # done by "make run" in lab6
+"""
+import argparse
+
+MAGIC = b"070701"
+HEADER_SIZE = 110
+FIELDS = ["ino", "mode", "uid", "gid", "nlink", "mtime", "filesize",
+          "devmajor", "devminor", "rdevmajor", "rdevminor", "namesize", "check"]
+MODE_TYPE = 0o170000
+MODE_FILE = 0o100000
+TRAILER = b"TRAILER!!!"
+
+
+def pad4(n: int) -> int:
+    return (4 - n % 4) % 4
+
+
+def read_entries(data: bytes):
+    off = 0
+    while True:
+        if data[off:off + 6] != MAGIC:
+            raise ValueError(f"bad magic at offset {off}")
+        hdr = {name: int(data[off + 6 + 8 * i: off + 14 + 8 * i], 16) for i, name in enumerate(FIELDS)}
+        name_start = off + HEADER_SIZE
+        name = data[name_start: name_start + hdr["namesize"] - 1]
+        data_start = name_start + hdr["namesize"]
+        data_start += pad4(data_start)
+        body = data[data_start: data_start + hdr["filesize"]]
+        yield hdr, name, body
+        if name == TRAILER:
+            return
+        off = data_start + hdr["filesize"]
+        off += pad4(off)
+
+
+def write_entry(out: bytearray, hdr: dict, name: bytes, body: bytes, align: int):
+    namesize = len(name) + 1
+    if align:
+        # Smallest namesize putting data right at the next page boundary, header and name need no pad then
+        data_start = len(out) + HEADER_SIZE + namesize
+        namesize += (align - data_start % align) % align
+    hdr = dict(hdr, namesize=namesize, filesize=len(body))
+    out += MAGIC + b"".join(b"%08X" % hdr[f] for f in FIELDS)
+    out += name + b"\0" * (namesize - len(name))
+    out += b"\0" * pad4(len(out))
+    out += body
+    out += b"\0" * pad4(len(out))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("src")
+    parser.add_argument("dst")
+    parser.add_argument("--page-size", type=int, default=4096)
+    parser.add_argument("--min-size", type=int, default=4096,
+                        help="files smaller than this are not aligned, padding would cost more than they save")
+    args = parser.parse_args()
+
+    with open(args.src, "rb") as f:
+        data = f.read()
+
+    out = bytearray()
+    aligned = 0
+    for hdr, name, body in read_entries(data):
+        is_file = (hdr["mode"] & MODE_TYPE) == MODE_FILE
+        align = args.page_size if is_file and len(body) >= args.min_size else 0
+        aligned += align != 0
+        write_entry(out, hdr, name, body, align)
+    out += b"\0" * ((512 - len(out) % 512) % 512)  # block size of cpio
+
+    with open(args.dst, "wb") as f:
+        f.write(out)
+    print(f"{args.dst}: {len(data)} -> {len(out)} bytes, {aligned} files page aligned")
+
+
+if __name__ == "__main__":
+    main()